@@ -9,10 +9,19 @@
 #include "ns3/wifi-module.h"
 #include "ns3/internet-module.h"
 
+#include "sumo_slot_map.h"
+#include "v2x_allocation_counter.h"
+#include "v2x_cam_telemetry.h"
+#include "v2x_connectivity_graph.h"
+#include "v2x_delta_observation.h"
+#include "v2x_observation.h"
+#include "v2x_observation_layout.h"
+#include "v2x_sparse_observation.h"
+#include "v2x_step_profiler.h"
+#include "v2x_trace_replay.h"
+
 #include <algorithm>
 #include <cmath>
-#include <fstream>
-#include <map>
 #include <sstream>
 #include <string>
 #include <unordered_map>
@@ -22,267 +31,145 @@ using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE ("SimpleV2X");
 
-struct VehicleMetrics
-{
-  VehicleMetrics () : position (Vector (0.0, 0.0, 0.0)), speed (0.0), active (false) {}
-  Vector position;
-  double speed;
-  bool active;
-};
-
-struct SumoVehicleState
-{
-  SumoVehicleState () : position (Vector (0.0, 0.0, 0.0)), speed (0.0), vehicleType ("passenger") {}
-  Vector position;
-  double speed;
-  std::string vehicleType;
-};
-
 // Global variables
 NodeContainer g_nodes;
+Ptr<SumoReplayTimeline> g_timeline; // drives the node positions of the trace
 uint32_t g_nodeNum = 0;
 uint32_t g_currentStep = 0;
 double g_envStepTime = 0.1;
+std::string g_profileEventsPath; // CSV of the profiler event ring, written with each dump
 
 bool g_useSumoMobility = false;
-std::vector<std::map<uint32_t, SumoVehicleState>> g_sumoTrajectory;
-std::unordered_map<std::string, uint32_t> g_sumoIdToNodeIndex;
-std::unordered_map<uint32_t, SumoVehicleState> g_currentSumoState;
-uint32_t g_sumoVehicleCount = 0;
-double g_sumoMaxTime = 0.0;
+V2xTraceReplay g_traceReplay;              // loaded trace, replayed one env step at a time
+bool g_interpolateTrace = true;            // interpolate env steps between coarse trace steps
+uint32_t g_parseThreads = 0;               // trace parser threads, 0 = one per core
+bool g_recycleSlots = false;               // nodes are slots shared by vehicles over time
+SumoSlotMap g_slotMap;                     // trajectory vehicle -> node slot, with g_recycleSlots
+SumoSlotOccupancy g_slotOccupancy;         // vehicle of each slot, published in the extra info
 
 std::vector<VehicleMetrics> g_vehicleMetrics;
 
-std::string
-ExtractAttribute (const std::string& line, const std::string& key)
-{
-  std::string token = key + "=\"";
-  auto pos = line.find (token);
-  if (pos == std::string::npos)
-    {
-      return "";
-    }
-  pos += token.size ();
-  auto end = line.find ("\"", pos);
-  if (end == std::string::npos)
-    {
-      return "";
-    }
-  return line.substr (pos, end - pos);
-}
-
-bool
-LoadSumoTrajectory (const std::string& filePath)
-{
-  std::ifstream in (filePath.c_str ());
-  if (!in.is_open ())
-    {
-      NS_LOG_UNCOND ("[SUMO] Failed to open mobility trace: " << filePath);
-      return false;
-    }
-
-  std::string line;
-  double currentTime = 0.0;
-  g_sumoTrajectory.clear ();
-  g_sumoIdToNodeIndex.clear ();
-  g_sumoVehicleCount = 0;
-
-  while (std::getline (in, line))
-    {
-      if (line.find ("<timestep") != std::string::npos)
-        {
-          std::string timeStr = ExtractAttribute (line, "time");
-          if (!timeStr.empty ())
-            {
-              currentTime = std::stod (timeStr);
-            }
-        }
-      else if (line.find ("<vehicle") != std::string::npos)
-        {
-          std::string idStr = ExtractAttribute (line, "id");
-          std::string xStr = ExtractAttribute (line, "x");
-          std::string yStr = ExtractAttribute (line, "y");
-          std::string speedStr = ExtractAttribute (line, "speed");
-          std::string typeStr = ExtractAttribute (line, "type");
-
-          if (idStr.empty () || xStr.empty () || yStr.empty ())
-            {
-              continue;
-            }
-
-          double x = std::stod (xStr);
-          double y = std::stod (yStr);
-          double speed = speedStr.empty () ? 0.0 : std::stod (speedStr);
-          std::string vehicleType = typeStr.empty () ? "passenger" : typeStr;
-
-          if (g_envStepTime <= 0.0)
-            {
-              g_envStepTime = 0.1;
-            }
-          uint32_t timestepIndex = static_cast<uint32_t> (std::round (currentTime / g_envStepTime));
-          if (g_sumoTrajectory.size () <= timestepIndex)
-            {
-              g_sumoTrajectory.resize (timestepIndex + 1);
-            }
-
-          uint32_t nodeIndex;
-          auto it = g_sumoIdToNodeIndex.find (idStr);
-          if (it == g_sumoIdToNodeIndex.end ())
-            {
-              nodeIndex = g_sumoIdToNodeIndex.size ();
-              g_sumoIdToNodeIndex[idStr] = nodeIndex;
-            }
-          else
-            {
-              nodeIndex = it->second;
-            }
-
-          SumoVehicleState state;
-          state.position = Vector (x, y, 0.0);
-          state.speed = speed;
-          state.vehicleType = vehicleType;
-
-          g_sumoTrajectory[timestepIndex][nodeIndex] = state;
-        }
-    }
-
-  g_sumoVehicleCount = g_sumoIdToNodeIndex.size ();
-  if (!g_sumoTrajectory.empty ())
-    {
-      g_sumoMaxTime = g_envStepTime * (g_sumoTrajectory.size () - 1);
-    }
-
-  NS_LOG_UNCOND ("[SUMO] Loaded mobility trace: " << g_sumoVehicleCount << " vehicles, "
-                 << g_sumoTrajectory.size () << " timesteps from " << filePath);
-
-  return (g_sumoVehicleCount > 0 && !g_sumoTrajectory.empty ());
-}
-
-void
-InitializeVehicleMetrics ()
-{
-  g_vehicleMetrics.clear ();
-  g_vehicleMetrics.resize (g_nodes.GetN ());
-}
+Ptr<V2xObservationContainer> g_observation; // reused across steps
+V2xSparseObservation::Encoding g_obsEncoding = V2xSparseObservation::DENSE;
+V2xSparseObservation g_sparseObservation;   // active-only row staged for --obsEncoding=list|csr
+V2xDeltaEncoder g_deltaEncoder;             // keyframes and deltas for --obsEncoding=delta
+Ptr<V2xDeltaObservationContainer> g_deltaObservation;
+uint64_t g_observationAllocations = 0;      // heap allocations of the last observation build
+uint64_t g_stepAllocations = 0;             // heap allocations of the last full step
+uint64_t g_stepAllocationMark = 0;
+
+bool g_enableCam = false;         // append per-vehicle 802.11p link stats to the observation
+V2xCamTelemetry g_camTelemetry;
+uint32_t g_graphStats = 0;        // V2xConnectivityGraph::Stat mask appended to the observation
+V2xConnectivityGraph g_connectivity;
+V2xObservationOps g_observationOps; // row builder specialized for the enabled features
 
 void
 UpdateVehicleMetrics ()
 {
-  if (g_vehicleMetrics.size () != g_nodes.GetN ())
+  V2X_PROFILE_SCOPE (METRICS);
+  if (g_vehicleMetrics.size () != g_nodeNum)
     {
-      InitializeVehicleMetrics ();
+      ResetVehicleMetrics (g_vehicleMetrics, g_nodeNum);
     }
 
   if (g_useSumoMobility)
     {
-      for (uint32_t i = 0; i < g_vehicleMetrics.size (); ++i)
-        {
-          auto it = g_currentSumoState.find (i);
-          if (it != g_currentSumoState.end ())
-            {
-              g_vehicleMetrics[i].position = it->second.position;
-              g_vehicleMetrics[i].speed = it->second.speed;
-              g_vehicleMetrics[i].active = true;
-            }
-          else
-            {
-              g_vehicleMetrics[i].position = Vector (0.0, 0.0, 0.0);
-              g_vehicleMetrics[i].speed = 0.0;
-              g_vehicleMetrics[i].active = false;
-            }
-        }
-    }
-  else
-    {
-      for (uint32_t i = 0; i < g_nodes.GetN (); ++i)
-        {
-          Ptr<Node> node = g_nodes.Get (i);
-          Ptr<MobilityModel> mobility = node->GetObject<MobilityModel> ();
-
-          if (mobility)
-            {
-              Vector pos = mobility->GetPosition ();
-              Vector vel = mobility->GetVelocity ();
-              double speed = std::sqrt (vel.x * vel.x + vel.y * vel.y);
-
-              g_vehicleMetrics[i].position = pos;
-              g_vehicleMetrics[i].speed = speed;
-              g_vehicleMetrics[i].active = true;
-            }
-          else
-            {
-              g_vehicleMetrics[i].position = Vector (0.0, 0.0, 0.0);
-              g_vehicleMetrics[i].speed = 0.0;
-              g_vehicleMetrics[i].active = false;
-            }
-        }
+      // Trace replay fills the metrics straight from the trajectory slice in ApplySumoMobility
+      return;
     }
+  UpdateMetricsFromMobility (g_nodes, g_vehicleMetrics);
 }
 
 void
 ApplySumoMobility (uint32_t timestep)
 {
-  if (!g_useSumoMobility || g_sumoTrajectory.empty ())
+  V2X_PROFILE_SCOPE (MOBILITY);
+  if (!g_useSumoMobility || g_traceReplay.IsEmpty ())
     {
       UpdateVehicleMetrics ();
       return;
     }
 
-  uint32_t clampedStep = std::min (timestep, static_cast<uint32_t> (g_sumoTrajectory.size () - 1));
-  
-  // 디버깅: 처음 10 스텝만 로그
-  static int logCount = 0;
-  if (logCount < 10)
+  ResetVehicleMetrics (g_vehicleMetrics, g_nodeNum);
+  V2xReplayTarget target (g_nodes, g_vehicleMetrics, g_nodeNum,
+                          g_recycleSlots ? &g_slotMap : nullptr, &g_slotOccupancy);
+  target.SetTimeline (g_timeline);
+  // Past the end of the trace the last step is held
+  g_traceReplay.ForEachSample (timestep, false, target);
+  NS_ABORT_MSG_IF (timestep == 0 && !target.HasAllNodes (),
+                   "Vehicles were placed on slots without a node: " << g_nodes.GetN () << " of "
+                                                                     << g_nodeNum << " nodes created");
+}
+
+/// Bring the metrics, CAM link stats and connectivity graph to the current env step.
+void
+UpdateVehicleState ()
+{
+  if (g_useSumoMobility)
     {
-      NS_LOG_UNCOND ("🔍 ApplySumoMobility: timestep=" << timestep << ", clampedStep=" << clampedStep 
-                     << ", trajectorySize=" << g_sumoTrajectory.size ());
-      logCount++;
+      ApplySumoMobility (g_currentStep);
     }
-  
-  const auto& states = g_sumoTrajectory[clampedStep];
-  
-  // 디버깅: 첫 번째 차량의 위치 로그
-  if (logCount <= 10 && !states.empty())
+  else
     {
-      const auto& firstVehicle = states.begin()->second;
-      NS_LOG_UNCOND ("   → Vehicle 0 position: (" << firstVehicle.position.x 
-                     << ", " << firstVehicle.position.y << "), speed=" << firstVehicle.speed);
+      UpdateVehicleMetrics ();
     }
-
-  g_currentSumoState.clear ();
-
-  for (const auto& entry : states)
+  if (g_enableCam)
     {
-      uint32_t nodeIndex = entry.first;
-      if (nodeIndex >= g_nodes.GetN ())
-        {
-          continue;
-        }
-
-      Ptr<Node> node = g_nodes.Get (nodeIndex);
-      Ptr<MobilityModel> mobility = node->GetObject<MobilityModel> ();
-      Ptr<ConstantPositionMobilityModel> constant = DynamicCast<ConstantPositionMobilityModel> (mobility);
-
-      if (!constant)
+      // Close the link stats window of the last step; only vehicles present now keep broadcasting
+      V2X_PROFILE_SCOPE (METRICS);
+      g_camTelemetry.CollectStep (g_envStepTime);
+      for (uint32_t i = 0; i < g_vehicleMetrics.size (); ++i)
         {
-          constant = CreateObject<ConstantPositionMobilityModel> ();
-          node->AggregateObject (constant);
+          g_camTelemetry.SetActive (i, g_vehicleMetrics[i].active);
         }
-
-      constant->SetPosition (entry.second.position);
-      g_currentSumoState[nodeIndex] = entry.second;
     }
+  if (g_graphStats != 0 || g_enableCam)
+    {
+      V2X_PROFILE_SCOPE (METRICS);
+      g_connectivity.Update (g_vehicleMetrics); // after the CAM window of the last step is closed
+    }
+}
+
+uint32_t
+GetObservationSize ()
+{
+  return g_observationOps.getSize (g_nodeNum, g_graphStats);
+}
 
-  UpdateVehicleMetrics ();
+V2xObservationSource
+GetObservationSource ()
+{
+  V2xObservationSource source;
+  source.metrics = &g_vehicleMetrics;
+  source.nodeCount = g_nodeNum;
+  source.cam = &g_camTelemetry;
+  source.graph = &g_connectivity;
+  source.graphStats = g_graphStats;
+  return source;
 }
 
 Ptr<OpenGymSpace>
 MyGetObservationSpace (void)
 {
-  uint32_t obsSize = 4 + (g_nodeNum * 3);
-  float low = -1000.0;
-  float high = 1000.0;
+  uint32_t obsSize = GetObservationSize ();
+  float low = -g_observationOps.bound;
+  float high = g_observationOps.bound;
   std::vector<uint32_t> shape = {obsSize};
+  if (g_obsEncoding == V2xSparseObservation::DELTA)
+    {
+      // Upper bound of the keyframe/delta payload, see v2x_delta_observation.h
+      shape = {static_cast<uint32_t> (V2xDeltaEncoder::GetMaxSize (obsSize))};
+      Ptr<OpenGymBoxSpace> space =
+          CreateObject<OpenGymBoxSpace> (0.0f, 4294967295.0f, shape, TypeNameGet<uint32_t> ());
+      NS_LOG_UNCOND ("MyGetObservationSpace: " << space);
+      return space;
+    }
+  if (V2xSparseObservation::IsSparse (g_obsEncoding))
+    {
+      // Upper bound of the variable-length payload; its header describes the actual layout
+      shape = {static_cast<uint32_t> (g_sparseObservation.GetMaxSize (1, g_nodeNum))};
+    }
   std::string dtype = TypeNameGet<float> ();
   Ptr<OpenGymBoxSpace> space = CreateObject<OpenGymBoxSpace> (low, high, shape, dtype);
   NS_LOG_UNCOND ("MyGetObservationSpace: " << space);
@@ -306,69 +193,64 @@ bool
 MyGetGameOver (void)
 {
   bool isGameOver = (g_currentStep >= 1000);
-  NS_LOG_UNCOND ("MyGetGameOver: " << isGameOver);
+  LOG_STEP ("MyGetGameOver: " << isGameOver);
   return isGameOver;
 }
 
+/// Encode the current metrics with an entry for active vehicles only.
+Ptr<V2xObservationContainer>
+BuildSparseObservation ()
+{
+  if (!g_observation)
+    {
+      g_observation = CreateObject<V2xObservationContainer> (std::vector<uint32_t> {0});
+    }
+  g_sparseObservation.Reset (1);
+  const float* fleet = g_observationOps.buildSparseRow (GetObservationSource (), g_sparseObservation, 0);
+  g_observation->SetShape ({static_cast<uint32_t> (g_sparseObservation.GetEncodedSize ())});
+  g_sparseObservation.Encode (g_observation->GetData ());
+  LOG_STEP ("MyGetObservation: Active vehicles=" << fleet[0] << " avg_speed=" << fleet[1]);
+  return g_observation;
+}
+
 Ptr<OpenGymDataContainer>
 MyGetObservation (void)
 {
-  NS_LOG_UNCOND ("MyGetObservation: Step " << g_currentStep);
+  LOG_STEP ("MyGetObservation: Step " << g_currentStep);
+  V2X_PROFILE_SCOPE (OBSERVATION);
+  uint64_t allocationMark = GetAllocationCount ();
 
-  // ✅ 수정: observation 직전에 최신 SUMO 상태 적용
-  if (g_useSumoMobility)
+  if (V2xSparseObservation::IsSparse (g_obsEncoding))
     {
-      ApplySumoMobility (g_currentStep);
+      Ptr<V2xObservationContainer> sparse = BuildSparseObservation ();
+      sparse->Pack ();
+      g_observationAllocations = GetAllocationCount () - allocationMark;
+      return sparse;
     }
 
-  uint32_t obsSize = 4 + (g_nodeNum * 3);
-  std::vector<uint32_t> shape = {obsSize};
-  Ptr<OpenGymBoxContainer<float>> box = CreateObject<OpenGymBoxContainer<float>> (shape);
-
-  uint32_t activeNodes = 0;
-  double totalSpeed = 0.0;
-  double avgX = 0.0;
-  double avgY = 0.0;
-
-  for (const auto& metrics : g_vehicleMetrics)
+  uint32_t obsSize = GetObservationSize ();
+  if (!g_observation || g_observation->GetSize () != obsSize)
     {
-      if (metrics.active)
-        {
-          activeNodes++;
-          totalSpeed += metrics.speed;
-          avgX += metrics.position.x;
-          avgY += metrics.position.y;
-        }
+      g_observation = CreateObject<V2xObservationContainer> (std::vector<uint32_t> {obsSize});
     }
+  float* obs = g_observation->GetData ();
+  g_observationOps.buildDense (GetObservationSource (), obs);
 
-  double avgSpeed = (activeNodes > 0) ? totalSpeed / activeNodes : 0.0;
-  double avgPosX = (activeNodes > 0) ? avgX / activeNodes : 0.0;
-  double avgPosY = (activeNodes > 0) ? avgY / activeNodes : 0.0;
-
-  box->AddValue (static_cast<float> (activeNodes));
-  box->AddValue (static_cast<float> (avgSpeed));
-  box->AddValue (static_cast<float> (avgPosX));
-  box->AddValue (static_cast<float> (avgPosY));
-
-  for (uint32_t i = 0; i < g_nodeNum; ++i)
+  LOG_STEP ("MyGetObservation: Active vehicles=" << obs[0] << " avg_speed=" << obs[1]);
+  if (g_obsEncoding == V2xSparseObservation::DELTA)
     {
-      if (i < g_vehicleMetrics.size () && g_vehicleMetrics[i].active)
+      if (!g_deltaObservation)
         {
-          const auto& metrics = g_vehicleMetrics[i];
-          box->AddValue (static_cast<float> (metrics.position.x));
-          box->AddValue (static_cast<float> (metrics.position.y));
-          box->AddValue (static_cast<float> (metrics.speed));
-        }
-      else
-        {
-          box->AddValue (0.0f);
-          box->AddValue (0.0f);
-          box->AddValue (0.0f);
+          g_deltaObservation = CreateObject<V2xDeltaObservationContainer> ();
         }
+      g_deltaEncoder.Encode (obs, obsSize, *g_deltaObservation);
+      g_deltaObservation->Pack ();
+      g_observationAllocations = GetAllocationCount () - allocationMark;
+      return g_deltaObservation;
     }
-
-  NS_LOG_UNCOND ("MyGetObservation: Active vehicles=" << activeNodes << " avg_speed=" << avgSpeed);
-  return box;
+  g_observation->Pack (); // serialized here so obsAllocs covers it, not when OpenGym asks for it
+  g_observationAllocations = GetAllocationCount () - allocationMark;
+  return g_observation;
 }
 
 float
@@ -384,7 +266,7 @@ MyGetReward (void)
     }
 
   float reward = static_cast<float> (g_currentStep * 0.05 + activeNodes * 0.1);
-  NS_LOG_UNCOND ("MyGetReward: " << reward << " (active=" << activeNodes << ")");
+  LOG_STEP ("MyGetReward: " << reward << " (active=" << activeNodes << ")");
   return reward;
 }
 
@@ -392,22 +274,28 @@ std::string
 MyGetExtraInfo (void)
 {
   std::ostringstream info;
-  info << "step:" << g_currentStep << ";vehicles:" << g_vehicleMetrics.size ();
-  NS_LOG_UNCOND ("MyGetExtraInfo: " << info.str ());
+  info << "step:" << g_currentStep << ";vehicles:" << g_vehicleMetrics.size ()
+       << ";obsAllocs:" << g_observationAllocations << ";stepAllocs:" << g_stepAllocations;
+  if (g_recycleSlots)
+    {
+      // Slot assignments since the last exchange, as slot=vehicleId
+      info << ";slots:";
+      g_slotOccupancy.WriteChanges (info, std::string (), false, false);
+    }
+  LOG_STEP ("MyGetExtraInfo: " << info.str ());
   return info.str ();
 }
 
 bool
 MyExecuteActions (Ptr<OpenGymDataContainer> action)
 {
-  NS_LOG_UNCOND ("MyExecuteActions: Step " << g_currentStep
-                 << " at sim time " << Simulator::Now ().GetSeconds ());
-  NS_LOG_UNCOND ("MyExecuteActions: Received action: " << action);
+  V2X_PROFILE_SCOPE (ACTION);
+  LOG_STEP ("MyExecuteActions: Step " << g_currentStep
+            << " at sim time " << Simulator::Now ().GetSeconds ());
+  LOG_STEP ("MyExecuteActions: Received action: " << action);
 
   g_currentStep++;
-  NS_LOG_UNCOND ("MyExecuteActions: Moving to step " << g_currentStep);
-
-  // ✅ 수정: SUMO 상태 업데이트는 MyGetObservation에서 처리
+  LOG_STEP ("MyExecuteActions: Moving to step " << g_currentStep);
 
   return true;
 }
@@ -415,15 +303,20 @@ MyExecuteActions (Ptr<OpenGymDataContainer> action)
 void
 ScheduleNextStateRead (double envStepTime, Ptr<OpenGymInterface> openGym)
 {
-  NS_LOG_UNCOND ("ScheduleNextStateRead: Sim time=" << Simulator::Now ().GetSeconds () << "s");
-
-  // ✅ 수정: SUMO 상태는 MyExecuteActions에서 이미 업데이트됨
-  if (!g_useSumoMobility)
+  LOG_STEP ("ScheduleNextStateRead: Sim time=" << Simulator::Now ().GetSeconds () << "s");
+  g_v2xStepProfiler.SetStep (g_currentStep);
+  if (V2xStepProfiler::TakeDumpRequest ())
     {
-      UpdateVehicleMetrics ();
+      g_v2xStepProfiler.DumpReport (g_profileEventsPath);
     }
+  uint64_t allocationCount = GetAllocationCount ();
+  g_stepAllocations = allocationCount - g_stepAllocationMark;
+  g_stepAllocationMark = allocationCount;
+
+  UpdateVehicleState ();
 
   Simulator::Schedule (Seconds (envStepTime), &ScheduleNextStateRead, envStepTime, openGym);
+  V2X_PROFILE_SCOPE (EXCHANGE); // self time excludes the callbacks run inside
   openGym->NotifyCurrentState ();
 }
 
@@ -434,21 +327,120 @@ main (int argc, char* argv[])
   uint32_t openGymPort = 5555;
   double envStepTime = 0.1;     // seconds
   std::string sumoTracePath = "";
+  bool useTraceCache = true;
+  bool recycleSlots = false;
+  std::string compileTracePath = "";
+  bool enableCam = false;
+  double camInterval = 0.1;
+  uint32_t camSize = 200;
+  std::string graphStats = "";
+  std::string obsEncoding = "dense";
+  uint32_t logInterval = 10;
+  bool profile = false;
+  uint32_t keyframeInterval = 50;
+  double deltaEpsilon = 0.0;
+  double commRange = 300.0;
 
   CommandLine cmd;
   cmd.AddValue ("openGymPort", "Port number for OpenGym env. Default: 5555", openGymPort);
   cmd.AddValue ("simTime", "Simulation time", simulationTime);
-  cmd.AddValue ("sumoTrace", "Path to SUMO FCD mobility trace (.xml)", sumoTracePath);
+  cmd.AddValue ("logInterval", "Log every N steps (0 disables per-step logging, 1 logs every step)",
+                logInterval);
+  cmd.AddValue ("profile",
+                "Record per-phase step latency histograms, logged at exit and on SIGUSR1",
+                profile);
+  cmd.AddValue ("profileEvents", "Write the recent profiler events to this CSV with each dump",
+                g_profileEventsPath);
+  cmd.AddValue ("sumoTrace", "Path to SUMO FCD mobility trace (.xml) or compiled trace",
+                sumoTracePath);
+  cmd.AddValue ("sumoTraceCache",
+                "Map the compiled <trace>.v2xtrace sidecar, refreshing it when stale",
+                useTraceCache);
+  cmd.AddValue ("compileTrace", "Compile --sumoTrace into this binary trace file and exit",
+                compileTracePath);
+  cmd.AddValue ("recycleSlots",
+                "Size the node pool to peak vehicle concurrency and reuse the nodes of departed "
+                "vehicles; assignments are published as slots:slot=vehicleId in the extra info",
+                recycleSlots);
+  cmd.AddValue ("parseThreads",
+                "Threads parsing an XML trace in parallel chunks (0 = one per core, 1 = serial)",
+                g_parseThreads);
+  cmd.AddValue ("interpolateTrace",
+                "Interpolate env steps that fall between the timesteps of a coarser trace",
+                g_interpolateTrace);
+  cmd.AddValue ("enableCam",
+                "Install 802.11p OCB devices, broadcast CAMs and append per-vehicle delivery "
+                "ratio, latency (ms) and channel busy ratio to the observation",
+                enableCam);
+  cmd.AddValue ("camInterval", "CAM broadcast interval in seconds", camInterval);
+  cmd.AddValue ("camSize", "CAM payload size in bytes", camSize);
+  cmd.AddValue ("obsEncoding",
+                "Observation layout: dense (a block per vehicle node), list or csr (active vehicles "
+                "only, self-describing header), delta (dense values as keyframes and changes)",
+                obsEncoding);
+  cmd.AddValue ("keyframeInterval", "Exchanges per delta keyframe, the keyframe included",
+                keyframeInterval);
+  cmd.AddValue ("deltaEpsilon",
+                "Quantum of the delta encoding; values are reconstructed within epsilon/2 "
+                "(0 = exact float values)",
+                deltaEpsilon);
+  cmd.AddValue ("graphStats",
+                "Connectivity stats appended to the observation: comma separated clusters, "
+                "largest, meanDegree, isolated, degree (empty disables)",
+                graphStats);
+  cmd.AddValue ("commRange",
+                "Communication range in meters for the connectivity graph and the CAM delivery ratio",
+                commRange);
   cmd.Parse (argc, argv);
 
   g_envStepTime = envStepTime;
+  g_v2xStepLog.SetInterval (logInterval);
+  if (profile || !g_profileEventsPath.empty ())
+    {
+      g_v2xStepProfiler.Enable (1 << 16);
+      V2xStepProfiler::InstallSignalHandler ();
+    }
+  g_enableCam = enableCam;
+  if (!V2xConnectivityGraph::ParseStats (graphStats, g_graphStats))
+    {
+      NS_LOG_UNCOND ("[Config] Unknown --graphStats entry in '" << graphStats << "'");
+      return 1;
+    }
+  g_connectivity.Configure (commRange, g_graphStats);
+  if (!V2xSparseObservation::ParseEncoding (obsEncoding, g_obsEncoding))
+    {
+      NS_LOG_UNCOND ("[Config] Unknown --obsEncoding '" << obsEncoding << "'");
+      return 1;
+    }
+  g_observationOps = V2xObservationOps::Select (g_enableCam, g_graphStats);
+  g_sparseObservation.Configure (g_obsEncoding, g_observationOps.getSparseRowFields (g_graphStats),
+                                 g_observationOps.entryFields);
+  g_deltaEncoder.Configure (keyframeInterval, static_cast<float> (deltaEpsilon));
+
+  g_traceReplay.Configure (g_envStepTime, g_parseThreads, g_interpolateTrace);
+  if (!compileTracePath.empty ())
+    {
+      bool compiled = !sumoTracePath.empty () && g_traceReplay.Parse (sumoTracePath)
+                      && g_traceReplay.Compile (sumoTracePath, compileTracePath);
+      return compiled ? 0 : 1;
+    }
 
   if (!sumoTracePath.empty ())
     {
-      g_useSumoMobility = LoadSumoTrajectory (sumoTracePath);
+      g_useSumoMobility = g_traceReplay.Load (sumoTracePath, useTraceCache);
+      g_envStepTime = g_traceReplay.GetEnvStepTime ();
       if (g_useSumoMobility)
         {
-          g_nodeNum = g_sumoVehicleCount;
+          g_nodeNum = g_traceReplay.GetVehicleCount ();
+        }
+      if (g_useSumoMobility && recycleSlots)
+        {
+          g_recycleSlots = true;
+          g_slotMap.Build (g_traceReplay.GetView ());
+          g_nodeNum = g_slotMap.GetSlotCount ();
+          g_slotOccupancy.Resize (g_nodeNum, &g_traceReplay.GetView ());
+          NS_LOG_UNCOND ("[SUMO] Recycling node slots: " << g_nodeNum << " slots for "
+                         << g_traceReplay.GetVehicleCount () << " vehicles");
         }
     }
 
@@ -463,17 +455,19 @@ main (int argc, char* argv[])
   NS_LOG_UNCOND ("Environment step time: " << envStepTime << "s");
   NS_LOG_UNCOND ("SUMO mobility enabled: " << (g_useSumoMobility ? "yes" : "no"));
   NS_LOG_UNCOND ("Num vehicles: " << g_nodeNum);
+  NS_LOG_UNCOND ("Log interval: " << logInterval);
 
-  g_nodes.Create (g_nodeNum);
-  InitializeVehicleMetrics ();
-  NS_LOG_UNCOND ("Created " << g_nodeNum << " vehicle nodes");
+  // CAM devices are installed once, so only a pool without them is filled lazily
+  g_nodes.Create (g_recycleSlots && !g_enableCam ? 0 : g_nodeNum);
+  ResetVehicleMetrics (g_vehicleMetrics, g_nodeNum);
+  NS_LOG_UNCOND ((g_recycleSlots && !g_enableCam ? "Reserved " : "Created ") << g_nodeNum
+                 << " vehicle nodes");
 
   if (g_useSumoMobility)
     {
-      MobilityHelper mobility;
-      mobility.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-      mobility.Install (g_nodes);
-      NS_LOG_UNCOND ("Installed SUMO-driven constant position mobility models");
+      g_traceReplay.BuildNodeTracks (g_nodeNum, g_recycleSlots ? &g_slotMap : nullptr);
+      g_timeline = g_traceReplay.InstallMobility (g_nodes, 0, false);
+      NS_LOG_UNCOND ("Installed trace replay mobility models, positions are evaluated on demand");
 
       ApplySumoMobility (0);
     }
@@ -494,6 +488,14 @@ main (int argc, char* argv[])
       UpdateVehicleMetrics ();
     }
 
+  if (g_enableCam)
+    {
+      // Fixed streams from 0, clear of the automatically assigned ones
+      g_camTelemetry.Install (g_nodes, camInterval, camSize, g_connectivity, 0);
+      NS_LOG_UNCOND ("Installed 802.11p OCB devices, CAM every " << camInterval << "s ("
+                     << camSize << " bytes)");
+    }
+
   Ptr<OpenGymInterface> openGym = CreateObject<OpenGymInterface> (openGymPort);
   openGym->SetGetActionSpaceCb (MakeCallback (&MyGetActionSpace));
   openGym->SetGetObservationSpaceCb (MakeCallback (&MyGetObservationSpace));
@@ -504,15 +506,8 @@ main (int argc, char* argv[])
   openGym->SetExecuteActionsCb (MakeCallback (&MyExecuteActions));
   NS_LOG_UNCOND ("OpenGym callbacks configured");
 
-  // ✅ 수정: 초기 상태(step 0) 준비
-  if (g_useSumoMobility)
-    {
-      ApplySumoMobility (0);
-    }
-  else
-    {
-      UpdateVehicleMetrics ();
-    }
+  // Initial state (step 0)
+  UpdateVehicleState ();
 
   Simulator::Schedule (Seconds (envStepTime), &ScheduleNextStateRead, envStepTime, openGym);
 
@@ -524,6 +519,7 @@ main (int argc, char* argv[])
   Simulator::Run ();
 
   NS_LOG_UNCOND ("=== Simulation Complete ===");
+  g_v2xStepProfiler.DumpReport (g_profileEventsPath);
   openGym->NotifySimulationEnd ();
   Simulator::Destroy ();
 
@@ -0,0 +1,369 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Streaming tokenizer for SUMO FCD (floating car data) XML exports
+ *
+ * The parser reads the trace through one large reusable buffer, scans every
+ * element exactly once and hands attribute values to the caller as views into
+ * that buffer. Numbers are converted in place with std::from_chars, so parsing
+ * a <vehicle> element performs no heap allocation. Elements may span several
+ * lines and attributes may appear in any order.
+ */
+
+#ifndef SUMO_FCD_PARSER_H
+#define SUMO_FCD_PARSER_H
+
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * One <vehicle> element of an FCD timestep. The string views point into the
+ * parser buffer and are only valid for the duration of the callback.
+ */
+struct SumoFcdVehicle
+{
+  std::string_view id;
+  std::string_view type;
+  double x = 0.0;
+  double y = 0.0;
+  double speed = 0.0;
+  bool hasX = false;
+  bool hasY = false;
+  bool hasSpeed = false;
+};
+
+struct SumoFcdParseStats
+{
+  uint64_t bytes = 0;
+  uint64_t timesteps = 0;
+  uint64_t vehicles = 0;
+  uint64_t skippedVehicles = 0; // <vehicle> elements of skipped timesteps, not tokenized
+  double seconds = 0.0;
+
+  double GetThroughputMBps () const
+  {
+    return (seconds > 0.0) ? (bytes / (1024.0 * 1024.0)) / seconds : 0.0;
+  }
+};
+
+inline bool
+ParseFcdNumber (std::string_view text, double& value)
+{
+  const char* begin = text.data ();
+  const char* end = begin + text.size ();
+  if (begin != end && *begin == '+')
+    {
+      ++begin;
+    }
+  auto result = std::from_chars (begin, end, value);
+  return result.ec == std::errc () && result.ptr == end;
+}
+
+class SumoFcdParser
+{
+public:
+  static constexpr std::size_t kDefaultBufferSize = 4u << 20;
+
+  explicit SumoFcdParser (std::size_t bufferSize = kDefaultBufferSize)
+    : m_buffer (bufferSize > 0 ? bufferSize : kDefaultBufferSize)
+  {
+  }
+
+  /**
+   * Stream the file and invoke onTimestep (double time) for every <timestep>
+   * and onVehicle (const SumoFcdVehicle&) for every <vehicle> element. When
+   * onTimestep returns bool, returning false skips the vehicles of that
+   * timestep without parsing their attributes.
+   */
+  template <typename TimestepFn, typename VehicleFn>
+  bool
+  Parse (const std::string& filePath, TimestepFn&& onTimestep, VehicleFn&& onVehicle)
+  {
+    return ParseRange (filePath, 0, UINT64_MAX, onTimestep, onVehicle);
+  }
+
+  /**
+   * Parse only the bytes [beginOffset, endOffset) of the file. The range
+   * should start at an element boundary; an element cut by endOffset is
+   * ignored.
+   */
+  template <typename TimestepFn, typename VehicleFn>
+  bool
+  ParseRange (const std::string& filePath, uint64_t beginOffset, uint64_t endOffset,
+              TimestepFn&& onTimestep, VehicleFn&& onVehicle)
+  {
+    m_stats = SumoFcdParseStats ();
+    m_skipVehicles = false;
+    m_abort = false;
+    std::FILE* file = std::fopen (filePath.c_str (), "rb");
+    if (file == nullptr)
+      {
+        return false;
+      }
+    if (beginOffset > 0 && std::fseek (file, static_cast<long> (beginOffset), SEEK_SET) != 0)
+      {
+        std::fclose (file);
+        return false;
+      }
+
+    auto start = std::chrono::steady_clock::now ();
+    uint64_t remaining = endOffset > beginOffset ? endOffset - beginOffset : 0;
+    std::size_t carry = 0;
+    bool eof = (remaining == 0);
+    while (!eof && !m_abort)
+      {
+        if (carry == m_buffer.size ())
+          {
+            // A single element is larger than the buffer
+            m_buffer.resize (m_buffer.size () * 2);
+          }
+        std::size_t wanted =
+            static_cast<std::size_t> (std::min<uint64_t> (m_buffer.size () - carry, remaining));
+        std::size_t got = std::fread (m_buffer.data () + carry, 1, wanted, file);
+        m_stats.bytes += got;
+        remaining -= got;
+        eof = (got < wanted) || remaining == 0;
+
+        const char* begin = m_buffer.data ();
+        const char* end = begin + carry + got;
+        std::size_t consumed = ParseBuffer (begin, end, eof, onTimestep, onVehicle);
+        carry = static_cast<std::size_t> (end - begin) - consumed;
+        if (carry > 0)
+          {
+            std::memmove (m_buffer.data (), begin + consumed, carry);
+          }
+      }
+
+    bool ok = (std::ferror (file) == 0);
+    std::fclose (file);
+    m_stats.seconds =
+        std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    return ok;
+  }
+
+  /// Called from a callback: stop reading once the current buffer has been parsed.
+  void
+  Abort ()
+  {
+    m_abort = true;
+    m_skipVehicles = true;
+  }
+
+  const SumoFcdParseStats&
+  GetStats () const
+  {
+    return m_stats;
+  }
+
+private:
+  static bool
+  IsSpace (char c)
+  {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+  }
+
+  static bool
+  NameIs (const char* p, const char* end, const char* name, std::size_t len)
+  {
+    if (static_cast<std::size_t> (end - p) < len || std::memcmp (p, name, len) != 0)
+      {
+        return false;
+      }
+    return (p + len == end) || IsSpace (p[len]) || p[len] == '/';
+  }
+
+  /// Find the closing '>' of the element starting at p, ignoring quoted text.
+  static const char*
+  FindElementEnd (const char* p, const char* end)
+  {
+    if (end - p >= 4 && std::memcmp (p, "<!--", 4) == 0)
+      {
+        for (const char* q = p + 4; q + 2 < end; ++q)
+          {
+            if (q[0] == '-' && q[1] == '-' && q[2] == '>')
+              {
+                return q + 2;
+              }
+          }
+        return nullptr;
+      }
+
+    char quote = 0;
+    for (const char* q = p + 1; q < end; ++q)
+      {
+        char c = *q;
+        if (quote != 0)
+          {
+            if (c == quote)
+              {
+                quote = 0;
+              }
+          }
+        else if (c == '"' || c == '\'')
+          {
+            quote = c;
+          }
+        else if (c == '>')
+          {
+            return q;
+          }
+      }
+    return nullptr;
+  }
+
+  /// Call fn (name, value) for every attribute in [p, end).
+  template <typename AttributeFn>
+  static void
+  ForEachAttribute (const char* p, const char* end, AttributeFn&& fn)
+  {
+    while (p < end)
+      {
+        while (p < end && (IsSpace (*p) || *p == '/'))
+          {
+            ++p;
+          }
+        const char* nameBegin = p;
+        while (p < end && *p != '=' && !IsSpace (*p))
+          {
+            ++p;
+          }
+        const char* nameEnd = p;
+        while (p < end && IsSpace (*p))
+          {
+            ++p;
+          }
+        if (p >= end || *p != '=')
+          {
+            return;
+          }
+        ++p;
+        while (p < end && IsSpace (*p))
+          {
+            ++p;
+          }
+        if (p >= end || (*p != '"' && *p != '\''))
+          {
+            return;
+          }
+        char quote = *p++;
+        const char* valueBegin = p;
+        while (p < end && *p != quote)
+          {
+            ++p;
+          }
+        if (p >= end)
+          {
+            return;
+          }
+        fn (std::string_view (nameBegin, nameEnd - nameBegin),
+            std::string_view (valueBegin, p - valueBegin));
+        ++p;
+      }
+  }
+
+  template <typename TimestepFn, typename VehicleFn>
+  void
+  ParseElement (const char* p, const char* end, TimestepFn& onTimestep, VehicleFn& onVehicle)
+  {
+    if (NameIs (p, end, "vehicle", 7))
+      {
+        if (m_skipVehicles)
+          {
+            m_stats.skippedVehicles++;
+            return;
+          }
+        SumoFcdVehicle vehicle;
+        ForEachAttribute (p + 7, end, [&vehicle] (std::string_view name, std::string_view value) {
+          if (name == "id")
+            {
+              vehicle.id = value;
+            }
+          else if (name == "x")
+            {
+              vehicle.hasX = ParseFcdNumber (value, vehicle.x);
+            }
+          else if (name == "y")
+            {
+              vehicle.hasY = ParseFcdNumber (value, vehicle.y);
+            }
+          else if (name == "speed")
+            {
+              vehicle.hasSpeed = ParseFcdNumber (value, vehicle.speed);
+            }
+          else if (name == "type")
+            {
+              vehicle.type = value;
+            }
+        });
+        m_stats.vehicles++;
+        onVehicle (vehicle);
+      }
+    else if (NameIs (p, end, "timestep", 8))
+      {
+        double time = 0.0;
+        bool hasTime = false;
+        ForEachAttribute (p + 8, end, [&] (std::string_view name, std::string_view value) {
+          if (name == "time")
+            {
+              hasTime = ParseFcdNumber (value, time);
+            }
+        });
+        m_stats.timesteps++;
+        if (hasTime)
+          {
+            if constexpr (std::is_same_v<std::invoke_result_t<TimestepFn&, double>, bool>)
+              {
+                m_skipVehicles = !onTimestep (time);
+              }
+            else
+              {
+                onTimestep (time);
+              }
+          }
+      }
+  }
+
+  /// Parse all complete elements and return the number of bytes consumed.
+  template <typename TimestepFn, typename VehicleFn>
+  std::size_t
+  ParseBuffer (const char* begin, const char* end, bool eof, TimestepFn& onTimestep,
+               VehicleFn& onVehicle)
+  {
+    const char* p = begin;
+    while (p < end)
+      {
+        const char* open = static_cast<const char*> (std::memchr (p, '<', end - p));
+        if (open == nullptr)
+          {
+            return end - begin;
+          }
+        const char* close = FindElementEnd (open, end);
+        if (close == nullptr)
+          {
+            // Incomplete element: keep it for the next read unless the file ended
+            return eof ? (end - begin) : (open - begin);
+          }
+        ParseElement (open + 1, close, onTimestep, onVehicle);
+        p = close + 1;
+      }
+    return end - begin;
+  }
+
+  std::vector<char> m_buffer;
+  SumoFcdParseStats m_stats;
+  bool m_skipVehicles = false; // set while the current timestep is skipped
+  bool m_abort = false;
+};
+
+} // namespace ns3
+
+#endif /* SUMO_FCD_PARSER_H */
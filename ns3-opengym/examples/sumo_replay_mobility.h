@@ -0,0 +1,379 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Trace-driven mobility evaluated on demand for SUMO trace replay
+ *
+ * The trajectory store is step-major: the samples of one env step are
+ * contiguous. SumoNodeTracks adds the node-major index a mobility model
+ * needs. For each node it lists the steps and sample indices of that node
+ * in step order, over all vehicles mapped to the node. SumoReplayTimeline
+ * maps simulation time to a trace step for one node pool, and
+ * TraceReplayMobilityModel reads its node's position and velocity from the
+ * store at Simulator::Now () when something asks for them.
+ *
+ * Positions between two samples of the same vehicle are interpolated
+ * linearly, so propagation models see sub-step positions, and the velocity
+ * is the displacement between the two samples over their time difference.
+ * Nothing is written per step and no course change is notified.
+ */
+
+#ifndef SUMO_REPLAY_MOBILITY_H
+#define SUMO_REPLAY_MOBILITY_H
+
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+
+#include "sumo_slot_map.h"
+#include "sumo_trajectory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * Samples of each node of a pool in step order. Nodes are trajectory
+ * vehicles, or node slots when a slot map is given; vehicles mapped past
+ * the pool are left out.
+ */
+class SumoNodeTracks
+{
+public:
+  void
+  Build (const SumoTrajectoryView& view, uint32_t nodeCount, const SumoSlotMap* slotMap = nullptr)
+  {
+    m_offsets.assign (uint64_t (nodeCount) + 1, 0);
+    for (uint64_t s = 0; s < view.sampleCount; ++s)
+      {
+        uint32_t node = GetNode (view.nodeIndex[s], slotMap);
+        if (node < nodeCount)
+          {
+            m_offsets[node + 1]++;
+          }
+      }
+    for (uint32_t node = 0; node < nodeCount; ++node)
+      {
+        m_offsets[node + 1] += m_offsets[node];
+      }
+
+    // Steps are visited in order, so every track comes out sorted
+    m_steps.resize (m_offsets[nodeCount]);
+    m_samples.resize (m_offsets[nodeCount]);
+    std::vector<uint64_t> next (m_offsets.begin (), m_offsets.end () - 1);
+    for (uint32_t step = 0; step < view.timestepCount; ++step)
+      {
+        for (uint64_t s = view.GetStepBegin (step); s < view.GetStepEnd (step); ++s)
+          {
+            uint32_t node = GetNode (view.nodeIndex[s], slotMap);
+            if (node < nodeCount)
+              {
+                m_steps[next[node]] = step;
+                m_samples[next[node]++] = s;
+              }
+          }
+      }
+  }
+
+  uint32_t
+  GetNodeCount () const
+  {
+    return m_offsets.empty () ? 0 : static_cast<uint32_t> (m_offsets.size () - 1);
+  }
+
+  /// First entry of a node's track; the track ends where the next node's begins.
+  uint64_t
+  GetTrackBegin (uint32_t node) const
+  {
+    return m_offsets[node];
+  }
+
+  uint64_t
+  GetTrackEnd (uint32_t node) const
+  {
+    return m_offsets[node + 1];
+  }
+
+  uint32_t
+  GetStep (uint64_t entry) const
+  {
+    return m_steps[entry];
+  }
+
+  uint64_t
+  GetSample (uint64_t entry) const
+  {
+    return m_samples[entry];
+  }
+
+  uint64_t
+  GetStorageBytes () const
+  {
+    return m_offsets.size () * sizeof (uint64_t) + m_steps.size () * sizeof (uint32_t)
+           + m_samples.size () * sizeof (uint64_t);
+  }
+
+private:
+  static uint32_t
+  GetNode (uint32_t vehicle, const SumoSlotMap* slotMap)
+  {
+    return slotMap != nullptr ? slotMap->GetSlot (vehicle) : vehicle;
+  }
+
+  std::vector<uint64_t> m_offsets; // node count + 1 entries into m_steps and m_samples
+  std::vector<uint32_t> m_steps;
+  std::vector<uint64_t> m_samples; // sample index into the trajectory store
+};
+
+/**
+ * Simulation time to trace time for one node pool, shared by the mobility
+ * models of its nodes. Trace step startStep is replayed at time origin;
+ * SetStart moves both, e.g. when an episode restarts.
+ */
+class SumoReplayTimeline : public SimpleRefCount<SumoReplayTimeline>
+{
+public:
+  SumoReplayTimeline (const SumoTrajectoryView& view, const SumoNodeTracks& tracks,
+                      double envStepTime, bool loop, bool interpolate)
+    : m_view (view),
+      m_tracks (tracks),
+      m_stepNs (std::max<int64_t> (std::llround (envStepTime * 1e9), 1)),
+      m_loop (loop),
+      m_interpolate (interpolate)
+  {
+  }
+
+  void
+  SetStart (uint32_t startStep, Time origin)
+  {
+    m_startStep = startStep;
+    m_originNs = origin.GetNanoSeconds ();
+    m_epoch++;
+  }
+
+  /// Changes with every SetStart, so models know cached positions are stale.
+  uint64_t
+  GetEpoch () const
+  {
+    return m_epoch;
+  }
+
+  /**
+   * Position and velocity of a node at simulation time nowNs. cursor is the
+   * track entry of the last lookup; lookups at increasing times then only
+   * step forward.
+   */
+  void
+  Evaluate (uint32_t node, int64_t nowNs, uint64_t& cursor, Vector& position, Vector& velocity) const
+  {
+    position = Vector (0.0, 0.0, 0.0);
+    velocity = Vector (0.0, 0.0, 0.0);
+    if (node >= m_tracks.GetNodeCount () || m_view.timestepCount == 0)
+      {
+        return;
+      }
+
+    // Whole trace step and the fraction of the next one at nowNs
+    int64_t elapsed = std::max<int64_t> (nowNs - m_originNs, 0);
+    uint64_t step = m_startStep + static_cast<uint64_t> (elapsed / m_stepNs);
+    double fraction = static_cast<double> (elapsed % m_stepNs) / m_stepNs;
+    if (m_loop)
+      {
+        step %= m_view.timestepCount;
+      }
+    else if (step >= m_view.timestepCount)
+      {
+        step = m_view.timestepCount - 1;
+        fraction = 0.0;
+      }
+
+    uint64_t begin = m_tracks.GetTrackBegin (node);
+    uint64_t end = m_tracks.GetTrackEnd (node);
+    uint64_t entry = FindEntry (begin, end, static_cast<uint32_t> (step), cursor);
+    if (entry == end)
+      {
+        return; // no vehicle on this node yet
+      }
+    cursor = entry;
+
+    uint32_t sampleStep = m_tracks.GetStep (entry);
+    uint64_t sample = m_tracks.GetSample (entry);
+    position = Vector (m_view.x[sample], m_view.y[sample], 0.0);
+    if (entry + 1 < end && IsConnected (entry, entry + 1))
+      {
+        uint64_t next = m_tracks.GetSample (entry + 1);
+        double span = m_tracks.GetStep (entry + 1) - sampleStep;
+        double alpha = (step - sampleStep + fraction) / span;
+        double dx = m_view.x[next] - m_view.x[sample];
+        double dy = m_view.y[next] - m_view.y[sample];
+        position.x += alpha * dx;
+        position.y += alpha * dy;
+        velocity = Vector (dx / (span * m_stepNs * 1e-9), dy / (span * m_stepNs * 1e-9), 0.0);
+      }
+    else if (step == sampleStep && entry > begin && IsConnected (entry - 1, entry))
+      {
+        // Last sample of the vehicle: keep the velocity it arrived with
+        uint64_t previous = m_tracks.GetSample (entry - 1);
+        double span = sampleStep - m_tracks.GetStep (entry - 1);
+        velocity = Vector ((m_view.x[sample] - m_view.x[previous]) / (span * m_stepNs * 1e-9),
+                           (m_view.y[sample] - m_view.y[previous]) / (span * m_stepNs * 1e-9), 0.0);
+      }
+    // Otherwise the vehicle has left, and the node holds its last position at rest
+  }
+
+private:
+  /// Last entry of the track at or before step, or end when the track starts later.
+  uint64_t
+  FindEntry (uint64_t begin, uint64_t end, uint32_t step, uint64_t cursor) const
+  {
+    if (cursor < begin || cursor >= end || m_tracks.GetStep (cursor) > step)
+      {
+        cursor = begin; // first lookup, or time went back (loop, restart)
+        if (cursor == end || m_tracks.GetStep (cursor) > step)
+          {
+            return end;
+          }
+      }
+    // Mostly one step forward per lookup; far jumps fall back to a binary search
+    for (uint32_t hop = 0; hop < 4; ++hop)
+      {
+        if (cursor + 1 == end || m_tracks.GetStep (cursor + 1) > step)
+          {
+            return cursor;
+          }
+        ++cursor;
+      }
+    uint64_t low = cursor;
+    uint64_t high = end;
+    while (high - low > 1)
+      {
+        uint64_t middle = low + (high - low) / 2;
+        if (m_tracks.GetStep (middle) <= step)
+          {
+            low = middle;
+          }
+        else
+          {
+            high = middle;
+          }
+      }
+    return low;
+  }
+
+  /// Whether two consecutive track entries are one vehicle moving between adjacent samples.
+  bool
+  IsConnected (uint64_t entry, uint64_t next) const
+  {
+    if (m_view.nodeIndex[m_tracks.GetSample (entry)] != m_view.nodeIndex[m_tracks.GetSample (next)])
+      {
+        return false; // the slot changed vehicle
+      }
+    uint32_t from = m_tracks.GetStep (entry);
+    uint32_t to = m_tracks.GetStep (next);
+    if (to == from + 1)
+      {
+        return true;
+      }
+    if (!m_interpolate)
+      {
+        return false;
+      }
+    // Env steps between two source timesteps of a coarser trace
+    for (uint32_t step = from + 1; step < to; ++step)
+      {
+        if (m_view.IsSampled (step))
+          {
+            return false;
+          }
+      }
+    return true;
+  }
+
+  const SumoTrajectoryView& m_view;
+  const SumoNodeTracks& m_tracks;
+  int64_t m_stepNs;          // env step in nanoseconds
+  bool m_loop;               // wrap around past the last trace step instead of holding it
+  bool m_interpolate;        // bridge the unsampled env steps of a coarser trace
+  uint32_t m_startStep = 0;
+  int64_t m_originNs = 0;
+  uint64_t m_epoch = 0;
+};
+
+/**
+ * Mobility of one node of a replayed trace. Position and velocity are
+ * evaluated from the trajectory store at the current simulation time and
+ * cached until the time changes. SetPosition has no effect.
+ */
+class TraceReplayMobilityModel : public MobilityModel
+{
+public:
+  static TypeId
+  GetTypeId ()
+  {
+    static TypeId tid = TypeId ("ns3::TraceReplayMobilityModel")
+                            .SetParent<MobilityModel> ()
+                            .SetGroupName ("Mobility")
+                            .AddConstructor<TraceReplayMobilityModel> ();
+    return tid;
+  }
+
+  /// Follow the track of node on a timeline.
+  void
+  SetTrack (Ptr<const SumoReplayTimeline> timeline, uint32_t node)
+  {
+    m_timeline = timeline;
+    m_node = node;
+    m_cursor = 0;
+    m_evaluatedEpoch = UINT64_MAX;
+  }
+
+private:
+  Vector
+  DoGetPosition () const override
+  {
+    Evaluate ();
+    return m_position;
+  }
+
+  void
+  DoSetPosition (const Vector& /* position */) override
+  {
+    // Positions come from the trace
+  }
+
+  Vector
+  DoGetVelocity () const override
+  {
+    Evaluate ();
+    return m_velocity;
+  }
+
+  void
+  Evaluate () const
+  {
+    if (!m_timeline)
+      {
+        return;
+      }
+    int64_t nowNs = Simulator::Now ().GetNanoSeconds ();
+    if (nowNs == m_evaluatedAt && m_timeline->GetEpoch () == m_evaluatedEpoch)
+      {
+        return;
+      }
+    m_timeline->Evaluate (m_node, nowNs, m_cursor, m_position, m_velocity);
+    m_evaluatedAt = nowNs;
+    m_evaluatedEpoch = m_timeline->GetEpoch ();
+  }
+
+  Ptr<const SumoReplayTimeline> m_timeline;
+  uint32_t m_node = 0;
+  mutable uint64_t m_cursor = 0; // track entry of the last evaluation
+  mutable int64_t m_evaluatedAt = 0;
+  mutable uint64_t m_evaluatedEpoch = UINT64_MAX;
+  mutable Vector m_position;
+  mutable Vector m_velocity;
+};
+
+} // namespace ns3
+
+#endif /* SUMO_REPLAY_MOBILITY_H */
@@ -0,0 +1,222 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Node slots sized to peak vehicle concurrency for SUMO trace replay
+ *
+ * Without slots every vehicle ID ever seen in the trace gets a node of its
+ * own. SumoSlotMap instead assigns each vehicle a slot for the interval
+ * between its first and last sampled step and hands the slot to a later
+ * vehicle once that interval has passed, so the node pool and the
+ * observation only grow with the largest number of vehicles present at the
+ * same time. Intervals are laid out once from the loaded trajectory with
+ * the lowest free slot first, which makes the assignment deterministic.
+ *
+ * Interpolation never overlaps two vehicles of one slot: a vehicle that is
+ * only present at one end of a gap is shown while that end is the nearer
+ * one, and the next vehicle of its slot appears at a strictly later sampled
+ * step.
+ */
+
+#ifndef SUMO_SLOT_MAP_H
+#define SUMO_SLOT_MAP_H
+
+#include "sumo_trajectory.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace ns3 {
+
+class SumoSlotMap
+{
+public:
+  static constexpr uint32_t kNoSlot = UINT32_MAX;
+
+  /// Assign slots for all vehicles of the trajectory.
+  void
+  Build (const SumoTrajectoryView& view)
+  {
+    std::vector<uint32_t> firstStep (view.vehicleCount, kNoSlot);
+    std::vector<uint32_t> lastStep (view.vehicleCount, 0);
+    for (uint32_t step = 0; step < view.timestepCount; ++step)
+      {
+        for (uint64_t s = view.GetStepBegin (step); s < view.GetStepEnd (step); ++s)
+          {
+            uint32_t vehicle = view.nodeIndex[s];
+            if (firstStep[vehicle] == kNoSlot)
+              {
+                firstStep[vehicle] = step;
+              }
+            lastStep[vehicle] = step;
+          }
+      }
+
+    // Vehicles are numbered in first-seen order, so this is almost always sorted already
+    std::vector<uint32_t> order;
+    order.reserve (view.vehicleCount);
+    for (uint32_t vehicle = 0; vehicle < view.vehicleCount; ++vehicle)
+      {
+        if (firstStep[vehicle] != kNoSlot)
+          {
+            order.push_back (vehicle);
+          }
+      }
+    std::stable_sort (order.begin (), order.end (), [&firstStep] (uint32_t a, uint32_t b) {
+      return firstStep[a] < firstStep[b];
+    });
+
+    using Occupied = std::pair<uint32_t, uint32_t>; // last step, slot
+    std::priority_queue<Occupied, std::vector<Occupied>, std::greater<Occupied>> occupied;
+    std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> freeSlots;
+    m_slot.assign (view.vehicleCount, kNoSlot);
+    m_slotCount = 0;
+    for (uint32_t vehicle : order)
+      {
+        while (!occupied.empty () && occupied.top ().first < firstStep[vehicle])
+          {
+            freeSlots.push (occupied.top ().second);
+            occupied.pop ();
+          }
+        uint32_t slot = m_slotCount;
+        if (freeSlots.empty ())
+          {
+            m_slotCount++;
+          }
+        else
+          {
+            slot = freeSlots.top ();
+            freeSlots.pop ();
+          }
+        m_slot[vehicle] = slot;
+        occupied.emplace (lastStep[vehicle], slot);
+      }
+  }
+
+  bool
+  IsEmpty () const
+  {
+    return m_slot.empty ();
+  }
+
+  /// Peak number of vehicles present at the same time.
+  uint32_t
+  GetSlotCount () const
+  {
+    return m_slotCount;
+  }
+
+  /// Slot of a trajectory vehicle index, kNoSlot for vehicles without samples.
+  uint32_t
+  GetSlot (uint32_t vehicle) const
+  {
+    return vehicle < m_slot.size () ? m_slot[vehicle] : kNoSlot;
+  }
+
+private:
+  std::vector<uint32_t> m_slot; // per trajectory vehicle
+  uint32_t m_slotCount = 0;
+};
+
+/**
+ * Which vehicle occupies each slot of one node pool, and the assignments
+ * the agent has not been told about yet. Every assignment is kept with the
+ * row of the exchange window it was made in, so a slot that changes
+ * vehicle inside a window, or a vehicle that enters and leaves within one,
+ * is still named at the rows it occupied.
+ */
+class SumoSlotOccupancy
+{
+public:
+  /// Size the pool; the vehicles passed to Set are named from view.
+  void
+  Resize (uint32_t slotCount, const SumoTrajectoryView* view = nullptr)
+  {
+    m_current.assign (slotCount, SumoSlotMap::kNoSlot);
+    m_view = view;
+    m_changeCount = 0;
+  }
+
+  /// Window row the following assignments belong to.
+  void
+  SetRow (uint32_t row)
+  {
+    m_row = row;
+  }
+
+  /// Trajectory vehicle `vehicle` occupies slot; recorded when it differs from the last occupant.
+  void
+  Set (uint32_t slot, uint32_t vehicle)
+  {
+    if (slot >= m_current.size () || m_current[slot] == vehicle)
+      {
+        return;
+      }
+    m_current[slot] = vehicle;
+    if (m_view != nullptr)
+      {
+        Enter (slot, m_view->GetVehicleId (vehicle));
+      }
+  }
+
+  /// Vehicle id entered slot, for replay without a loaded trajectory to name it from.
+  void
+  Enter (uint32_t slot, std::string_view id)
+  {
+    if (m_changeCount == m_changes.size ())
+      {
+        m_changes.emplace_back ();
+      }
+    Change& change = m_changes[m_changeCount++];
+    change.row = m_row;
+    change.slot = slot;
+    change.id.assign (id.data (), id.size ()); // entries and their strings are reused
+  }
+
+  /**
+   * Write "slot=vehicleId", or "row:slot=vehicleId" with rows, for every
+   * assignment since the previous call in the order they were made, comma
+   * separated and each preceded by prefix. Returns the number of entries
+   * written.
+   */
+  uint32_t
+  WriteChanges (std::ostream& out, const std::string& prefix, bool rows, bool leadingComma)
+  {
+    for (uint32_t i = 0; i < m_changeCount; ++i)
+      {
+        const Change& change = m_changes[i];
+        out << (leadingComma || i > 0 ? "," : "") << prefix;
+        if (rows)
+          {
+            out << change.row << ':';
+          }
+        out << change.slot << '=' << change.id;
+      }
+    uint32_t written = m_changeCount;
+    m_changeCount = 0;
+    return written;
+  }
+
+private:
+  struct Change
+  {
+    uint32_t row;
+    uint32_t slot;
+    std::string id;
+  };
+
+  std::vector<uint32_t> m_current;        // per slot, trajectory vehicle index
+  const SumoTrajectoryView* m_view = nullptr;
+  uint32_t m_row = 0;
+  std::vector<Change> m_changes;          // unpublished assignments, the first m_changeCount valid
+  uint32_t m_changeCount = 0;
+};
+
+} // namespace ns3
+
+#endif /* SUMO_SLOT_MAP_H */
@@ -0,0 +1,623 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Compiled binary SUMO trace cache
+ *
+ * A parsed FCD trace is written once in the SumoTrajectoryView layout and
+ * later memory-mapped read-only, so a restart does not re-parse the XML and
+ * concurrent simulations share the same page-cache pages. The file is native
+ * endian and starts with a versioned header that records the source trace
+ * size and modification time together with the env step the samples were
+ * binned with, which is what the stale check compares against.
+ */
+
+#ifndef SUMO_TRACE_CACHE_H
+#define SUMO_TRACE_CACHE_H
+
+#include "sumo_trajectory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ns3 {
+
+struct SumoTraceCacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint64_t fileSize;
+  uint64_t sourceSize;
+  int64_t sourceMtime;
+  double envStepTime;
+
+  uint32_t timestepCount;
+  uint32_t vehicleCount;
+  uint32_t typeCount;
+  uint32_t reserved;
+  uint64_t sampleCount;
+
+  uint64_t stepOffsetsOffset;
+  uint64_t nodeIndexOffset;
+  uint64_t xOffset;
+  uint64_t yOffset;
+  uint64_t speedOffset;
+  uint64_t typeIdOffset;
+  uint64_t idOffsetsOffset;
+  uint64_t idCharsOffset;
+  uint64_t typeOffsetsOffset;
+  uint64_t typeCharsOffset;
+  uint64_t stepSampledOffset;
+};
+
+class SumoTraceCacheFile
+{
+public:
+  static constexpr char kMagic[8] = {'V', '2', 'X', 'T', 'R', 'A', 'C', 'E'};
+  static constexpr uint32_t kVersion = 2;
+
+  SumoTraceCacheFile () = default;
+  SumoTraceCacheFile (const SumoTraceCacheFile&) = delete;
+  SumoTraceCacheFile& operator= (const SumoTraceCacheFile&) = delete;
+
+  ~SumoTraceCacheFile ()
+  {
+    Close ();
+  }
+
+  /// Sidecar cache path used for an XML trace.
+  static std::string
+  GetSidecarPath (const std::string& tracePath)
+  {
+    return tracePath + ".v2xtrace";
+  }
+
+  /// True when the file starts with the cache magic.
+  static bool
+  IsCacheFile (const std::string& path)
+  {
+    char magic[sizeof (kMagic)] = {};
+    std::FILE* file = std::fopen (path.c_str (), "rb");
+    if (file == nullptr)
+      {
+        return false;
+      }
+    bool ok = std::fread (magic, 1, sizeof (magic), file) == sizeof (magic);
+    std::fclose (file);
+    return ok && std::memcmp (magic, kMagic, sizeof (kMagic)) == 0;
+  }
+
+  /// Size and modification time of the source trace, as recorded in the header.
+  static bool
+  GetSourceStamp (const std::string& sourcePath, uint64_t& size, int64_t& mtime)
+  {
+    std::error_code ec;
+    size = std::filesystem::file_size (sourcePath, ec);
+    if (ec)
+      {
+        return false;
+      }
+    auto stamp = std::filesystem::last_write_time (sourcePath, ec);
+    if (ec)
+      {
+        return false;
+      }
+    mtime = static_cast<int64_t> (stamp.time_since_epoch ().count ());
+    return true;
+  }
+
+  /**
+   * Map a cache file read-only and validate its header, section bounds,
+   * offset tables and sample indices. A file that fails is rejected, so a
+   * truncated or corrupt cache is recompiled instead of being read out of
+   * bounds.
+   */
+  bool
+  Open (const std::string& path)
+  {
+    Close ();
+    int fd = ::open (path.c_str (), O_RDONLY);
+    if (fd < 0)
+      {
+        return false;
+      }
+    struct stat st;
+    if (::fstat (fd, &st) != 0 || static_cast<uint64_t> (st.st_size) < sizeof (SumoTraceCacheHeader))
+      {
+        ::close (fd);
+        return false;
+      }
+    void* base = ::mmap (nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (base == MAP_FAILED)
+      {
+        return false;
+      }
+    m_base = static_cast<const char*> (base);
+    m_size = st.st_size;
+
+    if (!Validate ())
+      {
+        Close ();
+        return false;
+      }
+    BuildView ();
+    return true;
+  }
+
+  void
+  Close ()
+  {
+    if (m_base != nullptr)
+      {
+        ::munmap (const_cast<char*> (m_base), m_size);
+      }
+    m_base = nullptr;
+    m_size = 0;
+    m_view = SumoTrajectoryView ();
+  }
+
+  bool
+  IsOpen () const
+  {
+    return m_base != nullptr;
+  }
+
+  const SumoTraceCacheHeader&
+  GetHeader () const
+  {
+    return *reinterpret_cast<const SumoTraceCacheHeader*> (m_base);
+  }
+
+  const SumoTrajectoryView&
+  GetView () const
+  {
+    return m_view;
+  }
+
+  uint64_t
+  GetMappedSize () const
+  {
+    return m_size;
+  }
+
+  /// True when the mapped cache was compiled from sourcePath as it is now.
+  bool
+  MatchesSource (const std::string& sourcePath, double envStepTime) const
+  {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    if (!IsOpen () || !GetSourceStamp (sourcePath, size, mtime))
+      {
+        return false;
+      }
+    const SumoTraceCacheHeader& header = GetHeader ();
+    return header.sourceSize == size && header.sourceMtime == mtime && MatchesEnvStep (envStepTime);
+  }
+
+  /// True when the mapped samples were binned at envStepTime, so step k replays time k * envStepTime.
+  bool
+  MatchesEnvStep (double envStepTime) const
+  {
+    return IsOpen () && std::abs (GetHeader ().envStepTime - envStepTime) <= 1e-9 * envStepTime;
+  }
+
+  /**
+   * Write a trajectory as a cache file. The data goes to a temporary file
+   * that is renamed into place, so concurrent readers never observe a
+   * partially written cache.
+   */
+  static bool
+  Write (const std::string& path, const SumoTrajectoryView& view, uint64_t sourceSize,
+         int64_t sourceMtime, double envStepTime)
+  {
+    SumoTraceCacheHeader header = MakeHeader (sourceSize, sourceMtime, envStepTime);
+    header.timestepCount = view.timestepCount;
+    header.vehicleCount = view.vehicleCount;
+    header.typeCount = view.typeCount;
+    header.sampleCount = view.sampleCount;
+
+    uint64_t idBytes = view.vehicleCount > 0 ? view.idOffsets[view.vehicleCount] : 0;
+    uint64_t typeBytes = view.typeCount > 0 ? view.typeOffsets[view.typeCount] : 0;
+    PlaceSections (header, idBytes, typeBytes);
+
+    std::string tmpPath = path + ".tmp." + std::to_string (::getpid ());
+    std::FILE* file = std::fopen (tmpPath.c_str (), "wb");
+    if (file == nullptr)
+      {
+        return false;
+      }
+
+    uint64_t written = 0;
+    bool ok = true;
+    auto put = [&] (uint64_t at, const void* data, uint64_t bytes) {
+      static const char zeros[8] = {};
+      while (ok && written < at)
+        {
+          uint64_t pad = std::min<uint64_t> (at - written, sizeof (zeros));
+          ok = std::fwrite (zeros, 1, pad, file) == pad;
+          written += pad;
+        }
+      if (ok && bytes > 0)
+        {
+          ok = std::fwrite (data, 1, bytes, file) == bytes;
+          written += bytes;
+        }
+    };
+
+    uint32_t emptyOffsets = 0;
+    put (0, &header, sizeof (header));
+    if (view.timestepCount > 0)
+      {
+        put (header.stepOffsetsOffset, view.stepOffsets,
+             (uint64_t (view.timestepCount) + 1) * sizeof (uint64_t));
+      }
+    put (header.nodeIndexOffset, view.nodeIndex, view.sampleCount * sizeof (uint32_t));
+    put (header.xOffset, view.x, view.sampleCount * sizeof (float));
+    put (header.yOffset, view.y, view.sampleCount * sizeof (float));
+    put (header.speedOffset, view.speed, view.sampleCount * sizeof (float));
+    put (header.typeIdOffset, view.typeId, view.sampleCount * sizeof (uint16_t));
+    if (view.vehicleCount > 0)
+      {
+        put (header.idOffsetsOffset, view.idOffsets,
+             (uint64_t (view.vehicleCount) + 1) * sizeof (uint32_t));
+      }
+    else
+      {
+        put (header.idOffsetsOffset, &emptyOffsets, sizeof (emptyOffsets));
+      }
+    put (header.idCharsOffset, view.idChars, idBytes);
+    if (view.typeCount > 0)
+      {
+        put (header.typeOffsetsOffset, view.typeOffsets,
+             (uint64_t (view.typeCount) + 1) * sizeof (uint32_t));
+      }
+    else
+      {
+        put (header.typeOffsetsOffset, &emptyOffsets, sizeof (emptyOffsets));
+      }
+    put (header.typeCharsOffset, view.typeChars, typeBytes);
+    put (header.stepSampledOffset, view.stepSampled, view.timestepCount);
+    put (header.fileSize, nullptr, 0);
+
+    ok = (std::fclose (file) == 0) && ok;
+    if (!ok || std::rename (tmpPath.c_str (), path.c_str ()) != 0)
+      {
+        std::remove (tmpPath.c_str ());
+        return false;
+      }
+    return true;
+  }
+
+  /// Header with the identification fields set and all counts and offsets zero.
+  static SumoTraceCacheHeader
+  MakeHeader (uint64_t sourceSize, int64_t sourceMtime, double envStepTime)
+  {
+    SumoTraceCacheHeader header;
+    std::memset (&header, 0, sizeof (header));
+    std::memcpy (header.magic, kMagic, sizeof (kMagic));
+    header.version = kVersion;
+    header.headerSize = sizeof (SumoTraceCacheHeader);
+    header.sourceSize = sourceSize;
+    header.sourceMtime = sourceMtime;
+    header.envStepTime = envStepTime;
+    return header;
+  }
+
+  /**
+   * Lay out the sections for the counts in the header and set fileSize. The
+   * step offsets and sample sections come first and only depend on the
+   * timestep and sample counts, so they can be written before the vehicle
+   * and type tables are known.
+   */
+  static void
+  PlaceSections (SumoTraceCacheHeader& header, uint64_t idBytes, uint64_t typeBytes)
+  {
+    uint64_t offset = AlignUp (sizeof (SumoTraceCacheHeader));
+    auto place = [&offset] (uint64_t bytes) {
+      uint64_t at = offset;
+      offset = AlignUp (offset + bytes);
+      return at;
+    };
+    header.stepOffsetsOffset = place ((uint64_t (header.timestepCount) + 1) * sizeof (uint64_t));
+    header.nodeIndexOffset = place (header.sampleCount * sizeof (uint32_t));
+    header.xOffset = place (header.sampleCount * sizeof (float));
+    header.yOffset = place (header.sampleCount * sizeof (float));
+    header.speedOffset = place (header.sampleCount * sizeof (float));
+    header.typeIdOffset = place (header.sampleCount * sizeof (uint16_t));
+    header.idOffsetsOffset = place ((uint64_t (header.vehicleCount) + 1) * sizeof (uint32_t));
+    header.idCharsOffset = place (idBytes);
+    header.typeOffsetsOffset = place ((uint64_t (header.typeCount) + 1) * sizeof (uint32_t));
+    header.typeCharsOffset = place (typeBytes);
+    header.stepSampledOffset = place (header.timestepCount);
+    header.fileSize = offset;
+  }
+
+private:
+  static uint64_t
+  AlignUp (uint64_t value)
+  {
+    return (value + 7) & ~uint64_t (7);
+  }
+
+  bool
+  SectionFits (uint64_t offset, uint64_t bytes) const
+  {
+    return offset % 8 == 0 && offset <= m_size && bytes <= m_size - offset;
+  }
+
+  bool
+  Validate () const
+  {
+    const SumoTraceCacheHeader& header = GetHeader ();
+    if (std::memcmp (header.magic, kMagic, sizeof (kMagic)) != 0 || header.version != kVersion
+        || header.headerSize != sizeof (SumoTraceCacheHeader) || header.fileSize != m_size)
+      {
+        return false;
+      }
+    uint64_t samples = header.sampleCount;
+    if (!SectionFits (header.stepOffsetsOffset, (uint64_t (header.timestepCount) + 1) * 8)
+        || !SectionFits (header.nodeIndexOffset, samples * sizeof (uint32_t))
+        || !SectionFits (header.xOffset, samples * sizeof (float))
+        || !SectionFits (header.yOffset, samples * sizeof (float))
+        || !SectionFits (header.speedOffset, samples * sizeof (float))
+        || !SectionFits (header.typeIdOffset, samples * sizeof (uint16_t))
+        || !SectionFits (header.idOffsetsOffset, (uint64_t (header.vehicleCount) + 1) * 4)
+        || !SectionFits (header.typeOffsetsOffset, (uint64_t (header.typeCount) + 1) * 4)
+        || !SectionFits (header.stepSampledOffset, header.timestepCount))
+      {
+        return false;
+      }
+    const uint32_t* idOffsets = reinterpret_cast<const uint32_t*> (m_base + header.idOffsetsOffset);
+    const uint32_t* typeOffsets =
+        reinterpret_cast<const uint32_t*> (m_base + header.typeOffsetsOffset);
+    const uint64_t* stepOffsets =
+        reinterpret_cast<const uint64_t*> (m_base + header.stepOffsetsOffset);
+    if (header.idCharsOffset > m_size || header.typeCharsOffset > m_size
+        || !IsOffsetTable (stepOffsets, header.timestepCount, samples)
+        || !IsOffsetTable (idOffsets, header.vehicleCount, idOffsets[header.vehicleCount])
+        || idOffsets[header.vehicleCount] > m_size - header.idCharsOffset
+        || !IsOffsetTable (typeOffsets, header.typeCount, typeOffsets[header.typeCount])
+        || typeOffsets[header.typeCount] > m_size - header.typeCharsOffset)
+      {
+        return false;
+      }
+
+    // Samples index the vehicle and type tables directly
+    const uint32_t* nodeIndex = reinterpret_cast<const uint32_t*> (m_base + header.nodeIndexOffset);
+    const uint16_t* typeId = reinterpret_cast<const uint16_t*> (m_base + header.typeIdOffset);
+    bool inRange = true;
+    for (uint64_t i = 0; i < samples; ++i)
+      {
+        inRange &= (nodeIndex[i] < header.vehicleCount) & (typeId[i] < header.typeCount);
+      }
+    return inRange;
+  }
+
+  /// count + 1 offsets that start at 0, never decrease and end at end.
+  template <typename T>
+  static bool
+  IsOffsetTable (const T* offsets, uint32_t count, uint64_t end)
+  {
+    if (offsets[0] != 0 || offsets[count] != end)
+      {
+        return false;
+      }
+    for (uint32_t i = 0; i < count; ++i)
+      {
+        if (offsets[i + 1] < offsets[i])
+          {
+            return false;
+          }
+      }
+    return true;
+  }
+
+  void
+  BuildView ()
+  {
+    const SumoTraceCacheHeader& header = GetHeader ();
+    m_view.timestepCount = header.timestepCount;
+    m_view.vehicleCount = header.vehicleCount;
+    m_view.typeCount = header.typeCount;
+    m_view.sampleCount = header.sampleCount;
+    m_view.stepOffsets = reinterpret_cast<const uint64_t*> (m_base + header.stepOffsetsOffset);
+    m_view.nodeIndex = reinterpret_cast<const uint32_t*> (m_base + header.nodeIndexOffset);
+    m_view.x = reinterpret_cast<const float*> (m_base + header.xOffset);
+    m_view.y = reinterpret_cast<const float*> (m_base + header.yOffset);
+    m_view.speed = reinterpret_cast<const float*> (m_base + header.speedOffset);
+    m_view.typeId = reinterpret_cast<const uint16_t*> (m_base + header.typeIdOffset);
+    m_view.idOffsets = reinterpret_cast<const uint32_t*> (m_base + header.idOffsetsOffset);
+    m_view.idChars = m_base + header.idCharsOffset;
+    m_view.typeOffsets = reinterpret_cast<const uint32_t*> (m_base + header.typeOffsetsOffset);
+    m_view.typeChars = m_base + header.typeCharsOffset;
+    m_view.stepSampled = reinterpret_cast<const uint8_t*> (m_base + header.stepSampledOffset);
+  }
+
+  const char* m_base = nullptr;
+  uint64_t m_size = 0;
+  SumoTrajectoryView m_view;
+};
+
+/**
+ * Writes a cache file timestep by timestep without holding the samples in
+ * memory. The number of timesteps and samples has to be known when the
+ * file is opened, which places the sample sections; the vehicle and type
+ * tables, which are small, are collected while writing and placed behind
+ * them by Finish (). Like SumoTraceCacheFile::Write the file only appears
+ * under its name once it is complete.
+ */
+class SumoTraceCacheStreamWriter
+{
+public:
+  SumoTraceCacheStreamWriter () = default;
+  SumoTraceCacheStreamWriter (const SumoTraceCacheStreamWriter&) = delete;
+  SumoTraceCacheStreamWriter& operator= (const SumoTraceCacheStreamWriter&) = delete;
+
+  ~SumoTraceCacheStreamWriter ()
+  {
+    Abort ();
+  }
+
+  bool
+  Open (const std::string& path, uint32_t timestepCount, uint64_t sampleCount, double envStepTime,
+        uint64_t sourceSize = 0, int64_t sourceMtime = 0)
+  {
+    Abort ();
+    m_path = path;
+    m_tmpPath = path + ".tmp." + std::to_string (::getpid ());
+    m_fd = ::open (m_tmpPath.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0)
+      {
+        return false;
+      }
+    m_header = SumoTraceCacheFile::MakeHeader (sourceSize, sourceMtime, envStepTime);
+    m_header.timestepCount = timestepCount;
+    m_header.sampleCount = sampleCount;
+    SumoTraceCacheFile::PlaceSections (m_header, 0, 0);
+    m_tables.Clear ();
+    m_tables.stepOffsets.reserve (uint64_t (timestepCount) + 1);
+    m_samples = 0;
+    m_ok = true;
+    return true;
+  }
+
+  uint32_t
+  AddVehicleId (std::string_view id)
+  {
+    return m_tables.AddVehicleId (id);
+  }
+
+  uint16_t
+  AddTypeName (std::string_view type)
+  {
+    return m_tables.AddTypeName (type);
+  }
+
+  /// Start the next timestep; the samples appended next belong to it.
+  void
+  BeginStep ()
+  {
+    m_tables.stepOffsets.push_back (m_samples);
+    m_tables.stepSampled.push_back (1);
+  }
+
+  /// Append count samples to the current timestep.
+  void
+  AppendSamples (const uint32_t* nodeIndex, const float* x, const float* y, const float* speed,
+                 const uint16_t* typeId, uint64_t count)
+  {
+    if (!m_ok || m_tables.stepOffsets.empty () || m_samples + count > m_header.sampleCount)
+      {
+        m_ok = false;
+        return;
+      }
+    Put (m_header.nodeIndexOffset + m_samples * sizeof (uint32_t), nodeIndex, count * sizeof (uint32_t));
+    Put (m_header.xOffset + m_samples * sizeof (float), x, count * sizeof (float));
+    Put (m_header.yOffset + m_samples * sizeof (float), y, count * sizeof (float));
+    Put (m_header.speedOffset + m_samples * sizeof (float), speed, count * sizeof (float));
+    Put (m_header.typeIdOffset + m_samples * sizeof (uint16_t), typeId, count * sizeof (uint16_t));
+    m_samples += count;
+  }
+
+  /// Write the tables and the header and move the file into place.
+  bool
+  Finish ()
+  {
+    if (m_fd < 0)
+      {
+        return false;
+      }
+    m_ok = m_ok && m_tables.stepOffsets.size () == m_header.timestepCount
+           && m_samples == m_header.sampleCount;
+    m_tables.stepOffsets.push_back (m_samples);
+
+    SumoTrajectoryView view = m_tables.GetView ();
+    uint64_t idBytes = view.vehicleCount > 0 ? view.idOffsets[view.vehicleCount] : 0;
+    uint64_t typeBytes = view.typeCount > 0 ? view.typeOffsets[view.typeCount] : 0;
+    m_header.vehicleCount = view.vehicleCount;
+    m_header.typeCount = view.typeCount;
+    SumoTraceCacheFile::PlaceSections (m_header, idBytes, typeBytes);
+
+    uint32_t emptyOffsets = 0;
+    Put (m_header.stepOffsetsOffset, view.stepOffsets,
+         (uint64_t (m_header.timestepCount) + 1) * sizeof (uint64_t));
+    Put (m_header.idOffsetsOffset, view.vehicleCount > 0 ? view.idOffsets : &emptyOffsets,
+         (uint64_t (view.vehicleCount) + 1) * sizeof (uint32_t));
+    Put (m_header.idCharsOffset, view.idChars, idBytes);
+    Put (m_header.typeOffsetsOffset, view.typeCount > 0 ? view.typeOffsets : &emptyOffsets,
+         (uint64_t (view.typeCount) + 1) * sizeof (uint32_t));
+    Put (m_header.typeCharsOffset, view.typeChars, typeBytes);
+    Put (m_header.stepSampledOffset, view.stepSampled, m_header.timestepCount);
+    Put (0, &m_header, sizeof (m_header));
+    // Alignment padding is never written and reads back as zeros
+    m_ok = m_ok && ::ftruncate (m_fd, static_cast<off_t> (m_header.fileSize)) == 0;
+
+    m_ok = (::close (m_fd) == 0) && m_ok;
+    m_fd = -1;
+    if (!m_ok || std::rename (m_tmpPath.c_str (), m_path.c_str ()) != 0)
+      {
+        std::remove (m_tmpPath.c_str ());
+        return false;
+      }
+    return true;
+  }
+
+  /// Drop a file that was opened but not finished.
+  void
+  Abort ()
+  {
+    if (m_fd >= 0)
+      {
+        ::close (m_fd);
+        m_fd = -1;
+        std::remove (m_tmpPath.c_str ());
+      }
+  }
+
+  uint64_t
+  GetFileSize () const
+  {
+    return m_header.fileSize;
+  }
+
+private:
+  void
+  Put (uint64_t at, const void* data, uint64_t bytes)
+  {
+    const char* p = static_cast<const char*> (data);
+    while (m_ok && bytes > 0)
+      {
+        ssize_t n = ::pwrite (m_fd, p, bytes, static_cast<off_t> (at));
+        if (n <= 0)
+          {
+            m_ok = false;
+            return;
+          }
+        p += n;
+        at += n;
+        bytes -= n;
+      }
+  }
+
+  std::string m_path;
+  std::string m_tmpPath;
+  int m_fd = -1;
+  bool m_ok = false;
+  SumoTraceCacheHeader m_header{};
+  SumoTrajectoryData m_tables; // step offsets, sampled flags and the ID and type tables
+  uint64_t m_samples = 0;
+};
+
+} // namespace ns3
+
+#endif /* SUMO_TRACE_CACHE_H */
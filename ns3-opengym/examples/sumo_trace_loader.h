@@ -0,0 +1,374 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Serial and multi-threaded loading of SUMO FCD traces into SumoTrajectoryData
+ *
+ * The parallel path splits the file at <timestep boundaries into one chunk
+ * per thread. Each thread parses its chunk with its own SumoFcdParser into a
+ * chunk-local sample list, interning vehicle IDs and type names into
+ * chunk-local tables. The chunks are then replayed in file order through a
+ * single SumoTrajectoryBuilder and SumoStepResampler, so node indices, type
+ * IDs, resampling and duplicate handling come out exactly as in the serial
+ * path and the resulting arrays are byte-identical.
+ *
+ * A chunk can only judge the resampling of its own timesteps once it has
+ * seen the one before, so the first timestep of every chunk is parsed in
+ * full and the decision is left to the merge. Vehicles of the other
+ * timesteps that are not kept are skipped before their attributes are parsed,
+ * just like in the serial path.
+ */
+
+#ifndef SUMO_TRACE_LOADER_H
+#define SUMO_TRACE_LOADER_H
+
+#include "sumo_fcd_parser.h"
+#include "sumo_trajectory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ns3 {
+
+class SumoTraceLoader
+{
+public:
+  /// Below this many bytes per chunk the thread start-up outweighs the gain.
+  static constexpr uint64_t kMinChunkBytes = 16u << 20;
+
+  /**
+   * Parse filePath into data, resampled to envStepTime. threads = 0 picks
+   * one thread per core; small files are always parsed serially.
+   */
+  bool
+  Load (const std::string& filePath, double envStepTime, uint32_t threads, SumoTrajectoryData& data)
+  {
+    m_stats = SumoFcdParseStats ();
+    m_droppedSamples = 0;
+    m_chunkCount = 1;
+
+    uint64_t fileSize = GetFileSize (filePath);
+    if (threads == 0)
+      {
+        threads = std::max (1u, std::thread::hardware_concurrency ());
+      }
+    threads = static_cast<uint32_t> (
+        std::min<uint64_t> (threads, std::max<uint64_t> (fileSize / kMinChunkBytes, 1)));
+
+    std::vector<uint64_t> bounds;
+    if (threads > 1)
+      {
+        bounds = FindTimestepBounds (filePath, fileSize, threads);
+      }
+    if (bounds.size () < 3)
+      {
+        return LoadSerial (filePath, envStepTime, data);
+      }
+    return LoadParallel (filePath, envStepTime, bounds, data);
+  }
+
+  /// Statistics summed over all chunks; seconds is the wall time of the whole load.
+  const SumoFcdParseStats&
+  GetStats () const
+  {
+    return m_stats;
+  }
+
+  uint64_t
+  GetDroppedSamples () const
+  {
+    return m_droppedSamples;
+  }
+
+  uint32_t
+  GetChunkCount () const
+  {
+    return m_chunkCount;
+  }
+
+private:
+  /**
+   * Samples of one chunk. steps[0] collects the vehicles ahead of the
+   * chunk's first <timestep>, which belong to the previous chunk's last one.
+   */
+  struct Chunk
+  {
+    struct Step
+    {
+      double time = 0.0;
+      bool hasTime = false;
+      bool parsed = true;       // false when the chunk already skipped its vehicles
+      uint64_t firstSample = 0;
+    };
+
+    std::vector<Step> steps;
+    std::vector<uint32_t> node; // chunk-local vehicle index
+    std::vector<uint16_t> type; // chunk-local type index
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> speed;
+    std::vector<std::string> vehicleIds;
+    std::vector<std::string> typeNames;
+    SumoFcdParseStats stats;
+    bool ok = false;
+  };
+
+  static uint64_t
+  GetFileSize (const std::string& filePath)
+  {
+    std::FILE* file = std::fopen (filePath.c_str (), "rb");
+    if (file == nullptr)
+      {
+        return 0;
+      }
+    long size = (std::fseek (file, 0, SEEK_END) == 0) ? std::ftell (file) : -1;
+    std::fclose (file);
+    return size > 0 ? static_cast<uint64_t> (size) : 0;
+  }
+
+  /**
+   * Offsets 0, the first "<timestep" at or after each k * fileSize / chunks,
+   * and fileSize, without duplicates.
+   */
+  static std::vector<uint64_t>
+  FindTimestepBounds (const std::string& filePath, uint64_t fileSize, uint32_t chunks)
+  {
+    static const char kTag[] = "<timestep";
+    const std::size_t tagSize = sizeof (kTag) - 1;
+
+    std::vector<uint64_t> bounds {0};
+    std::FILE* file = std::fopen (filePath.c_str (), "rb");
+    if (file == nullptr)
+      {
+        return bounds;
+      }
+    std::vector<char> buffer (1u << 16);
+    for (uint32_t k = 1; k < chunks; ++k)
+      {
+        uint64_t offset = std::max (fileSize / chunks * k, bounds.back () + 1);
+        uint64_t found = fileSize;
+        while (offset < fileSize && std::fseek (file, static_cast<long> (offset), SEEK_SET) == 0)
+          {
+            std::size_t got = std::fread (buffer.data (), 1, buffer.size (), file);
+            if (got <= tagSize)
+              {
+                break;
+              }
+            for (std::size_t i = 0; i + tagSize < got; ++i)
+              {
+                char next = buffer[i + tagSize];
+                if (buffer[i] == '<' && std::memcmp (&buffer[i], kTag, tagSize) == 0
+                    && (next == ' ' || next == '\t' || next == '\r' || next == '\n' || next == '>'
+                        || next == '/'))
+                  {
+                    found = offset + i;
+                    break;
+                  }
+              }
+            if (found != fileSize)
+              {
+                break;
+              }
+            offset += got - tagSize; // keep a tag cut by the window end
+          }
+        if (found >= fileSize)
+          {
+            break;
+          }
+        bounds.push_back (found);
+      }
+    std::fclose (file);
+    bounds.push_back (fileSize);
+    return bounds;
+  }
+
+  bool
+  LoadSerial (const std::string& filePath, double envStepTime, SumoTrajectoryData& data)
+  {
+    uint32_t timestepIndex = 0;
+    SumoFcdParser parser;
+    SumoTrajectoryBuilder builder (data);
+    SumoStepResampler resampler (envStepTime);
+
+    // Resample to the env step: of several source timesteps per env step only the
+    // nearest is kept, the others are skipped before their vehicles are parsed
+    auto onTimestep = [&] (double time) {
+      return resampler.Accept (time, timestepIndex) && builder.BeginStep (timestepIndex);
+    };
+    auto onVehicle = [&] (const SumoFcdVehicle& vehicle) {
+      if (vehicle.id.empty () || !vehicle.hasX || !vehicle.hasY)
+        {
+          return;
+        }
+
+      uint32_t nodeIndex = builder.InternVehicle (vehicle.id);
+      uint16_t typeId = builder.InternType (vehicle.type.empty () ? "passenger" : vehicle.type);
+      builder.AddSample (timestepIndex, nodeIndex, static_cast<float> (vehicle.x),
+                         static_cast<float> (vehicle.y),
+                         static_cast<float> (vehicle.hasSpeed ? vehicle.speed : 0.0), typeId);
+    };
+
+    if (!parser.Parse (filePath, onTimestep, onVehicle))
+      {
+        return false;
+      }
+    builder.Finish ();
+    m_stats = parser.GetStats ();
+    m_droppedSamples = builder.GetDroppedSamples ();
+    return true;
+  }
+
+  static void
+  ParseChunk (const std::string& filePath, double envStepTime, uint64_t begin, uint64_t end,
+              Chunk& chunk)
+  {
+    SumoFcdParser parser;
+    SumoStepResampler resampler (envStepTime);
+    std::unordered_map<std::string, uint32_t> vehicleIds;
+    std::unordered_map<std::string, uint16_t> typeIds;
+    std::string key;
+    chunk.steps.emplace_back ();
+
+    // Only the first timestep lacks its predecessor; for the others the chunk-local
+    // resampler decides exactly like the serial one
+    auto onTimestep = [&] (double time) {
+      uint32_t step = 0;
+      Chunk::Step record;
+      record.time = time;
+      record.hasTime = true;
+      record.parsed = resampler.Accept (time, step);
+      record.firstSample = chunk.node.size ();
+      chunk.steps.push_back (record);
+      return record.parsed;
+    };
+    auto onVehicle = [&] (const SumoFcdVehicle& vehicle) {
+      if (vehicle.id.empty () || !vehicle.hasX || !vehicle.hasY)
+        {
+          return;
+        }
+
+      key.assign (vehicle.id.data (), vehicle.id.size ());
+      auto node = vehicleIds.find (key);
+      if (node == vehicleIds.end ())
+        {
+          node = vehicleIds.emplace (key, static_cast<uint32_t> (chunk.vehicleIds.size ())).first;
+          chunk.vehicleIds.push_back (key);
+        }
+      if (vehicle.type.empty ())
+        {
+          key = "passenger";
+        }
+      else
+        {
+          key.assign (vehicle.type.data (), vehicle.type.size ());
+        }
+      auto type = typeIds.find (key);
+      if (type == typeIds.end ())
+        {
+          type = typeIds.emplace (key, static_cast<uint16_t> (chunk.typeNames.size ())).first;
+          chunk.typeNames.push_back (key);
+        }
+
+      chunk.node.push_back (node->second);
+      chunk.type.push_back (type->second);
+      chunk.x.push_back (static_cast<float> (vehicle.x));
+      chunk.y.push_back (static_cast<float> (vehicle.y));
+      chunk.speed.push_back (static_cast<float> (vehicle.hasSpeed ? vehicle.speed : 0.0));
+    };
+
+    chunk.ok = parser.ParseRange (filePath, begin, end, onTimestep, onVehicle);
+    chunk.stats = parser.GetStats ();
+  }
+
+  bool
+  LoadParallel (const std::string& filePath, double envStepTime,
+                const std::vector<uint64_t>& bounds, SumoTrajectoryData& data)
+  {
+    auto start = std::chrono::steady_clock::now ();
+    m_chunkCount = static_cast<uint32_t> (bounds.size () - 1);
+    std::vector<Chunk> chunks (m_chunkCount);
+    std::vector<std::thread> workers;
+    workers.reserve (m_chunkCount);
+    for (uint32_t i = 0; i < m_chunkCount; ++i)
+      {
+        workers.emplace_back (&SumoTraceLoader::ParseChunk, std::cref (filePath), envStepTime,
+                              bounds[i], bounds[i + 1], std::ref (chunks[i]));
+      }
+    for (auto& worker : workers)
+      {
+        worker.join ();
+      }
+    for (const Chunk& chunk : chunks)
+      {
+        if (!chunk.ok)
+          {
+            return false;
+          }
+      }
+
+    // Replay the chunks in file order with the serial loader's state machine
+    SumoTrajectoryBuilder builder (data);
+    SumoStepResampler resampler (envStepTime);
+    uint32_t timestepIndex = 0;
+    bool keep = true; // vehicles ahead of the first <timestep> go to step 0, as in the parser
+    std::vector<uint32_t> nodeMap;
+    std::vector<uint16_t> typeMap;
+    for (Chunk& chunk : chunks)
+      {
+        nodeMap.assign (chunk.vehicleIds.size (), UINT32_MAX);
+        typeMap.assign (chunk.typeNames.size (), UINT16_MAX);
+        for (std::size_t s = 0; s < chunk.steps.size (); ++s)
+          {
+            const Chunk::Step& step = chunk.steps[s];
+            if (step.hasTime)
+              {
+                keep = resampler.Accept (step.time, timestepIndex) && builder.BeginStep (timestepIndex);
+              }
+            if (!keep || !step.parsed)
+              {
+                continue;
+              }
+            uint64_t end = (s + 1 < chunk.steps.size ()) ? chunk.steps[s + 1].firstSample
+                                                         : chunk.node.size ();
+            for (uint64_t i = step.firstSample; i < end; ++i)
+              {
+                uint32_t& node = nodeMap[chunk.node[i]];
+                if (node == UINT32_MAX)
+                  {
+                    node = builder.InternVehicle (chunk.vehicleIds[chunk.node[i]]);
+                  }
+                uint16_t& type = typeMap[chunk.type[i]];
+                if (type == UINT16_MAX)
+                  {
+                    type = builder.InternType (chunk.typeNames[chunk.type[i]]);
+                  }
+                builder.AddSample (timestepIndex, node, chunk.x[i], chunk.y[i], chunk.speed[i], type);
+              }
+          }
+
+        m_stats.bytes += chunk.stats.bytes;
+        m_stats.timesteps += chunk.stats.timesteps;
+        m_stats.vehicles += chunk.stats.vehicles;
+        m_stats.skippedVehicles += chunk.stats.skippedVehicles;
+        chunk = Chunk (); // release the chunk before the next one grows the trajectory
+      }
+    builder.Finish ();
+    m_droppedSamples = builder.GetDroppedSamples ();
+    m_stats.seconds =
+        std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    return true;
+  }
+
+  SumoFcdParseStats m_stats;
+  uint64_t m_droppedSamples = 0;
+  uint32_t m_chunkCount = 1;
+};
+
+} // namespace ns3
+
+#endif /* SUMO_TRACE_LOADER_H */
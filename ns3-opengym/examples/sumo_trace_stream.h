@@ -0,0 +1,471 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Windowed streaming replay of SUMO FCD traces
+ *
+ * A background reader thread parses the trace with SumoFcdParser, resamples
+ * it to the env step and publishes one frame per env step into a
+ * single-producer/single-consumer ring of `window` slots. The simulation
+ * consumes frames in step order, so only the window is ever resident: peak
+ * memory is window x the largest number of vehicles per step, independent of
+ * the trace length. Frame slots keep their arrays between uses, so after
+ * warm-up neither side allocates. The reader runs ahead until the ring is
+ * full; the simulation only waits when the frame it needs has not been
+ * parsed yet, and such stalls are counted.
+ *
+ * Nodes are slots handed out as the stream is read: a vehicle gets the
+ * lowest free slot in the frame it appears in and gives it back in the
+ * first frame it is missing from, when its ID is forgotten as well. The
+ * node pool and the reader's ID table are bounded by the vehicles present
+ * at once, not by the vehicles of the whole trace. New vehicles are placed
+ * once their frame is complete, so a slot freed in a frame can be taken
+ * over by a vehicle entering in that same frame.
+ */
+
+#ifndef SUMO_TRACE_STREAM_H
+#define SUMO_TRACE_STREAM_H
+
+#include "sumo_fcd_parser.h"
+#include "sumo_trajectory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * Vehicles of one env step in the SumoTrajectoryView sample layout, with
+ * nodeIndex holding node slots. The vehicles given their slot in this
+ * frame are listed with their IDs.
+ */
+struct SumoTraceFrame
+{
+  uint32_t step = 0;
+  std::vector<uint32_t> nodeIndex;
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> speed;
+  std::vector<uint32_t> entered;      // samples whose vehicle entered its slot in this frame
+  std::vector<uint32_t> enteredIdEnd; // end of each entered vehicle's ID in enteredIds
+  std::string enteredIds;
+
+  void
+  Clear ()
+  {
+    nodeIndex.clear ();
+    x.clear ();
+    y.clear ();
+    speed.clear ();
+    entered.clear ();
+    enteredIdEnd.clear ();
+    enteredIds.clear ();
+  }
+
+  uint32_t
+  GetSize () const
+  {
+    return static_cast<uint32_t> (nodeIndex.size ());
+  }
+
+  uint32_t
+  GetEnteredCount () const
+  {
+    return static_cast<uint32_t> (entered.size ());
+  }
+
+  /// Slot and vehicle ID of the k-th vehicle that entered in this frame.
+  uint32_t
+  GetEnteredSlot (uint32_t k) const
+  {
+    return nodeIndex[entered[k]];
+  }
+
+  std::string_view
+  GetEnteredId (uint32_t k) const
+  {
+    uint32_t begin = k > 0 ? enteredIdEnd[k - 1] : 0;
+    return std::string_view (enteredIds.data () + begin, enteredIdEnd[k] - begin);
+  }
+};
+
+struct SumoTraceStreamStats
+{
+  uint64_t framesRead = 0;    // frames published by the reader
+  uint64_t vehicles = 0;      // vehicles given a slot, a vehicle returning after a gap counts again
+  uint64_t overflow = 0;      // samples of new vehicles dropped while every slot was taken
+  uint64_t stalls = 0;        // Acquire calls that had to wait for the reader
+  double stallSeconds = 0.0;  // total time spent waiting
+  uint32_t peakFrameSize = 0; // most vehicles in one frame
+  uint32_t slots = 0;         // slots handed out, the peak number of vehicles present at once
+};
+
+class SumoTraceStream
+{
+public:
+  SumoTraceStream () = default;
+  SumoTraceStream (const SumoTraceStream&) = delete;
+  SumoTraceStream& operator= (const SumoTraceStream&) = delete;
+
+  ~SumoTraceStream ()
+  {
+    Stop ();
+  }
+
+  /**
+   * Start reading `path` in the background with maxNodes node slots. A new
+   * vehicle that finds every slot taken has its samples counted as overflow
+   * and dropped until a slot frees up. window is the ring size in frames.
+   */
+  bool
+  Start (const std::string& path, double envStepTime, uint32_t window, uint32_t maxNodes)
+  {
+    Stop ();
+    std::FILE* probe = std::fopen (path.c_str (), "rb");
+    if (probe == nullptr)
+      {
+        return false;
+      }
+    std::fclose (probe);
+
+    uint32_t capacity = 2; // the consumer holds one slot while the reader fills the next
+    while (capacity < window)
+      {
+        capacity <<= 1;
+      }
+    m_slots.clear ();
+    m_slots.resize (capacity);
+    m_mask = capacity - 1;
+    m_head.store (0, std::memory_order_relaxed);
+    m_tail.store (0, std::memory_order_relaxed);
+    m_finished.store (false, std::memory_order_relaxed);
+    m_stop.store (false, std::memory_order_relaxed);
+    m_failed = false;
+    m_stats = SumoTraceStreamStats ();
+    m_readerStats = ReaderStats ();
+
+    m_reader = std::thread (&SumoTraceStream::Read, this, path, envStepTime, maxNodes);
+    return true;
+  }
+
+  void
+  Stop ()
+  {
+    m_stop.store (true, std::memory_order_release);
+    if (m_reader.joinable ())
+      {
+        m_reader.join ();
+      }
+  }
+
+  bool
+  IsRunning () const
+  {
+    return m_reader.joinable ();
+  }
+
+  uint32_t
+  GetWindow () const
+  {
+    return static_cast<uint32_t> (m_slots.size ());
+  }
+
+  /**
+   * Frame of env step `step`, which must not decrease between calls. Steps
+   * without a source timestep yield an empty frame; after the end of the
+   * trace the last frame is held. Waits only while the reader has not
+   * reached `step` yet. The frame stays valid until the next call.
+   */
+  const SumoTraceFrame&
+  Acquire (uint32_t step)
+  {
+    std::chrono::steady_clock::time_point stallStart;
+    bool stalled = false;
+    for (;;)
+      {
+        bool finished = m_finished.load (std::memory_order_acquire);
+        uint64_t tail = m_tail.load (std::memory_order_acquire);
+        uint64_t head = m_head.load (std::memory_order_relaxed);
+
+        // Release frames behind `step`, keeping the newest one until its successor is known
+        while (head != tail && head + 1 != tail && Slot (head).step < step)
+          {
+            m_head.store (++head, std::memory_order_release);
+          }
+
+        const SumoTraceFrame* frame = nullptr;
+        if (head != tail)
+          {
+            const SumoTraceFrame& candidate = Slot (head);
+            if (candidate.step == step || (candidate.step < step && finished))
+              {
+                frame = &candidate;
+              }
+            else if (candidate.step > step)
+              {
+                frame = &m_empty;
+              }
+          }
+        else if (finished)
+          {
+            frame = &m_empty;
+          }
+
+        if (frame != nullptr)
+          {
+            if (stalled)
+              {
+                m_stats.stallSeconds += std::chrono::duration<double> (
+                                            std::chrono::steady_clock::now () - stallStart)
+                                            .count ();
+              }
+            return *frame;
+          }
+
+        if (!stalled)
+          {
+            stalled = true;
+            m_stats.stalls++;
+            stallStart = std::chrono::steady_clock::now ();
+          }
+        std::this_thread::yield ();
+      }
+  }
+
+  /// Reader counters are published once the reader has finished.
+  SumoTraceStreamStats
+  GetStats () const
+  {
+    SumoTraceStreamStats stats = m_stats;
+    if (m_finished.load (std::memory_order_acquire))
+      {
+        stats.framesRead = m_readerStats.framesRead;
+        stats.vehicles = m_readerStats.vehicles;
+        stats.overflow = m_readerStats.overflow;
+        stats.peakFrameSize = m_readerStats.peakFrameSize;
+        stats.slots = m_readerStats.slots;
+      }
+    return stats;
+  }
+
+  bool
+  HasFailed () const
+  {
+    return m_finished.load (std::memory_order_acquire) && m_failed;
+  }
+
+private:
+  struct ReaderStats
+  {
+    uint64_t framesRead = 0;
+    uint64_t vehicles = 0;
+    uint64_t overflow = 0;
+    uint32_t peakFrameSize = 0;
+    uint32_t slots = 0;
+  };
+
+  /// Samples of vehicles without a slot yet, placed when their frame is complete.
+  struct Arrivals
+  {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> speed;
+    std::vector<uint32_t> idEnd;
+    std::string ids;
+
+    void
+    Clear ()
+    {
+      x.clear ();
+      y.clear ();
+      speed.clear ();
+      idEnd.clear ();
+      ids.clear ();
+    }
+
+    std::string_view
+    GetId (uint32_t k) const
+    {
+      uint32_t begin = k > 0 ? idEnd[k - 1] : 0;
+      return std::string_view (ids.data () + begin, idEnd[k] - begin);
+    }
+  };
+
+  SumoTraceFrame&
+  Slot (uint64_t index)
+  {
+    return m_slots[index & m_mask];
+  }
+
+  /// Reader thread: wait for a free slot; false when asked to stop.
+  bool
+  WaitForSlot (uint64_t tail)
+  {
+    while (tail - m_head.load (std::memory_order_acquire) >= m_slots.size ())
+      {
+        if (m_stop.load (std::memory_order_acquire))
+          {
+            return false;
+          }
+        std::this_thread::sleep_for (std::chrono::microseconds (100));
+      }
+    return true;
+  }
+
+  void
+  Read (std::string path, double envStepTime, uint32_t maxNodes)
+  {
+    SumoFcdParser parser;
+    SumoStepResampler resampler (envStepTime);
+    std::unordered_map<std::string, uint32_t> slotOf; // vehicles holding a slot
+    std::vector<std::string> slotId (maxNodes);     // per slot, ID of its vehicle, empty when free
+    std::vector<uint64_t> slotSeen (maxNodes, 0);   // per slot, frame its vehicle was last sampled in, plus one
+    std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> freeSlots;
+    uint32_t slotsUsed = 0; // slots handed out so far; the free ones below it are in freeSlots
+    Arrivals arrivals;
+    std::string key;
+    uint64_t tail = 0;
+    SumoTraceFrame* frame = nullptr;
+    bool stopped = false;
+
+    auto pushSample = [&] (uint32_t slot, float x, float y, float speed) {
+      slotSeen[slot] = tail + 1;
+      frame->nodeIndex.push_back (slot);
+      frame->x.push_back (x);
+      frame->y.push_back (y);
+      frame->speed.push_back (speed);
+    };
+
+    // Free the slots of vehicles missing from the frame, then seat its new vehicles lowest slot first
+    auto completeFrame = [&] () {
+      for (uint32_t slot = 0; slot < slotsUsed; ++slot)
+        {
+          if (!slotId[slot].empty () && slotSeen[slot] != tail + 1)
+            {
+              slotOf.erase (slotId[slot]);
+              slotId[slot].clear ();
+              freeSlots.push (slot);
+            }
+        }
+      for (uint32_t k = 0; k < arrivals.x.size (); ++k)
+        {
+          std::string_view id = arrivals.GetId (k);
+          key.assign (id.data (), id.size ());
+          auto it = slotOf.find (key);
+          if (it == slotOf.end ())
+            {
+              uint32_t slot = slotsUsed;
+              if (!freeSlots.empty ())
+                {
+                  slot = freeSlots.top ();
+                  freeSlots.pop ();
+                }
+              else if (slotsUsed < maxNodes)
+                {
+                  slotsUsed++;
+                }
+              else
+                {
+                  m_readerStats.overflow++;
+                  continue;
+                }
+              it = slotOf.emplace (key, slot).first;
+              slotId[slot] = key;
+              m_readerStats.vehicles++;
+              frame->entered.push_back (frame->GetSize ());
+              frame->enteredIds.append (id.data (), id.size ());
+              frame->enteredIdEnd.push_back (static_cast<uint32_t> (frame->enteredIds.size ()));
+            }
+          pushSample (it->second, arrivals.x[k], arrivals.y[k], arrivals.speed[k]);
+        }
+      arrivals.Clear ();
+      m_readerStats.slots = slotsUsed;
+    };
+
+    auto publish = [&] () {
+      if (frame != nullptr)
+        {
+          completeFrame ();
+          m_readerStats.framesRead++;
+          m_readerStats.peakFrameSize = std::max (m_readerStats.peakFrameSize, frame->GetSize ());
+          m_tail.store (++tail, std::memory_order_release);
+          frame = nullptr;
+        }
+    };
+
+    auto onTimestep = [&] (double time) {
+      uint32_t step = 0;
+      if (stopped || !resampler.Accept (time, step))
+        {
+          return false;
+        }
+      if (frame != nullptr && step <= frame->step)
+        {
+          return step == frame->step; // samples of a repeated step are merged, later ones win
+        }
+      publish ();
+      if (!WaitForSlot (tail))
+        {
+          stopped = true;
+          parser.Abort ();
+          return false;
+        }
+      frame = &Slot (tail);
+      frame->Clear ();
+      frame->step = step;
+      return true;
+    };
+    auto onVehicle = [&] (const SumoFcdVehicle& vehicle) {
+      if (frame == nullptr || vehicle.id.empty () || !vehicle.hasX || !vehicle.hasY)
+        {
+          return;
+        }
+      float x = static_cast<float> (vehicle.x);
+      float y = static_cast<float> (vehicle.y);
+      float speed = static_cast<float> (vehicle.hasSpeed ? vehicle.speed : 0.0);
+      key.assign (vehicle.id.data (), vehicle.id.size ());
+      auto it = slotOf.find (key);
+      if (it != slotOf.end ())
+        {
+          pushSample (it->second, x, y, speed);
+          return;
+        }
+      arrivals.x.push_back (x);
+      arrivals.y.push_back (y);
+      arrivals.speed.push_back (speed);
+      arrivals.ids.append (vehicle.id.data (), vehicle.id.size ());
+      arrivals.idEnd.push_back (static_cast<uint32_t> (arrivals.ids.size ()));
+    };
+
+    m_failed = !parser.Parse (path, onTimestep, onVehicle);
+    if (!stopped)
+      {
+        publish ();
+      }
+    m_finished.store (true, std::memory_order_release);
+  }
+
+  std::vector<SumoTraceFrame> m_slots;
+  uint64_t m_mask = 0;
+  alignas (64) std::atomic<uint64_t> m_head{0}; // next frame to release, written by the consumer
+  alignas (64) std::atomic<uint64_t> m_tail{0}; // frames published, written by the reader
+  std::atomic<bool> m_finished{false};
+  std::atomic<bool> m_stop{false};
+  bool m_failed = false;             // written by the reader before m_finished
+  ReaderStats m_readerStats;         // reader-owned until m_finished
+  SumoTraceStreamStats m_stats;      // consumer-owned
+  SumoTraceFrame m_empty;
+  std::thread m_reader;
+};
+
+} // namespace ns3
+
+#endif /* SUMO_TRACE_STREAM_H */
@@ -0,0 +1,440 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Flat, timestep-indexed SUMO trajectory layout shared by the in-memory
+ * loader and the compiled binary trace cache
+ *
+ * Samples of one timestep are stored contiguously; stepOffsets[t] ..
+ * stepOffsets[t + 1] delimits the slice of timestep t in the parallel
+ * nodeIndex/x/y/speed/typeId arrays. Vehicle IDs and type names are kept in
+ * string tables addressed by node index and type ID respectively.
+ *
+ * Timesteps are env steps. stepSampled[t] tells whether a source timestep
+ * was mapped onto env step t; when the trace is coarser than the env step
+ * the slots in between stay empty and are interpolated on demand by
+ * SumoTrajectorySampler.
+ */
+
+#ifndef SUMO_TRAJECTORY_H
+#define SUMO_TRAJECTORY_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * Read-only view of a trajectory. The arrays are owned either by a
+ * SumoTrajectoryData instance or by a memory-mapped trace cache file.
+ */
+struct SumoTrajectoryView
+{
+  uint32_t timestepCount = 0;
+  uint32_t vehicleCount = 0;
+  uint32_t typeCount = 0;
+  uint64_t sampleCount = 0;
+
+  const uint64_t* stepOffsets = nullptr; // timestepCount + 1 entries
+  const uint32_t* nodeIndex = nullptr;   // sampleCount entries
+  const float* x = nullptr;
+  const float* y = nullptr;
+  const float* speed = nullptr;
+  const uint16_t* typeId = nullptr;
+  const uint8_t* stepSampled = nullptr; // timestepCount entries, 1 where a source timestep landed
+
+  const uint32_t* idOffsets = nullptr; // vehicleCount + 1 entries into idChars
+  const char* idChars = nullptr;
+  const uint32_t* typeOffsets = nullptr; // typeCount + 1 entries into typeChars
+  const char* typeChars = nullptr;
+
+  bool
+  IsEmpty () const
+  {
+    return timestepCount == 0 || vehicleCount == 0;
+  }
+
+  uint64_t
+  GetStepBegin (uint32_t step) const
+  {
+    return stepOffsets[step];
+  }
+
+  uint64_t
+  GetStepEnd (uint32_t step) const
+  {
+    return stepOffsets[step + 1];
+  }
+
+  /// True when env step `step` holds a source timestep (always true without sampling flags).
+  bool
+  IsSampled (uint32_t step) const
+  {
+    return stepSampled == nullptr || stepSampled[step] != 0;
+  }
+
+  std::string_view
+  GetVehicleId (uint32_t node) const
+  {
+    return std::string_view (idChars + idOffsets[node], idOffsets[node + 1] - idOffsets[node]);
+  }
+
+  std::string_view
+  GetTypeName (uint16_t type) const
+  {
+    return std::string_view (typeChars + typeOffsets[type],
+                             typeOffsets[type + 1] - typeOffsets[type]);
+  }
+
+  /// Bytes occupied by the arrays and string tables.
+  uint64_t
+  GetStorageBytes () const
+  {
+    uint64_t bytes = (uint64_t (timestepCount) + 1) * sizeof (uint64_t) + timestepCount;
+    bytes += sampleCount * (sizeof (uint32_t) + 3 * sizeof (float) + sizeof (uint16_t));
+    bytes += (uint64_t (vehicleCount) + 1) * sizeof (uint32_t);
+    bytes += (uint64_t (typeCount) + 1) * sizeof (uint32_t);
+    bytes += (vehicleCount > 0 ? idOffsets[vehicleCount] : 0);
+    bytes += (typeCount > 0 ? typeOffsets[typeCount] : 0);
+    return bytes;
+  }
+};
+
+/**
+ * Heap-owned trajectory arrays in the SumoTrajectoryView layout.
+ */
+struct SumoTrajectoryData
+{
+  std::vector<uint64_t> stepOffsets;
+  std::vector<uint32_t> nodeIndex;
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> speed;
+  std::vector<uint16_t> typeId;
+  std::vector<uint8_t> stepSampled;
+  std::vector<uint32_t> idOffsets;
+  std::vector<char> idChars;
+  std::vector<uint32_t> typeOffsets;
+  std::vector<char> typeChars;
+
+  void
+  Clear ()
+  {
+    *this = SumoTrajectoryData ();
+  }
+
+  uint32_t
+  AddVehicleId (std::string_view id)
+  {
+    if (idOffsets.empty ())
+      {
+        idOffsets.push_back (0);
+      }
+    idChars.insert (idChars.end (), id.begin (), id.end ());
+    idOffsets.push_back (static_cast<uint32_t> (idChars.size ()));
+    return static_cast<uint32_t> (idOffsets.size () - 2);
+  }
+
+  uint16_t
+  AddTypeName (std::string_view type)
+  {
+    if (typeOffsets.empty ())
+      {
+        typeOffsets.push_back (0);
+      }
+    typeChars.insert (typeChars.end (), type.begin (), type.end ());
+    typeOffsets.push_back (static_cast<uint32_t> (typeChars.size ()));
+    return static_cast<uint16_t> (typeOffsets.size () - 2);
+  }
+
+  SumoTrajectoryView
+  GetView () const
+  {
+    SumoTrajectoryView view;
+    view.timestepCount = stepOffsets.empty () ? 0 : static_cast<uint32_t> (stepOffsets.size () - 1);
+    view.vehicleCount = idOffsets.empty () ? 0 : static_cast<uint32_t> (idOffsets.size () - 1);
+    view.typeCount = typeOffsets.empty () ? 0 : static_cast<uint32_t> (typeOffsets.size () - 1);
+    view.sampleCount = nodeIndex.size ();
+    view.stepOffsets = stepOffsets.data ();
+    view.nodeIndex = nodeIndex.data ();
+    view.x = x.data ();
+    view.y = y.data ();
+    view.speed = speed.data ();
+    view.typeId = typeId.data ();
+    view.stepSampled = stepSampled.data ();
+    view.idOffsets = idOffsets.data ();
+    view.idChars = idChars.data ();
+    view.typeOffsets = typeOffsets.data ();
+    view.typeChars = typeChars.data ();
+    return view;
+  }
+};
+
+/**
+ * Maps source timestep times onto env steps. When the trace is finer than the
+ * env step only the source timestep nearest to each env step is accepted, so
+ * the vehicles of the others can be skipped unparsed.
+ */
+class SumoStepResampler
+{
+public:
+  explicit SumoStepResampler (double envStepTime)
+    : m_envStepTime (envStepTime)
+  {
+  }
+
+  /// Set step to the env step of a source timestep; false when it is not the nearest one.
+  bool
+  Accept (double time, uint32_t& step)
+  {
+    double spacing = (m_previousTime >= 0.0) ? time - m_previousTime : 0.0;
+    m_previousTime = time;
+    step = static_cast<uint32_t> (std::round (time / m_envStepTime));
+    double offset = std::fabs (time - step * m_envStepTime);
+    return spacing <= 0.0 || spacing >= m_envStepTime || offset <= 0.5 * spacing + 1e-9;
+  }
+
+private:
+  double m_envStepTime;
+  double m_previousTime = -1.0;
+};
+
+/**
+ * Builds SumoTrajectoryData directly from a stream of FCD samples in
+ * timestep order. Vehicle IDs are assigned node indices in first-seen order
+ * and type names are interned, so each sample costs 18 bytes regardless of
+ * the ID or type string length. When several source samples fall into the
+ * same timestep slot (trace step finer than the env step) the last one wins,
+ * matching the previous map-based loader.
+ */
+class SumoTrajectoryBuilder
+{
+public:
+  explicit SumoTrajectoryBuilder (SumoTrajectoryData& data)
+    : m_data (data)
+  {
+    m_data.Clear ();
+  }
+
+  uint32_t
+  InternVehicle (std::string_view id)
+  {
+    m_key.assign (id.data (), id.size ());
+    auto it = m_vehicleIds.find (m_key);
+    if (it != m_vehicleIds.end ())
+      {
+        return it->second;
+      }
+    uint32_t node = m_data.AddVehicleId (id);
+    m_vehicleIds.emplace (m_key, node);
+    m_lastSample.push_back (kNoSample);
+    return node;
+  }
+
+  uint16_t
+  InternType (std::string_view type)
+  {
+    m_key.assign (type.data (), type.size ());
+    auto it = m_typeIds.find (m_key);
+    if (it != m_typeIds.end ())
+      {
+        return it->second;
+      }
+    uint16_t typeId = m_data.AddTypeName (type);
+    m_typeIds.emplace (m_key, typeId);
+    return typeId;
+  }
+
+  /**
+   * Mark env step `step` as holding a source timestep, also when no vehicle
+   * is present in it. Returns false for a step earlier than the current one.
+   */
+  bool
+  BeginStep (uint32_t step)
+  {
+    if (!OpenStep (step))
+      {
+        return false;
+      }
+    m_data.stepSampled[step] = 1;
+    return true;
+  }
+
+  /// Append a sample. Samples for an earlier timestep than the current one are dropped.
+  void
+  AddSample (uint32_t step, uint32_t node, float x, float y, float speed, uint16_t type)
+  {
+    if (!OpenStep (step))
+      {
+        m_droppedSamples++;
+        return;
+      }
+    m_data.stepSampled[step] = 1;
+
+    uint64_t last = m_lastSample[node];
+    if (last != kNoSample && last >= m_data.stepOffsets[m_currentStep])
+      {
+        m_data.x[last] = x;
+        m_data.y[last] = y;
+        m_data.speed[last] = speed;
+        m_data.typeId[last] = type;
+        return;
+      }
+
+    m_lastSample[node] = m_data.nodeIndex.size ();
+    m_data.nodeIndex.push_back (node);
+    m_data.x.push_back (x);
+    m_data.y.push_back (y);
+    m_data.speed.push_back (speed);
+    m_data.typeId.push_back (type);
+  }
+
+  /// Close the last timestep and release the growth slack of the arrays.
+  void
+  Finish ()
+  {
+    if (!m_data.stepOffsets.empty ())
+      {
+        m_data.stepOffsets.push_back (m_data.nodeIndex.size ());
+      }
+    m_data.stepOffsets.shrink_to_fit ();
+    m_data.stepSampled.shrink_to_fit ();
+    m_data.nodeIndex.shrink_to_fit ();
+    m_data.x.shrink_to_fit ();
+    m_data.y.shrink_to_fit ();
+    m_data.speed.shrink_to_fit ();
+    m_data.typeId.shrink_to_fit ();
+    m_data.idChars.shrink_to_fit ();
+    m_data.idOffsets.shrink_to_fit ();
+  }
+
+  uint64_t
+  GetDroppedSamples () const
+  {
+    return m_droppedSamples;
+  }
+
+private:
+  static constexpr uint64_t kNoSample = std::numeric_limits<uint64_t>::max ();
+
+  /// Open every timestep up to and including `step`; skipped ones stay empty and unsampled.
+  bool
+  OpenStep (uint32_t step)
+  {
+    if (m_data.stepOffsets.empty () || step > m_currentStep)
+      {
+        uint64_t begin = m_data.nodeIndex.size ();
+        while (m_data.stepOffsets.size () <= step)
+          {
+            m_data.stepOffsets.push_back (begin);
+            m_data.stepSampled.push_back (0);
+          }
+        m_currentStep = step;
+      }
+    return step == m_currentStep;
+  }
+
+  SumoTrajectoryData& m_data;
+  std::unordered_map<std::string, uint32_t> m_vehicleIds;
+  std::unordered_map<std::string, uint16_t> m_typeIds;
+  std::string m_key; // reused lookup key, avoids a string allocation per sample
+  std::vector<uint64_t> m_lastSample; // per node: index of its most recent sample
+  uint32_t m_currentStep = 0;
+  uint64_t m_droppedSamples = 0;
+};
+
+/**
+ * Reads the vehicles of an env step from a trajectory. Steps holding a source
+ * timestep are returned as stored. An unsampled step between two sampled ones
+ * is linearly interpolated: vehicles present at both ends are placed between
+ * them, a vehicle present at one end only is kept while that end is the nearer
+ * one. The per-node scratch is reused, so sampling does not allocate once it
+ * has grown to the vehicle count.
+ */
+class SumoTrajectorySampler
+{
+public:
+  /**
+   * Invoke fn (node, x, y, speed, type) for every vehicle of `step`, which
+   * must be below view.timestepCount. With interpolate false unsampled steps
+   * are returned as stored, i.e. empty.
+   */
+  template <typename Fn>
+  void
+  ForEachSample (const SumoTrajectoryView& view, uint32_t step, bool interpolate, Fn&& fn)
+  {
+    uint32_t before = step;
+    uint32_t after = step;
+    if (interpolate && !view.IsSampled (step))
+      {
+        while (before > 0 && !view.IsSampled (before))
+          {
+            --before;
+          }
+        while (after + 1 < view.timestepCount && !view.IsSampled (after))
+          {
+            ++after;
+          }
+      }
+    if (before == after || !view.IsSampled (before) || !view.IsSampled (after))
+      {
+        for (uint64_t s = view.GetStepBegin (step); s < view.GetStepEnd (step); ++s)
+          {
+            fn (view.nodeIndex[s], view.x[s], view.y[s], view.speed[s], view.typeId[s]);
+          }
+        return;
+      }
+
+    float alpha = float (step - before) / float (after - before);
+    if (m_nodeSample.size () < view.vehicleCount)
+      {
+        m_nodeSample.resize (view.vehicleCount, kNone);
+      }
+    uint64_t beforeEnd = view.GetStepEnd (before);
+    for (uint64_t s = view.GetStepBegin (before); s < beforeEnd; ++s)
+      {
+        m_nodeSample[view.nodeIndex[s]] = s;
+      }
+    for (uint64_t s = view.GetStepBegin (after); s < view.GetStepEnd (after); ++s)
+      {
+        uint32_t node = view.nodeIndex[s];
+        uint64_t b = m_nodeSample[node];
+        if (b != kNone)
+          {
+            m_nodeSample[node] = kNone;
+            fn (node, view.x[b] + alpha * (view.x[s] - view.x[b]),
+                view.y[b] + alpha * (view.y[s] - view.y[b]),
+                view.speed[b] + alpha * (view.speed[s] - view.speed[b]), view.typeId[s]);
+          }
+        else if (alpha >= 0.5f)
+          {
+            fn (node, view.x[s], view.y[s], view.speed[s], view.typeId[s]);
+          }
+      }
+    for (uint64_t s = view.GetStepBegin (before); s < beforeEnd; ++s)
+      {
+        uint32_t node = view.nodeIndex[s];
+        if (m_nodeSample[node] != kNone)
+          {
+            m_nodeSample[node] = kNone;
+            if (alpha < 0.5f)
+              {
+                fn (node, view.x[s], view.y[s], view.speed[s], view.typeId[s]);
+              }
+          }
+      }
+  }
+
+private:
+  static constexpr uint64_t kNone = std::numeric_limits<uint64_t>::max ();
+
+  std::vector<uint64_t> m_nodeSample; // per node: its sample in the earlier step, or kNone
+};
+
+} // namespace ns3
+
+#endif /* SUMO_TRAJECTORY_H */
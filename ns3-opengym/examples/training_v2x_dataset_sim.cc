@@ -10,10 +10,25 @@
 #include "ns3/internet-module.h"
 #include "ns3/random-variable-stream.h"
 
+#include "sumo_slot_map.h"
+#include "sumo_trace_cache.h"
+#include "sumo_trace_stream.h"
+#include "v2x_allocation_counter.h"
+#include "v2x_cam_telemetry.h"
+#include "v2x_connectivity_graph.h"
+#include "v2x_dataset_export.h"
+#include "v2x_delta_observation.h"
+#include "v2x_observation.h"
+#include "v2x_observation_layout.h"
+#include "v2x_shm_transport.h"
+#include "v2x_sparse_observation.h"
+#include "v2x_step_profiler.h"
+#include "v2x_trace_replay.h"
+#include "v2x_worker_pool.h"
+
 #include <algorithm>
+#include <chrono>
 #include <cmath>
-#include <fstream>
-#include <map>
 #include <sstream>
 #include <string>
 #include <unordered_map>
@@ -23,294 +38,260 @@ using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE ("TrainingV2XDatasetSim");
 
-struct VehicleMetrics
-{
-  VehicleMetrics () : position (Vector (0.0, 0.0, 0.0)), speed (0.0), active (false) {}
-  Vector position;
-  double speed;
-  bool active;
-};
-
-struct SumoVehicleState
+/**
+ * One scenario instance of a vectorized environment. Replicas share the
+ * trajectory read-only and advance in lockstep; each owns its nodes, metrics
+ * and trace start offset.
+ */
+struct V2xReplica
 {
-  SumoVehicleState () : position (Vector (0.0, 0.0, 0.0)), speed (0.0), vehicleType ("passenger") {}
-  Vector position;
-  double speed;
-  std::string vehicleType;
+  NodeContainer nodes;
+  std::vector<VehicleMetrics> metrics;
+  uint32_t startStep = 0; // trace timestep replayed at env step 0
+  V2xCamTelemetry cam;    // 802.11p CAM link stats, installed with --enableCam
+  V2xConnectivityGraph graph; // range graph over the vehicles, with --graphStats or --enableCam
+  SumoSlotOccupancy slots;    // vehicle of each node slot, with --recycleSlots
+  Ptr<SumoReplayTimeline> timeline; // drives the node positions of a loaded trace
 };
 
 // Global state
-NodeContainer g_nodes;
+std::vector<V2xReplica> g_replicas;
+uint32_t g_numEnvs = 1;
 uint32_t g_nodeNum = 0;
 uint32_t g_currentStep = 0;
 double g_envStepTime = 0.1;
 
-double g_simulationTimeLimit = 0.0;
-uint32_t g_maxSteps = 0;
+double g_simulationTimeLimit = 0.0; // per episode
+uint32_t g_maxSteps = 0;            // per episode
+uint32_t g_episodes = 1;            // episodes served in one process, 0 = unbounded
+uint32_t g_episode = 0;
+uint32_t g_episodeStartStride = 0;  // trace steps between the start steps of consecutive episodes
+uint32_t g_episodeOffset = 0;       // trace steps skipped at the start of the current episode
+Time g_episodeStart;                // simulation time of the current episode's step 0
+uint32_t g_rngRun = 1;              // RNG run of the first episode
+uint32_t g_episodeRunStride = 1;    // RNG run increment per episode, one run per worker in between
+double g_areaMin = 0.0;             // random-walk area, redrawn from on a reset
+double g_areaMax = 800.0;
 bool g_loopSumoTrajectory = false;
-uint32_t g_logInterval = 10; // 0 disables per-step logs, 1 logs every step
+bool g_enableCam = false;     // append per-vehicle 802.11p link stats to the observation
+uint32_t g_graphStats = 0;    // V2xConnectivityGraph::Stat mask appended to the observation
+V2xObservationOps g_observationOps; // row builder specialized for the enabled features
 
 bool g_useSumoMobility = false;
-std::vector<std::map<uint32_t, SumoVehicleState>> g_sumoTrajectory;
-std::unordered_map<std::string, uint32_t> g_sumoIdToNodeIndex;
-std::unordered_map<uint32_t, SumoVehicleState> g_currentSumoState;
-uint32_t g_sumoVehicleCount = 0;
-double g_sumoMaxTime = 0.0;
-
-std::vector<VehicleMetrics> g_vehicleMetrics;
+V2xTraceReplay g_traceReplay;              // trace loaded once, replayed by every replica
+bool g_interpolateTrace = true;            // interpolate env steps between coarse trace steps
+uint32_t g_parseThreads = 0;               // trace parser threads, 0 = one per core
+bool g_recycleSlots = false;               // nodes are slots shared by vehicles over time, always when streaming
+SumoSlotMap g_slotMap;                     // trajectory vehicle -> node slot, with g_recycleSlots on a loaded trace
+bool g_streamTrace = false;                // replay through g_traceStream instead of loading the trace
+SumoTraceStream g_traceStream;             // bounded window of upcoming steps, filled by a reader thread
+
+Ptr<V2xObservationContainer> g_observation; // reused across steps
+V2xSparseObservation::Encoding g_obsEncoding = V2xSparseObservation::DENSE;
+V2xSparseObservation g_sparseObservation;   // active-only rows staged for --obsEncoding=list|csr
+V2xDeltaEncoder g_deltaEncoder;             // keyframes and deltas for --obsEncoding=delta
+Ptr<V2xDeltaObservationContainer> g_deltaObservation;
+bool g_shmTransport = false;                // observations go through g_shmRing, OpenGym carries descriptors
+V2xShmRing g_shmRing;
+Ptr<V2xShmDescriptorContainer> g_shmDescriptor;
+uint32_t g_asyncLag = 0;                    // observations the simulation may run ahead of the agent, 0 = lockstep
+bool g_asyncStepping = false;               // past the OpenGym handshake of an --asyncLag run
+V2xShmRing g_shmActionRing;                 // actions the agent sends back in an --asyncLag run
+V2xShmActionReader g_shmActions;
+Ptr<V2xObservationContainer> g_asyncAction; // reused holder of the last action taken from the ring
+uint64_t g_asyncStalls = 0;                 // waits for the agent to free an observation slot
+uint64_t g_asyncStallNs = 0;
+uint64_t g_observationAllocations = 0;      // heap allocations of the last observation build
+uint64_t g_stepAllocations = 0;             // heap allocations of the last full step
+uint64_t g_stepAllocationMark = 0;
+
+uint32_t g_stepsPerExchange = 1;      // sim steps per OpenGym exchange
+uint32_t g_windowSteps = 0;           // steps recorded in the current window
+std::vector<float> g_windowRewards;   // per-replica, per-step rewards of the current window
+Ptr<OpenGymDataContainer> g_lastAction; // repeated on the steps inside a window
+
+V2xDatasetExporter g_exporter;        // headless --export mode, replaces the OpenGym exchange
+std::vector<float> g_exportRewards;   // per-replica rewards of the exported step
+
+std::string g_profileEventsPath;      // CSV of the profiler event ring, written with each dump
+
+V2xWorkerPool g_workerPool;           // --workers supervisor, and this process's step counter in a worker
 
-inline void
-LogStepMessage (const std::string& message, bool force = false)
+void
+UpdateVehicleMetrics (V2xReplica& replica)
 {
-  if (force)
+  V2X_PROFILE_SCOPE (METRICS);
+  if (replica.metrics.size () != g_nodeNum)
     {
-      NS_LOG_UNCOND (message);
-      return;
+      ResetVehicleMetrics (replica.metrics, g_nodeNum);
     }
 
-  if (g_logInterval == 0)
+  if (g_useSumoMobility)
     {
+      // Trace replay fills the metrics straight from the trajectory slice in ApplySumoMobility
       return;
     }
-
-  if (g_logInterval == 1 || (g_logInterval > 1 && (g_currentStep % g_logInterval == 0)))
-    {
-      NS_LOG_UNCOND (message);
-    }
-}
-
-std::string
-ExtractAttribute (const std::string& line, const std::string& key)
-{
-  std::string token = key + "=\"";
-  auto pos = line.find (token);
-  if (pos == std::string::npos)
-    {
-      return "";
-    }
-  pos += token.size ();
-  auto end = line.find ("\"", pos);
-  if (end == std::string::npos)
-    {
-      return "";
-    }
-  return line.substr (pos, end - pos);
+  UpdateMetricsFromMobility (replica.nodes, replica.metrics);
 }
 
-bool
-LoadSumoTrajectory (const std::string& filePath)
+void
+ApplySumoMobility (V2xReplica& replica, uint32_t timestep)
 {
-  std::ifstream in (filePath.c_str ());
-  if (!in.is_open ())
+  V2X_PROFILE_SCOPE (MOBILITY);
+  if (!g_useSumoMobility || (!g_streamTrace && g_traceReplay.IsEmpty ()))
     {
-      NS_LOG_UNCOND ("[SUMO] Failed to open mobility trace: " << filePath);
-      return false;
+      UpdateVehicleMetrics (replica);
+      return;
     }
 
-  std::string line;
-  double currentTime = 0.0;
-  g_sumoTrajectory.clear ();
-  g_sumoIdToNodeIndex.clear ();
-  g_sumoVehicleCount = 0;
-
-  while (std::getline (in, line))
+  ResetVehicleMetrics (replica.metrics, g_nodeNum);
+  // Streamed frames already hold node slots
+  V2xReplayTarget target (replica.nodes, replica.metrics, g_nodeNum,
+                          g_recycleSlots && !g_streamTrace ? &g_slotMap : nullptr, &replica.slots);
+  // Nodes of a loaded trace read their positions from it, streamed samples are pushed
+  target.SetPushPositions (g_streamTrace);
+  target.SetTimeline (replica.timeline);
+  replica.slots.SetRow (g_windowSteps); // the window row this step is recorded at
+
+  uint32_t traceStep = replica.startStep + g_episodeOffset + timestep;
+  if (g_streamTrace)
     {
-      if (line.find ("<timestep") != std::string::npos)
+      const SumoTraceFrame& frame = g_traceStream.Acquire (traceStep);
+      for (uint32_t i = 0; i < frame.GetSize (); ++i)
         {
-          std::string timeStr = ExtractAttribute (line, "time");
-          if (!timeStr.empty ())
-            {
-              currentTime = std::stod (timeStr);
-            }
+          target (frame.nodeIndex[i], frame.x[i], frame.y[i], frame.speed[i]);
         }
-      else if (line.find ("<vehicle") != std::string::npos)
+      for (uint32_t k = 0; frame.step == traceStep && k < frame.GetEnteredCount (); ++k)
         {
-          std::string idStr = ExtractAttribute (line, "id");
-          std::string xStr = ExtractAttribute (line, "x");
-          std::string yStr = ExtractAttribute (line, "y");
-          std::string speedStr = ExtractAttribute (line, "speed");
-          std::string typeStr = ExtractAttribute (line, "type");
-
-          if (idStr.empty () || xStr.empty () || yStr.empty ())
-            {
-              continue;
-            }
-
-          double x = std::stod (xStr);
-          double y = std::stod (yStr);
-          double speed = speedStr.empty () ? 0.0 : std::stod (speedStr);
-          std::string vehicleType = typeStr.empty () ? "passenger" : typeStr;
-
-          if (g_envStepTime <= 0.0)
-            {
-              g_envStepTime = 0.1;
-            }
-          uint32_t timestepIndex = static_cast<uint32_t> (std::round (currentTime / g_envStepTime));
-          if (g_sumoTrajectory.size () <= timestepIndex)
-            {
-              g_sumoTrajectory.resize (timestepIndex + 1);
-            }
-
-          uint32_t nodeIndex;
-          auto it = g_sumoIdToNodeIndex.find (idStr);
-          if (it == g_sumoIdToNodeIndex.end ())
-            {
-              nodeIndex = g_sumoIdToNodeIndex.size ();
-              g_sumoIdToNodeIndex[idStr] = nodeIndex;
-            }
-          else
-            {
-              nodeIndex = it->second;
-            }
-
-          SumoVehicleState state;
-          state.position = Vector (x, y, 0.0);
-          state.speed = speed;
-          state.vehicleType = vehicleType;
-
-          g_sumoTrajectory[timestepIndex][nodeIndex] = state;
+          // Once per frame; the last frame is held past the end of the trace
+          replica.slots.Enter (frame.GetEnteredSlot (k), frame.GetEnteredId (k));
         }
     }
-
-  g_sumoVehicleCount = g_sumoIdToNodeIndex.size ();
-  if (!g_sumoTrajectory.empty ())
+  else
     {
-      g_sumoMaxTime = g_envStepTime * (g_sumoTrajectory.size () - 1);
+      g_traceReplay.ForEachSample (traceStep, g_loopSumoTrajectory, target);
     }
-
-  NS_LOG_UNCOND ("[SUMO] Loaded mobility trace: " << g_sumoVehicleCount << " vehicles, "
-                                               << g_sumoTrajectory.size () << " timesteps from "
-                                               << filePath);
-
-  return (g_sumoVehicleCount > 0 && !g_sumoTrajectory.empty ());
+  NS_ABORT_MSG_IF (timestep == 0 && !target.HasAllNodes (),
+                   "Vehicles were placed on slots without a node: " << replica.nodes.GetN () << " of "
+                                                                     << g_nodeNum << " nodes created");
 }
 
+/// Close the CAM telemetry window of the last step; only vehicles present now keep broadcasting.
 void
-InitializeVehicleMetrics ()
+UpdateCamTelemetry (V2xReplica& replica)
 {
-  g_vehicleMetrics.clear ();
-  g_vehicleMetrics.resize (g_nodes.GetN ());
+  V2X_PROFILE_SCOPE (METRICS);
+  replica.cam.CollectStep (g_envStepTime);
+  for (uint32_t i = 0; i < replica.metrics.size (); ++i)
+    {
+      replica.cam.SetActive (i, replica.metrics[i].active);
+    }
 }
 
+/// Advance every replica to the current env step.
 void
-UpdateVehicleMetrics ()
+UpdateReplicas ()
 {
-  if (g_vehicleMetrics.size () != g_nodes.GetN ())
-    {
-      InitializeVehicleMetrics ();
-    }
-
-  if (g_useSumoMobility)
+  for (auto& replica : g_replicas)
     {
-      for (uint32_t i = 0; i < g_vehicleMetrics.size (); ++i)
+      if (g_useSumoMobility)
         {
-          auto it = g_currentSumoState.find (i);
-          if (it != g_currentSumoState.end ())
-            {
-              g_vehicleMetrics[i].position = it->second.position;
-              g_vehicleMetrics[i].speed = it->second.speed;
-              g_vehicleMetrics[i].active = true;
-            }
-          else
-            {
-              g_vehicleMetrics[i].position = Vector (0.0, 0.0, 0.0);
-              g_vehicleMetrics[i].speed = 0.0;
-              g_vehicleMetrics[i].active = false;
-            }
+          ApplySumoMobility (replica, g_currentStep);
         }
-    }
-  else
-    {
-      for (uint32_t i = 0; i < g_nodes.GetN (); ++i)
+      else
         {
-          Ptr<Node> node = g_nodes.Get (i);
-          Ptr<MobilityModel> mobility = node->GetObject<MobilityModel> ();
-
-          if (mobility)
-            {
-              Vector pos = mobility->GetPosition ();
-              Vector vel = mobility->GetVelocity ();
-              double speed = std::sqrt (vel.x * vel.x + vel.y * vel.y);
-
-              g_vehicleMetrics[i].position = pos;
-              g_vehicleMetrics[i].speed = speed;
-              g_vehicleMetrics[i].active = true;
-            }
-          else
-            {
-              g_vehicleMetrics[i].position = Vector (0.0, 0.0, 0.0);
-              g_vehicleMetrics[i].speed = 0.0;
-              g_vehicleMetrics[i].active = false;
-            }
+          UpdateVehicleMetrics (replica);
+        }
+      if (g_enableCam)
+        {
+          UpdateCamTelemetry (replica);
+        }
+      if (g_graphStats != 0 || g_enableCam)
+        {
+          V2X_PROFILE_SCOPE (METRICS);
+          replica.graph.Update (replica.metrics); // after the CAM window of the last step is closed
         }
     }
 }
 
-void
-ApplySumoMobility (uint32_t timestep)
+uint32_t
+GetObservationSize ()
 {
-  if (!g_useSumoMobility || g_sumoTrajectory.empty ())
-    {
-      UpdateVehicleMetrics ();
-      return;
-    }
+  return g_observationOps.getSize (g_nodeNum, g_graphStats);
+}
 
-  uint32_t effectiveSize = static_cast<uint32_t> (g_sumoTrajectory.size ());
-  uint32_t safeIndex = std::min (timestep, effectiveSize - 1);
-  if (g_loopSumoTrajectory && effectiveSize > 0)
+/// [N, K, obsSize], with the replica and window axes dropped when they are 1.
+std::vector<uint32_t>
+GetObservationShape ()
+{
+  std::vector<uint32_t> shape;
+  if (g_numEnvs > 1)
     {
-      safeIndex = timestep % effectiveSize;
+      shape.push_back (g_numEnvs);
     }
-
-  const auto& states = g_sumoTrajectory[safeIndex];
-
-  g_currentSumoState.clear ();
-
-  for (const auto& entry : states)
+  if (g_stepsPerExchange > 1)
     {
-      uint32_t nodeIndex = entry.first;
-      if (nodeIndex >= g_nodes.GetN ())
-        {
-          continue;
-        }
-
-      Ptr<Node> node = g_nodes.Get (nodeIndex);
-      Ptr<MobilityModel> mobility = node->GetObject<MobilityModel> ();
-      Ptr<ConstantPositionMobilityModel> constant = DynamicCast<ConstantPositionMobilityModel> (mobility);
-
-      if (!constant)
-        {
-          constant = CreateObject<ConstantPositionMobilityModel> ();
-          node->AggregateObject (constant);
-        }
-
-      constant->SetPosition (entry.second.position);
-      g_currentSumoState[nodeIndex] = entry.second;
+      shape.push_back (g_stepsPerExchange);
     }
-
-  UpdateVehicleMetrics ();
+  shape.push_back (GetObservationSize ());
+  return shape;
 }
 
 Ptr<OpenGymSpace>
 MyGetObservationSpace (void)
 {
-  uint32_t obsSize = 4 + (g_nodeNum * 3);
-  float low = -10000.0f;
-  float high = 10000.0f;
-  std::vector<uint32_t> shape = {obsSize};
+  uint32_t obsSize = GetObservationSize ();
+  float low = -g_observationOps.bound;
+  float high = g_observationOps.bound;
+  std::vector<uint32_t> shape = GetObservationShape ();
+  if (g_shmTransport)
+    {
+      // The data is in the shared-memory slot the descriptor points at
+      shape = {V2xShmDescriptorContainer::kSize};
+      Ptr<OpenGymBoxSpace> space =
+          CreateObject<OpenGymBoxSpace> (0.0f, 4294967295.0f, shape, TypeNameGet<uint32_t> ());
+      NS_LOG_UNCOND ("MyGetObservationSpace: " << space);
+      return space;
+    }
+  if (g_obsEncoding == V2xSparseObservation::DELTA)
+    {
+      // Upper bound of the keyframe/delta payload, see v2x_delta_observation.h
+      shape = {static_cast<uint32_t> (
+          V2xDeltaEncoder::GetMaxSize (uint64_t (g_numEnvs) * g_stepsPerExchange * obsSize))};
+      Ptr<OpenGymBoxSpace> space =
+          CreateObject<OpenGymBoxSpace> (0.0f, 4294967295.0f, shape, TypeNameGet<uint32_t> ());
+      NS_LOG_UNCOND ("MyGetObservationSpace: " << space);
+      return space;
+    }
+  if (V2xSparseObservation::IsSparse (g_obsEncoding))
+    {
+      // Upper bound of the variable-length payload; its header describes the actual layout
+      shape = {static_cast<uint32_t> (
+          g_sparseObservation.GetMaxSize (g_numEnvs * g_stepsPerExchange, g_nodeNum))};
+    }
   std::string dtype = TypeNameGet<float> ();
   Ptr<OpenGymBoxSpace> space = CreateObject<OpenGymBoxSpace> (low, high, shape, dtype);
   NS_LOG_UNCOND ("MyGetObservationSpace: " << space);
   return space;
 }
 
+std::vector<uint32_t>
+GetActionShape ()
+{
+  uint32_t actionNum = 4;
+  if (g_numEnvs > 1)
+    {
+      return {g_numEnvs, actionNum};
+    }
+  return {actionNum};
+}
+
 Ptr<OpenGymSpace>
 MyGetActionSpace (void)
 {
-  uint32_t actionNum = 4;
   float low = 0.0f;
   float high = 10.0f;
-  std::vector<uint32_t> shape = {actionNum};
+  std::vector<uint32_t> shape = GetActionShape ();
   std::string dtype = TypeNameGet<float> ();
   Ptr<OpenGymBoxSpace> space = CreateObject<OpenGymBoxSpace> (low, high, shape, dtype);
   NS_LOG_UNCOND ("MyGetActionSpace: " << space);
@@ -318,83 +299,353 @@ MyGetActionSpace (void)
 }
 
 bool
-MyGetGameOver (void)
+IsEpisodeOver ()
 {
   bool stepLimitReached = (g_maxSteps > 0 && g_currentStep >= g_maxSteps);
-  bool timeLimitReached = (g_simulationTimeLimit > 0.0 && Simulator::Now ().GetSeconds () >= g_simulationTimeLimit);
-  bool isGameOver = stepLimitReached || timeLimitReached;
-  LogStepMessage ("MyGetGameOver: " + std::to_string (isGameOver), false);
+  bool timeLimitReached = (g_simulationTimeLimit > 0.0
+                           && (Simulator::Now () - g_episodeStart).GetSeconds () >= g_simulationTimeLimit);
+  return stepLimitReached || timeLimitReached;
+}
+
+/// Whether another episode follows the current one in this process.
+bool
+HasNextEpisode ()
+{
+  return g_episodes == 0 || g_episode + 1 < g_episodes;
+}
+
+/**
+ * First RNG stream of a replica's fixed block: the random walk (two per
+ * node), the start coordinates, spare streams, then the CAM devices and
+ * jitter. Every stream replica i draws from is independent of N.
+ */
+int64_t
+GetReplicaStreamBase (uint32_t env)
+{
+  return env * (2 * int64_t (g_nodeNum) + 16 + V2xCamTelemetry::GetStreamCount (g_nodeNum));
+}
+
+/// First RNG stream of a replica's CAM devices and jitter, inside its fixed block.
+int64_t
+GetReplicaCamStream (uint32_t env)
+{
+  return GetReplicaStreamBase (env) + 2 * int64_t (g_nodeNum) + 16;
+}
+
+/// Reseed the random walk of a replica from the current RNG run and redraw its start positions.
+void
+RestartRandomWalk (uint32_t env)
+{
+  V2xReplica& replica = g_replicas[env];
+  int64_t stream = GetReplicaStreamBase (env);
+  MobilityHelper mobility;
+  mobility.AssignStreams (replica.nodes, stream);
+  Ptr<UniformRandomVariable> coordinate = CreateObject<UniformRandomVariable> ();
+  coordinate->SetStream (stream + 2 * int64_t (g_nodeNum));
+  for (uint32_t i = 0; i < replica.nodes.GetN (); ++i)
+    {
+      double x = coordinate->GetValue (g_areaMin, g_areaMax);
+      double y = coordinate->GetValue (g_areaMin, g_areaMax);
+      replica.nodes.Get (i)->GetObject<MobilityModel> ()->SetPosition (Vector (x, y, 0.0));
+    }
+}
+
+/**
+ * Start the next episode in place. The step counter is rewound, the RNG run
+ * advanced, and every replica restarted at its start step plus the episode
+ * offset. Nodes, devices and the OpenGym connection are kept. The next state
+ * read, one env step from now, is step 0 of the new episode.
+ */
+void
+ResetEpisode ()
+{
+  auto begin = std::chrono::steady_clock::now ();
+  g_episode++;
+  g_currentStep = 0;
+  g_windowSteps = 0;
+  g_episodeOffset = g_episode * g_episodeStartStride;
+  g_episodeStart = Simulator::Now () + Seconds (g_envStepTime);
+  RngSeedManager::SetRun (g_rngRun + uint64_t (g_episode) * g_episodeRunStride);
+  for (uint32_t env = 0; env < g_numEnvs; ++env)
+    {
+      V2xReplica& replica = g_replicas[env];
+      if (replica.timeline)
+        {
+          replica.timeline->SetStart (replica.startStep + g_episodeOffset, g_episodeStart);
+        }
+      else if (!g_useSumoMobility)
+        {
+          // Ahead of the state read at the same time, so step 0 sees the new positions
+          Simulator::Schedule (Seconds (g_envStepTime), &RestartRandomWalk, env);
+        }
+      ResetVehicleMetrics (replica.metrics, g_nodeNum);
+      if (g_enableCam)
+        {
+          replica.cam.Reset (GetReplicaCamStream (env));
+        }
+    }
+  g_deltaEncoder.RequestKeyframe ();
+  double resetMs =
+      std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now () - begin).count ();
+  NS_LOG_UNCOND ("[Episode] Starting episode " << g_episode << " at trace offset " << g_episodeOffset
+                 << " with RNG run " << RngSeedManager::GetRun () << " (reset took " << resetMs
+                 << " ms)");
+}
+
+bool
+MyGetGameOver (void)
+{
+  bool isGameOver = IsEpisodeOver () && !HasNextEpisode ();
+  LOG_STEP ("MyGetGameOver: " << isGameOver);
   return isGameOver;
 }
 
-Ptr<OpenGymDataContainer>
-MyGetObservation (void)
+V2xObservationSource
+GetObservationSource (const V2xReplica& replica)
+{
+  V2xObservationSource source;
+  source.metrics = &replica.metrics;
+  source.nodeCount = g_nodeNum;
+  source.cam = &replica.cam;
+  source.graph = &replica.graph;
+  source.graphStats = g_graphStats;
+  return source;
+}
+
+/**
+ * Write one observation row (fleet aggregates, x/y/speed per vehicle, then
+ * the per-vehicle link stats when CAM telemetry is on and the selected
+ * connectivity graph stats) for the current metrics of a replica into obs.
+ */
+void
+BuildObservation (const V2xReplica& replica, float* obs)
 {
-  LogStepMessage ("MyGetObservation: step=" + std::to_string (g_currentStep), false);
+  g_observationOps.buildDense (GetObservationSource (replica), obs);
+}
 
-  uint32_t obsSize = 4 + (g_nodeNum * 3);
-  std::vector<uint32_t> shape = {obsSize};
-  Ptr<OpenGymBoxContainer<float>> box = CreateObject<OpenGymBoxContainer<float>> (shape);
+/**
+ * Stage the observation row of a replica for the sparse encodings: the same
+ * values as BuildObservation, but with an entry for active vehicles only.
+ */
+void
+BuildSparseRow (const V2xReplica& replica, uint32_t row)
+{
+  g_observationOps.buildSparseRow (GetObservationSource (replica), g_sparseObservation, row);
+}
 
+float
+ComputeReward (const V2xReplica& replica)
+{
   uint32_t activeNodes = 0;
-  double totalSpeed = 0.0;
-  double avgX = 0.0;
-  double avgY = 0.0;
-
-  for (const auto& metrics : g_vehicleMetrics)
+  for (const auto& metrics : replica.metrics)
     {
       if (metrics.active)
         {
           activeNodes++;
-          totalSpeed += metrics.speed;
-          avgX += metrics.position.x;
-          avgY += metrics.position.y;
         }
     }
+  return static_cast<float> (activeNodes * 0.1);
+}
 
-  double avgSpeed = (activeNodes > 0) ? totalSpeed / activeNodes : 0.0;
-  double avgPosX = (activeNodes > 0) ? avgX / activeNodes : 0.0;
-  double avgPosY = (activeNodes > 0) ? avgY / activeNodes : 0.0;
+Ptr<V2xObservationContainer>
+GetObservationContainer ()
+{
+  uint32_t rows = g_numEnvs * g_stepsPerExchange;
+  bool dense = !V2xSparseObservation::IsSparse (g_obsEncoding);
+  if (!g_observation || (dense && g_observation->GetSize () != rows * GetObservationSize ()))
+    {
+      // Sparse payloads are resized per exchange and start empty
+      g_observation = CreateObject<V2xObservationContainer> (
+          dense ? GetObservationShape () : std::vector<uint32_t> {0});
+    }
+  return g_observation;
+}
 
-  box->AddValue (static_cast<float> (activeNodes));
-  box->AddValue (static_cast<float> (avgSpeed));
-  box->AddValue (static_cast<float> (avgPosX));
-  box->AddValue (static_cast<float> (avgPosY));
+/// Where the dense rows of this exchange are written: the next shared-memory slot or the container.
+float*
+GetObservationData ()
+{
+  return g_shmTransport ? g_shmRing.GetWriteData () : GetObservationContainer ()->GetData ();
+}
+
+/// First float of the observation row of a replica at a window position.
+float*
+GetObservationRow (float* data, uint32_t env, uint32_t windowStep)
+{
+  return data + (uint64_t (env) * g_stepsPerExchange + windowStep) * GetObservationSize ();
+}
 
-  for (uint32_t i = 0; i < g_nodeNum; ++i)
+/// Append the current step of every replica as the next row of its stacked window.
+void
+RecordWindowStep ()
+{
+  V2X_PROFILE_SCOPE (OBSERVATION);
+  bool dense = !V2xSparseObservation::IsSparse (g_obsEncoding);
+  float* data = dense ? GetObservationData () : nullptr;
+  if (!dense && g_windowSteps == 0)
+    {
+      g_sparseObservation.Reset (g_numEnvs * g_stepsPerExchange);
+    }
+  for (uint32_t env = 0; env < g_numEnvs; ++env)
     {
-      if (i < g_vehicleMetrics.size () && g_vehicleMetrics[i].active)
+      if (dense)
         {
-          const auto& metrics = g_vehicleMetrics[i];
-          box->AddValue (static_cast<float> (metrics.position.x));
-          box->AddValue (static_cast<float> (metrics.position.y));
-          box->AddValue (static_cast<float> (metrics.speed));
+          BuildObservation (g_replicas[env], GetObservationRow (data, env, g_windowSteps));
         }
       else
         {
-          box->AddValue (0.0f);
-          box->AddValue (0.0f);
-          box->AddValue (0.0f);
+          BuildSparseRow (g_replicas[env], env * g_stepsPerExchange + g_windowSteps);
         }
+      g_windowRewards[env * g_stepsPerExchange + g_windowSteps] = ComputeReward (g_replicas[env]);
     }
-
-  return box;
+  g_windowSteps++;
 }
 
+/// Reward of a replica over the current exchange.
 float
-MyGetReward (void)
+GetEnvReward (uint32_t env)
 {
-  uint32_t activeNodes = 0;
-  for (const auto& metrics : g_vehicleMetrics)
+  if (g_stepsPerExchange <= 1)
     {
-      if (metrics.active)
+      return ComputeReward (g_replicas[env]);
+    }
+  float reward = 0.0f;
+  for (uint32_t row = 0; row < g_windowSteps; ++row)
+    {
+      reward += g_windowRewards[env * g_stepsPerExchange + row];
+    }
+  return reward;
+}
+
+/// Release this exchange's slot to the agent and describe it in the OpenGym observation.
+Ptr<OpenGymDataContainer>
+PublishShmObservation (uint32_t size)
+{
+  float reward = 0.0f;
+  for (uint32_t env = 0; env < g_numEnvs; ++env)
+    {
+      reward += GetEnvReward (env);
+    }
+  uint32_t flags = 0;
+  if (IsEpisodeOver ())
+    {
+      flags |= g_episodes != 1 ? uint32_t (V2xShmRing::EPISODE_END) : 0;
+      flags |= HasNextEpisode () ? 0 : uint32_t (V2xShmRing::GAME_OVER);
+    }
+  uint32_t slot = g_shmRing.GetWriteSlot ();
+  uint32_t sequence = g_shmRing.Publish (size, g_currentStep, reward, flags, g_asyncStallNs);
+  g_shmDescriptor->Set (sequence, slot, size, g_currentStep);
+  return g_shmDescriptor;
+}
+
+Ptr<OpenGymDataContainer>
+MyGetObservation (void)
+{
+  LOG_STEP ("MyGetObservation: step=" << g_currentStep);
+  V2X_PROFILE_SCOPE (OBSERVATION);
+
+  uint64_t allocationMark = GetAllocationCount ();
+  if (V2xSparseObservation::IsSparse (g_obsEncoding))
+    {
+      if (g_stepsPerExchange <= 1)
         {
-          activeNodes++;
+          g_sparseObservation.Reset (g_numEnvs);
+          for (uint32_t env = 0; env < g_numEnvs; ++env)
+            {
+              BuildSparseRow (g_replicas[env], env);
+            }
+        }
+      else
+        {
+          if (g_windowSteps == 0)
+            {
+              RecordWindowStep (); // initial exchange before the first window
+            }
+          for (uint32_t env = 0; env < g_numEnvs; ++env)
+            {
+              uint32_t last = env * g_stepsPerExchange + g_windowSteps - 1;
+              for (uint32_t row = g_windowSteps; row < g_stepsPerExchange; ++row)
+                {
+                  g_sparseObservation.CopyRow (last, env * g_stepsPerExchange + row);
+                }
+            }
+        }
+      uint32_t size = static_cast<uint32_t> (g_sparseObservation.GetEncodedSize ());
+      if (g_shmTransport)
+        {
+          g_sparseObservation.Encode (g_shmRing.GetWriteData ());
+          g_observationAllocations = GetAllocationCount () - allocationMark;
+          return PublishShmObservation (size);
+        }
+      Ptr<V2xObservationContainer> container = GetObservationContainer ();
+      container->SetShape ({size});
+      g_sparseObservation.Encode (container->GetData ());
+      container->Pack ();
+      g_observationAllocations = GetAllocationCount () - allocationMark;
+      return container;
+    }
+
+  float* data = GetObservationData ();
+  if (g_stepsPerExchange <= 1)
+    {
+      for (uint32_t env = 0; env < g_numEnvs; ++env)
+        {
+          BuildObservation (g_replicas[env], GetObservationRow (data, env, 0));
+        }
+    }
+  else
+    {
+      if (g_windowSteps == 0)
+        {
+          RecordWindowStep (); // initial exchange before the first window
+        }
+
+      // A window cut short by the episode end repeats its last recorded step
+      uint32_t obsSize = GetObservationSize ();
+      for (uint32_t env = 0; env < g_numEnvs; ++env)
+        {
+          const float* last = GetObservationRow (data, env, g_windowSteps - 1);
+          for (uint32_t row = g_windowSteps; row < g_stepsPerExchange; ++row)
+            {
+              std::copy (last, last + obsSize, GetObservationRow (data, env, row));
+            }
+        }
+    }
+
+  if (g_shmTransport)
+    {
+      g_observationAllocations = GetAllocationCount () - allocationMark;
+      return PublishShmObservation (g_numEnvs * g_stepsPerExchange * GetObservationSize ());
+    }
+  if (g_obsEncoding == V2xSparseObservation::DELTA)
+    {
+      if (!g_deltaObservation)
+        {
+          g_deltaObservation = CreateObject<V2xDeltaObservationContainer> ();
         }
+      g_deltaEncoder.Encode (data, g_observation->GetSize (), *g_deltaObservation);
+      g_deltaObservation->Pack ();
+      g_observationAllocations = GetAllocationCount () - allocationMark;
+      return g_deltaObservation;
     }
 
-  float reward = static_cast<float> (activeNodes * 0.1);
-  LogStepMessage ("MyGetReward: " + std::to_string (reward), false);
+  if (!g_exporter.IsOpen ())
+    {
+      g_observation->Pack (); // serialized here so obsAllocs covers it, not when OpenGym asks for it
+    }
+  g_observationAllocations = GetAllocationCount () - allocationMark;
+  return g_observation;
+}
+
+float
+MyGetReward (void)
+{
+  float reward = 0.0f;
+  for (uint32_t env = 0; env < g_numEnvs; ++env)
+    {
+      reward += GetEnvReward (env);
+    }
+  LOG_STEP ("MyGetReward: " << reward);
   return reward;
 }
 
@@ -402,44 +653,229 @@ std::string
 MyGetExtraInfo (void)
 {
   std::ostringstream info;
-  info << "step:" << g_currentStep << ";vehicles:" << g_vehicleMetrics.size ();
-  LogStepMessage ("MyGetExtraInfo: " + info.str (), false);
+  info << "step:" << g_currentStep << ";vehicles:" << g_replicas[0].metrics.size ()
+       << ";obsAllocs:" << g_observationAllocations << ";stepAllocs:" << g_stepAllocations;
+  if (g_stepsPerExchange > 1)
+    {
+      info << ";windowSteps:" << g_windowSteps << ";rewards:";
+      for (uint32_t env = 0; env < g_numEnvs; ++env)
+        {
+          for (uint32_t row = 0; row < g_windowSteps; ++row)
+            {
+              info << (env + row > 0 ? "," : "") << g_windowRewards[env * g_stepsPerExchange + row];
+            }
+        }
+    }
+  if (g_numEnvs > 1)
+    {
+      info << ";envRewards:";
+      for (uint32_t env = 0; env < g_numEnvs; ++env)
+        {
+          info << (env > 0 ? "," : "") << GetEnvReward (env);
+        }
+    }
+  if (g_recycleSlots)
+    {
+      // Slot assignments since the last exchange, as [env/][row:]slot=vehicleId in the order made
+      info << ";slots:";
+      uint32_t written = 0;
+      for (uint32_t env = 0; env < g_numEnvs; ++env)
+        {
+          std::string prefix = g_numEnvs > 1 ? std::to_string (env) + "/" : std::string ();
+          written += g_replicas[env].slots.WriteChanges (info, prefix, g_stepsPerExchange > 1, written > 0);
+        }
+    }
+  if (g_streamTrace)
+    {
+      info << ";streamStalls:" << g_traceStream.GetStats ().stalls;
+    }
+  if (g_episodes != 1)
+    {
+      info << ";episode:" << g_episode;
+      if (IsEpisodeOver ())
+        {
+          // Final state of the episode; unless it is the last, the next action starts a new one
+          info << ";episodeEnd:1";
+        }
+    }
+  LOG_STEP ("MyGetExtraInfo: " << info.str ());
   return info.str ();
 }
 
+/**
+ * Apply an agent action for one env step; with several replicas it is the
+ * batched [N, 4] action, row i addressed to replica i. Actions do not steer
+ * the replay, a step only advances it.
+ */
+void
+ApplyAction (Ptr<OpenGymDataContainer> action)
+{
+  g_lastAction = action;
+  g_currentStep++;
+}
+
 bool
 MyExecuteActions (Ptr<OpenGymDataContainer> action)
 {
+  V2X_PROFILE_SCOPE (ACTION);
+  if (IsEpisodeOver () && HasNextEpisode ())
+    {
+      ResetEpisode (); // the action answering an episode's last exchange
+      return true;
+    }
   if (g_maxSteps > 0 && g_currentStep >= g_maxSteps)
     {
-      LogStepMessage ("MyExecuteActions: Step limit reached, ignoring actions", true);
+      NS_LOG_UNCOND ("MyExecuteActions: Step limit reached, ignoring actions");
       return false;
     }
 
-  LogStepMessage ("MyExecuteActions: step=" + std::to_string (g_currentStep)
-                     + " sim=" + std::to_string (Simulator::Now ().GetSeconds ()), false);
+  LOG_STEP ("MyExecuteActions: step=" << g_currentStep << " sim=" << Simulator::Now ().GetSeconds ());
 
-  g_currentStep++;
+  ApplyAction (action);
   return true;
 }
 
+/**
+ * Headless counterpart of an OpenGym exchange: record the state the agent
+ * would receive, then advance as MyExecuteActions would.
+ */
 void
-ScheduleNextStateRead (double envStepTime, Ptr<OpenGymInterface> openGym)
+ExportCurrentState ()
 {
-  if (g_useSumoMobility)
+  MyGetObservation (); // fills g_observation, export keeps the dense layout
+  g_exportRewards.resize (g_numEnvs);
+  for (uint32_t env = 0; env < g_numEnvs; ++env)
+    {
+      g_exportRewards[env] = GetEnvReward (env);
+    }
+  if (!g_exporter.AppendStep (g_observation->GetData (), g_exportRewards.data (), MyGetExtraInfo ()))
     {
-      ApplySumoMobility (g_currentStep);
+      NS_LOG_UNCOND ("[Export] Write failed, stopping");
+      Simulator::Stop ();
+      return;
+    }
+
+  if (IsEpisodeOver () && HasNextEpisode ())
+    {
+      ResetEpisode ();
+    }
+  else if (IsEpisodeOver ())
+    {
+      Simulator::Stop ();
     }
   else
     {
-      UpdateVehicleMetrics ();
+      ApplyAction (Ptr<OpenGymDataContainer> ());
     }
+}
 
-  openGym->NotifyCurrentState ();
+/// --asyncLag backpressure: wait until the agent frees the slot the next observation is built in.
+void
+WaitForObservationSlot ()
+{
+  uint64_t stallNs = g_shmRing.WaitForSpace (g_asyncLag);
+  if (stallNs > 0)
+    {
+      ++g_asyncStalls;
+      g_asyncStallNs += stallNs;
+    }
+}
 
-  if (g_maxSteps > 0 && g_currentStep >= g_maxSteps)
+/// The newest action the agent sent for the observation just published, or the one in effect.
+Ptr<OpenGymDataContainer>
+TakeAsyncAction ()
+{
+  if (!g_shmActions.Take (g_shmRing.GetPublished (), g_asyncAction->GetData (), g_asyncAction->GetSize ()))
     {
-      LogStepMessage ("ScheduleNextStateRead: Reached max steps, stopping schedule", true);
+      return g_lastAction;
+    }
+  return g_asyncAction;
+}
+
+/**
+ * --asyncLag counterpart of an OpenGym exchange: publish the state into the
+ * ring without waiting for the agent, then advance with the newest action
+ * that has arrived, as ExportCurrentState does with none.
+ */
+void
+PublishAsyncState ()
+{
+  MyGetObservation ();
+  LOG_STEP ("PublishAsyncState: agent " << g_shmRing.GetPublished () - g_shmRing.GetConsumed ()
+                                        << " observations behind");
+  if (IsEpisodeOver () && HasNextEpisode ())
+    {
+      ResetEpisode ();
+    }
+  else if (IsEpisodeOver ())
+    {
+      Simulator::Stop ();
+    }
+  else
+    {
+      ApplyAction (TakeAsyncAction ());
+    }
+}
+
+void
+PublishCurrentState (Ptr<OpenGymInterface> openGym)
+{
+  V2X_PROFILE_SCOPE (EXCHANGE); // self time excludes the callbacks run inside
+  if (g_asyncStepping)
+    {
+      PublishAsyncState ();
+    }
+  else if (openGym)
+    {
+      openGym->NotifyCurrentState ();
+    }
+  else
+    {
+      ExportCurrentState ();
+    }
+}
+
+void
+ScheduleNextStateRead (double envStepTime, Ptr<OpenGymInterface> openGym)
+{
+  g_v2xStepProfiler.SetStep (g_currentStep);
+  if (V2xStepProfiler::TakeDumpRequest ())
+    {
+      g_v2xStepProfiler.DumpReport (g_profileEventsPath);
+    }
+
+  uint64_t allocationCount = GetAllocationCount ();
+  g_stepAllocations = allocationCount - g_stepAllocationMark;
+  g_stepAllocationMark = allocationCount;
+
+  UpdateReplicas ();
+  g_workerPool.CountStep ();
+  if (g_asyncStepping && g_windowSteps == 0)
+    {
+      WaitForObservationSlot (); // before the first row of this exchange is written into the slot
+    }
+
+  // Step 0 of a restarted episode is published alone, like the initial exchange
+  if (g_stepsPerExchange > 1 && g_currentStep > 0)
+    {
+      RecordWindowStep ();
+      if (g_windowSteps < g_stepsPerExchange && !IsEpisodeOver ())
+        {
+          // Keep stepping with the last action until the window is full
+          ApplyAction (g_lastAction);
+          Simulator::Schedule (Seconds (envStepTime), &ScheduleNextStateRead, envStepTime, openGym);
+          return;
+        }
+    }
+
+  bool publishedEpisodeEnd = IsEpisodeOver ();
+  PublishCurrentState (openGym);
+  g_windowSteps = 0;
+
+  // A single episode stops at its limit; with --episodes every episode publishes its final state
+  if (IsEpisodeOver () && !HasNextEpisode () && (g_episodes == 1 || publishedEpisodeEnd))
+    {
+      NS_LOG_UNCOND ("ScheduleNextStateRead: Episode over, stopping schedule");
       return;
     }
 
@@ -453,25 +889,136 @@ main (int argc, char* argv[])
   uint32_t openGymPort = 5556;
   double envStepTime = 0.1; // seconds
   std::string sumoTracePath = "";
+  bool useTraceCache = true;
+  std::string compileTracePath = "";
   uint32_t vehicleCount = 40;
   bool loopSumo = true;
   uint32_t maxSteps = 0; // unlimited by default
   uint32_t logInterval = 10;
+  uint32_t stepsPerExchange = 1;
+  uint32_t numEnvs = 1;
+  uint32_t envStartStride = 0;
+  std::string obsEncoding = "dense";
+  uint32_t keyframeInterval = 50;
+  double deltaEpsilon = 0.0;
+  bool recycleSlots = false;
+  bool streamTrace = false;
+  uint32_t streamWindow = 256;
+  uint32_t streamVehicles = 0;
+  std::string exportPath = "";
+  uint32_t exportChunkSteps = 256;
+  bool profile = false;
+  bool enableCam = false;
+  double camInterval = 0.1;
+  uint32_t camSize = 200;
+  std::string graphStats = "";
+  double commRange = 300.0;
   double areaMin = 0.0;
   double areaMax = 800.0;
   double minSpeed = 5.0;
   double maxSpeedValue = 25.0;
   uint32_t rngSeed = 1;
   uint32_t rngRun = 1;
+  uint32_t workers = 0;
+  double workerReportInterval = 10.0;
+  uint32_t workerRestarts = 5;
+  uint32_t episodes = 1;
+  std::string transport = "zmq";
+  uint32_t shmSlots = 4;
+  std::string shmName = "";
+  uint32_t asyncLag = 0;
+  uint32_t startStep = 0;
+  double startTime = 0.0;
+  uint32_t endStep = 0;
+  uint32_t shards = 0;
+  uint32_t shard = 0;
+  uint32_t episodeStartStride = 0;
 
   CommandLine cmd;
   cmd.AddValue ("openGymPort", "Port number for OpenGym env. Default: 5556", openGymPort);
   cmd.AddValue ("simTime", "Simulation time in seconds", simulationTime);
   cmd.AddValue ("envStep", "Environment step time", envStepTime);
-  cmd.AddValue ("sumoTrace", "Path to SUMO FCD mobility trace (.xml)", sumoTracePath);
+  cmd.AddValue ("sumoTrace", "Path to SUMO FCD mobility trace (.xml) or compiled trace",
+                sumoTracePath);
+  cmd.AddValue ("sumoTraceCache",
+                "Map the compiled <trace>.v2xtrace sidecar, refreshing it when stale",
+                useTraceCache);
+  cmd.AddValue ("compileTrace", "Compile --sumoTrace into this binary trace file and exit",
+                compileTracePath);
+  cmd.AddValue ("parseThreads",
+                "Threads parsing an XML trace in parallel chunks (0 = one per core, 1 = serial)",
+                g_parseThreads);
+  cmd.AddValue ("interpolateTrace",
+                "Interpolate env steps that fall between the timesteps of a coarser trace",
+                g_interpolateTrace);
+  cmd.AddValue ("recycleSlots",
+                "Size the node pool to peak vehicle concurrency and reuse the nodes of departed "
+                "vehicles; assignments are published as slots:slot=vehicleId in the extra info",
+                recycleSlots);
+  cmd.AddValue ("streamTrace",
+                "Replay the XML trace through a bounded window read ahead by a background thread "
+                "instead of loading it whole",
+                streamTrace);
+  cmd.AddValue ("streamWindow", "Steps buffered ahead of the simulation in --streamTrace mode",
+                streamWindow);
+  cmd.AddValue ("streamVehicles",
+                "Node slots in --streamTrace mode (0 uses --vehicleCount), reused as vehicles leave; "
+                "a vehicle arriving while all are taken is dropped until one frees up",
+                streamVehicles);
   cmd.AddValue ("vehicleCount", "Number of vehicles when SUMO is not used", vehicleCount);
   cmd.AddValue ("loopSumo", "Loop SUMO trajectory when simulation exceeds trace length", loopSumo);
   cmd.AddValue ("maxSteps", "Maximum OpenGym steps before terminating (0=unbounded)", maxSteps);
+  cmd.AddValue ("stepsPerExchange",
+                "Sim steps per OpenGym exchange; K > 1 returns a stacked [K, obsSize] observation",
+                stepsPerExchange);
+  cmd.AddValue ("numEnvs", "Scenario replicas behind the OpenGym endpoint (batched [N, ...] spaces)",
+                numEnvs);
+  cmd.AddValue ("envStartStride", "Trace start offset in steps between consecutive replicas",
+                envStartStride);
+  cmd.AddValue ("obsEncoding",
+                "Observation layout: dense (a block per vehicle node), list or csr (active vehicles "
+                "only, self-describing header), delta (dense values as keyframes and changes)",
+                obsEncoding);
+  cmd.AddValue ("keyframeInterval", "Exchanges per delta keyframe, the keyframe included",
+                keyframeInterval);
+  cmd.AddValue ("deltaEpsilon",
+                "Quantum of the delta encoding; values are reconstructed within epsilon/2 "
+                "(0 = exact float values)",
+                deltaEpsilon);
+  cmd.AddValue ("transport",
+                "Observation transport: zmq (in the OpenGym message) or shm (a shared-memory ring "
+                "in /dev/shm, the OpenGym message carries a [sequence, slot, size, step] descriptor)",
+                transport);
+  cmd.AddValue ("shmSlots", "Observation slots of the --transport=shm ring", shmSlots);
+  cmd.AddValue ("shmName", "Name of the ring in /dev/shm (empty = v2x-obs-<openGymPort>)", shmName);
+  cmd.AddValue ("asyncLag",
+                "Observations the simulation may publish ahead of the agent with --transport=shm; "
+                "actions arrive through the <shmName>.actions ring (0 = lockstep exchanges)",
+                asyncLag);
+  cmd.AddValue ("export",
+                "Run headless and write observations to this .npy file (plus .rewards.npy, "
+                ".info.txt and .json) instead of serving OpenGym",
+                exportPath);
+  cmd.AddValue ("exportChunkSteps", "Steps buffered per export chunk before the files are flushed",
+                exportChunkSteps);
+  cmd.AddValue ("profile",
+                "Record per-phase step latency histograms, logged at exit and on SIGUSR1",
+                profile);
+  cmd.AddValue ("profileEvents", "Write the recent profiler events to this CSV with each dump",
+                g_profileEventsPath);
+  cmd.AddValue ("enableCam",
+                "Install 802.11p OCB devices, broadcast CAMs and append per-vehicle delivery "
+                "ratio, latency (ms) and channel busy ratio to the observation",
+                enableCam);
+  cmd.AddValue ("camInterval", "CAM broadcast interval in seconds", camInterval);
+  cmd.AddValue ("camSize", "CAM payload size in bytes", camSize);
+  cmd.AddValue ("graphStats",
+                "Connectivity stats appended to the observation: comma separated clusters, "
+                "largest, meanDegree, isolated, degree (empty disables)",
+                graphStats);
+  cmd.AddValue ("commRange",
+                "Communication range in meters for the connectivity graph and the CAM delivery ratio",
+                commRange);
   cmd.AddValue ("logInterval", "Log every N steps (0 disables per-step logging, 1 logs every step)",
                 logInterval);
   cmd.AddValue ("areaMin", "Minimum coordinate for default random area", areaMin);
@@ -480,36 +1027,188 @@ main (int argc, char* argv[])
   cmd.AddValue ("maxSpeed", "Maximum speed for random-walk mobility", maxSpeedValue);
   cmd.AddValue ("seed", "RNG seed", rngSeed);
   cmd.AddValue ("run", "RNG run number", rngRun);
+  cmd.AddValue ("startStep", "Trace step replayed at env step 0", startStep);
+  cmd.AddValue ("startTime", "Trace time in seconds replayed at env step 0, instead of --startStep",
+                startTime);
+  cmd.AddValue ("endStep",
+                "Trace step at which the episode ends, exclusive (0 = --maxSteps and --simTime only)",
+                endStep);
+  cmd.AddValue ("shards",
+                "Cut the loaded trace into this many equal time shards and replay one of them; "
+                "with --workers it must match the worker count and worker i replays shard i",
+                shards);
+  cmd.AddValue ("shard", "Shard replayed with --shards, from 0", shard);
+  cmd.AddValue ("episodes",
+                "Episodes served in one process; an episode's end is reported as episodeEnd:1 in "
+                "the extra info and the next action restarts it in place (0 = unbounded)",
+                episodes);
+  cmd.AddValue ("episodeStartStride", "Trace start offset in steps between consecutive episodes",
+                episodeStartStride);
+  cmd.AddValue ("workers",
+                "Load the trace once and fork this many worker simulations sharing it; worker i "
+                "serves openGymPort + i with RNG run + i (0 = single process)",
+                workers);
+  cmd.AddValue ("workerReportInterval", "Seconds between worker step rate logs (0 disables)",
+                workerReportInterval);
+  cmd.AddValue ("workerRestarts", "Restarts of a crashed worker before it is given up",
+                workerRestarts);
   cmd.Parse (argc, argv);
 
   g_envStepTime = envStepTime;
   g_maxSteps = maxSteps;
   g_loopSumoTrajectory = loopSumo;
-  g_logInterval = logInterval;
-
-  g_simulationTimeLimit = simulationTime;
-
-  if (g_maxSteps > 0)
+  g_v2xStepLog.SetInterval (logInterval);
+  g_episodes = episodes;
+  g_episodeStartStride = episodeStartStride;
+  g_areaMin = areaMin;
+  g_areaMax = areaMax;
+  if (profile || !g_profileEventsPath.empty ())
     {
-      double minimumSim = envStepTime * (g_maxSteps + 5);
-      if (simulationTime < minimumSim)
-        {
-          NS_LOG_UNCOND ("[Config] Extending simulation time to " << minimumSim
-                                                                   << "s to cover requested steps");
-          simulationTime = minimumSim;
-          g_simulationTimeLimit = simulationTime;
-        }
+      g_v2xStepProfiler.Enable (1 << 16);
+      V2xStepProfiler::InstallSignalHandler ();
+    }
+  g_stepsPerExchange = std::max<uint32_t> (stepsPerExchange, 1);
+  g_numEnvs = std::max<uint32_t> (numEnvs, 1);
+  g_windowRewards.assign (g_numEnvs * g_stepsPerExchange, 0.0f);
+  g_enableCam = enableCam;
+  if (!V2xConnectivityGraph::ParseStats (graphStats, g_graphStats))
+    {
+      NS_LOG_UNCOND ("[Config] Unknown --graphStats entry in '" << graphStats << "'");
+      return 1;
+    }
+  if (!V2xSparseObservation::ParseEncoding (obsEncoding, g_obsEncoding))
+    {
+      NS_LOG_UNCOND ("[Config] Unknown --obsEncoding '" << obsEncoding << "'");
+      return 1;
+    }
+  if (g_obsEncoding != V2xSparseObservation::DENSE && !exportPath.empty ())
+    {
+      NS_LOG_UNCOND ("[Config] --export writes fixed-size rows, use --obsEncoding=dense");
+      return 1;
+    }
+  if (transport != "zmq" && transport != "shm")
+    {
+      NS_LOG_UNCOND ("[Config] Unknown --transport '" << transport << "'");
+      return 1;
     }
+  g_shmTransport = transport == "shm" && exportPath.empty ();
+  if (g_shmTransport && g_obsEncoding == V2xSparseObservation::DELTA)
+    {
+      NS_LOG_UNCOND ("[Config] --obsEncoding=delta saves wire bytes, --transport=shm has none to save");
+      return 1;
+    }
+  g_asyncLag = exportPath.empty () ? asyncLag : 0;
+  if (g_asyncLag > 0 && !g_shmTransport)
+    {
+      NS_LOG_UNCOND ("[Config] --asyncLag needs --transport=shm");
+      return 1;
+    }
+  if (g_asyncLag > 0 && (recycleSlots || streamTrace))
+    {
+      // The slot changes travel in the extra info, which the ring does not carry
+      NS_LOG_UNCOND ("[Config] --asyncLag cannot report slot reassignments, drop --recycleSlots and "
+                     "--streamTrace");
+      return 1;
+    }
+  // The producer reuses a slot only once the agent consumed it
+  shmSlots = std::max<uint32_t> ({shmSlots, g_asyncLag, 1});
+  if (workers > 0 && !exportPath.empty () && shards != workers)
+    {
+      NS_LOG_UNCOND ("[Config] --workers with --export needs --shards=" << workers
+                     << ", each worker exports one shard");
+      return 1;
+    }
+  if (shards > 0 && (startStep > 0 || startTime > 0.0 || endStep > 0))
+    {
+      NS_LOG_UNCOND ("[Config] --shards sets the trace range, drop --startStep, --startTime and "
+                     "--endStep");
+      return 1;
+    }
+  if (shards > 0 && (workers > 0 ? shards != workers : shard >= shards))
+    {
+      NS_LOG_UNCOND ("[Config] --shards=" << shards << " needs --shard below it, or --workers="
+                     << shards);
+      return 1;
+    }
+  if (startStep > 0 && startTime > 0.0)
+    {
+      NS_LOG_UNCOND ("[Config] Give either --startStep or --startTime");
+      return 1;
+    }
+  g_observationOps = V2xObservationOps::Select (g_enableCam, g_graphStats);
+  g_sparseObservation.Configure (g_obsEncoding, g_observationOps.getSparseRowFields (g_graphStats),
+                                 g_observationOps.entryFields);
+  g_deltaEncoder.Configure (keyframeInterval, static_cast<float> (deltaEpsilon));
 
   RngSeedManager::SetSeed (rngSeed);
   RngSeedManager::SetRun (rngRun);
 
-  if (!sumoTracePath.empty ())
+  g_traceReplay.Configure (g_envStepTime, g_parseThreads, g_interpolateTrace);
+  if (!compileTracePath.empty ())
+    {
+      bool compiled = !sumoTracePath.empty () && g_traceReplay.Parse (sumoTracePath)
+                      && g_traceReplay.Compile (sumoTracePath, compileTracePath);
+      return compiled ? 0 : 1;
+    }
+
+  if (streamTrace && SumoTraceCacheFile::IsCacheFile (sumoTracePath))
+    {
+      NS_LOG_UNCOND ("[Config] Compiled traces are memory-mapped, ignoring --streamTrace");
+      streamTrace = false;
+    }
+  if (!sumoTracePath.empty () && streamTrace)
+    {
+      if (g_episodes != 1)
+        {
+          NS_LOG_UNCOND ("[Config] --streamTrace replays the trace once, --episodes must be 1");
+          return 1;
+        }
+      if (workers > 0)
+        {
+          NS_LOG_UNCOND ("[Config] --workers shares the loaded trace, it cannot be combined with "
+                         "--streamTrace");
+          return 1;
+        }
+      // The node count has to be known before the trace is read, so it bounds the vehicles present at once
+      g_nodeNum = streamVehicles > 0 ? streamVehicles : vehicleCount;
+      if (envStartStride > 0 && g_numEnvs > 1)
+        {
+          NS_LOG_UNCOND ("[Config] --streamTrace replays one window, --envStartStride must be 0");
+          return 1;
+        }
+      if (g_loopSumoTrajectory)
+        {
+          NS_LOG_UNCOND ("[Config] --streamTrace does not loop, the last trace step is held");
+          g_loopSumoTrajectory = false;
+        }
+      g_streamTrace = g_traceStream.Start (sumoTracePath, g_envStepTime, streamWindow, g_nodeNum);
+      g_useSumoMobility = g_streamTrace;
+      g_recycleSlots = g_streamTrace; // slots are assigned as the trace is read, without a slot map
+      if (!g_streamTrace)
+        {
+          NS_LOG_UNCOND ("[SUMO] Cannot open " << sumoTracePath << " for streaming");
+        }
+      else
+        {
+          NS_LOG_UNCOND ("[SUMO] Streaming " << sumoTracePath << " with a " << g_traceStream.GetWindow ()
+                         << "-step window into " << g_nodeNum << " recycled node slots");
+        }
+    }
+  else if (!sumoTracePath.empty ())
     {
-      g_useSumoMobility = LoadSumoTrajectory (sumoTracePath);
+      g_useSumoMobility = g_traceReplay.Load (sumoTracePath, useTraceCache);
+      g_envStepTime = g_traceReplay.GetEnvStepTime ();
       if (g_useSumoMobility)
         {
-          g_nodeNum = g_sumoVehicleCount;
+          g_nodeNum = g_traceReplay.GetVehicleCount ();
+        }
+      if (g_useSumoMobility && recycleSlots)
+        {
+          g_recycleSlots = true;
+          g_slotMap.Build (g_traceReplay.GetView ());
+          g_nodeNum = g_slotMap.GetSlotCount ();
+          NS_LOG_UNCOND ("[SUMO] Recycling node slots: " << g_nodeNum << " slots for "
+                         << g_traceReplay.GetVehicleCount () << " vehicles");
         }
     }
 
@@ -521,32 +1220,181 @@ main (int argc, char* argv[])
         }
       g_nodeNum = vehicleCount;
     }
+  else if (!g_streamTrace)
+    {
+      // Before any fork, so workers share the tracks with the trajectory
+      g_traceReplay.BuildNodeTracks (g_nodeNum, g_recycleSlots ? &g_slotMap : nullptr);
+    }
+
+  if (startTime > 0.0)
+    {
+      startStep = static_cast<uint32_t> (std::llround (startTime / g_envStepTime));
+    }
+  if ((startStep > 0 || shards > 0) && !g_useSumoMobility)
+    {
+      NS_LOG_UNCOND ("[Config] --startStep, --startTime and --shards need a SUMO trace");
+      return 1;
+    }
+  if (shards > 0 && g_streamTrace)
+    {
+      NS_LOG_UNCOND ("[Config] --shards needs the trace length, it cannot be combined with "
+                     "--streamTrace");
+      return 1;
+    }
+  if (g_useSumoMobility && !g_streamTrace && !g_loopSumoTrajectory
+      && startStep >= g_traceReplay.GetView ().timestepCount)
+    {
+      NS_LOG_UNCOND ("[Config] --startStep " << startStep << " is past the last trace step "
+                     << g_traceReplay.GetView ().timestepCount - 1);
+      return 1;
+    }
+  if (g_useSumoMobility && shards > g_traceReplay.GetView ().timestepCount)
+    {
+      // An empty shard ends at step 0, which would read as an unbounded range
+      NS_LOG_UNCOND ("[Config] --shards " << shards << " exceeds the "
+                     << g_traceReplay.GetView ().timestepCount << " trace steps, some shards would be empty");
+      return 1;
+    }
+  if (g_useSumoMobility && !g_streamTrace && endStep > g_traceReplay.GetView ().timestepCount)
+    {
+      // A range end past the trace would hold its last step, or wrap around with --loopSumo
+      NS_LOG_UNCOND ("[Config] --endStep " << endStep << " is past the end of the trace ("
+                     << g_traceReplay.GetView ().timestepCount << " steps)");
+      return 1;
+    }
+
+  if (workers > 0)
+    {
+      int worker = g_workerPool.Run (workers, workerReportInterval, workerRestarts);
+      if (worker == V2xWorkerPool::kSupervisor)
+        {
+          return g_workerPool.AllSucceeded () ? 0 : 1;
+        }
+      openGymPort += worker;
+      rngRun += worker;
+      RngSeedManager::SetRun (rngRun);
+      if (!g_profileEventsPath.empty ())
+        {
+          g_profileEventsPath += ".worker" + std::to_string (worker);
+        }
+      if (!shmName.empty ())
+        {
+          shmName += ".worker" + std::to_string (worker);
+        }
+      g_episodeRunStride = workers;
+      if (shards > 0)
+        {
+          shard = worker;
+        }
+      if (!exportPath.empty ())
+        {
+          // One file per shard, concatenated in shard order
+          bool npy = exportPath.size () >= 4 && exportPath.compare (exportPath.size () - 4, 4, ".npy") == 0;
+          exportPath.insert (npy ? exportPath.size () - 4 : exportPath.size (),
+                             ".shard" + std::to_string (worker));
+        }
+      NS_LOG_UNCOND ("[Workers] Worker " << worker << " (pid " << getpid () << "): OpenGym port "
+                     << openGymPort << ", RNG run " << rngRun);
+    }
+
+  g_rngRun = rngRun;
+
+  // Trace range of this run; replay seeks to the start through the trace's step index
+  if (shards > 0)
+    {
+      g_traceReplay.GetShard (shard, shards, startStep, endStep);
+      NS_LOG_UNCOND ("[SUMO] Shard " << shard << " of " << shards << ": trace steps [" << startStep
+                     << ", " << endStep << ")");
+    }
+  if (endStep > 0)
+    {
+      if (endStep <= startStep)
+        {
+          NS_LOG_UNCOND ("[Config] The trace range [" << startStep << ", " << endStep << ") is empty");
+          return 1;
+        }
+      g_maxSteps = g_maxSteps > 0 ? std::min (g_maxSteps, endStep - startStep) : endStep - startStep;
+    }
+
+  g_simulationTimeLimit = simulationTime;
+
+  if (g_maxSteps > 0)
+    {
+      double minimumSim = envStepTime * (g_maxSteps + 5);
+      if (simulationTime < minimumSim)
+        {
+          NS_LOG_UNCOND ("[Config] Extending simulation time to " << minimumSim
+                                                                   << "s to cover requested steps");
+          simulationTime = minimumSim;
+          g_simulationTimeLimit = simulationTime;
+        }
+    }
 
   NS_LOG_UNCOND ("=== Training V2X Dataset Simulation ===");
   NS_LOG_UNCOND ("Simulation time: " << simulationTime << "s");
-  NS_LOG_UNCOND ("OpenGym port: " << openGymPort);
+  if (exportPath.empty ())
+    {
+      NS_LOG_UNCOND ("OpenGym port: " << openGymPort);
+    }
+  else
+    {
+      NS_LOG_UNCOND ("Export: " << exportPath << " (" << exportChunkSteps << " steps per chunk)");
+    }
   NS_LOG_UNCOND ("Environment step time: " << envStepTime << "s");
   NS_LOG_UNCOND ("SUMO mobility enabled: " << (g_useSumoMobility ? "yes" : "no"));
   if (g_useSumoMobility)
     {
       NS_LOG_UNCOND ("Loop SUMO: " << (g_loopSumoTrajectory ? "yes" : "no"));
+      NS_LOG_UNCOND ("Start step: " << startStep);
     }
   NS_LOG_UNCOND ("Vehicle count: " << g_nodeNum);
   NS_LOG_UNCOND ("Max steps: " << (g_maxSteps > 0 ? std::to_string (g_maxSteps) : std::string ("unbounded")));
   NS_LOG_UNCOND ("Log interval: " << logInterval);
+  NS_LOG_UNCOND ("Steps per exchange: " << g_stepsPerExchange);
+  NS_LOG_UNCOND ("Environments: " << g_numEnvs);
+  if (g_episodes != 1)
+    {
+      NS_LOG_UNCOND ("Episodes: " << (g_episodes > 0 ? std::to_string (g_episodes) : std::string ("unbounded"))
+                     << " (start stride " << g_episodeStartStride << " steps)");
+    }
+  NS_LOG_UNCOND ("CAM telemetry: " << (g_enableCam ? "yes" : "no"));
+  if (g_graphStats != 0)
+    {
+      NS_LOG_UNCOND ("Graph stats: " << graphStats << " (range " << commRange << "m)");
+    }
 
-  g_nodes.Create (g_nodeNum);
-  InitializeVehicleMetrics ();
-  NS_LOG_UNCOND ("Created " << g_nodeNum << " vehicle nodes");
+  g_replicas.resize (g_numEnvs);
+  for (uint32_t env = 0; env < g_numEnvs; ++env)
+    {
+      V2xReplica& replica = g_replicas[env];
+      replica.startStep = startStep + env * envStartStride;
+      // CAM devices are installed once, so only a pool without them is filled lazily
+      replica.nodes.Create (g_recycleSlots && !g_enableCam ? 0 : g_nodeNum);
+      replica.slots.Resize (g_recycleSlots ? g_nodeNum : 0, &g_traceReplay.GetView ());
+      replica.graph.Configure (commRange, g_graphStats);
+      ResetVehicleMetrics (replica.metrics, g_nodeNum);
+    }
+  NS_LOG_UNCOND ((g_recycleSlots && !g_enableCam ? "Reserved " : "Created ")
+                 << g_nodeNum << " vehicle nodes" << (g_numEnvs > 1 ? " per replica" : ""));
 
-  if (g_useSumoMobility)
+  if (g_useSumoMobility && g_streamTrace)
     {
       MobilityHelper mobility;
       mobility.SetMobilityModel ("ns3::ConstantPositionMobilityModel");
-      mobility.Install (g_nodes);
+      for (auto& replica : g_replicas)
+        {
+          mobility.Install (replica.nodes);
+        }
       NS_LOG_UNCOND ("Installed SUMO-driven constant position mobility models");
-
-      ApplySumoMobility (0);
+    }
+  else if (g_useSumoMobility)
+    {
+      for (auto& replica : g_replicas)
+        {
+          replica.timeline =
+              g_traceReplay.InstallMobility (replica.nodes, replica.startStep, g_loopSumoTrajectory);
+        }
+      NS_LOG_UNCOND ("Installed trace replay mobility models, positions are evaluated on demand");
     }
   else
     {
@@ -565,33 +1413,167 @@ main (int argc, char* argv[])
       mobility.SetMobilityModel ("ns3::RandomWalk2dMobilityModel",
                                  "Bounds", RectangleValue (Rectangle (areaMin, areaMax, areaMin, areaMax)),
                                  "Speed", StringValue (speedStr.str ()));
-      mobility.Install (g_nodes);
+      // Fixed per-replica stream blocks keep replica i's random walk independent of N
+      for (uint32_t env = 0; env < g_numEnvs; ++env)
+        {
+          mobility.Install (g_replicas[env].nodes);
+          if (g_numEnvs > 1)
+            {
+              mobility.AssignStreams (g_replicas[env].nodes, GetReplicaStreamBase (env));
+            }
+        }
       NS_LOG_UNCOND ("Installed random walk mobility models within [" << areaMin << ", " << areaMax
                                                                        << "]");
-
-      UpdateVehicleMetrics ();
     }
+  if (g_enableCam)
+    {
+      for (uint32_t env = 0; env < g_numEnvs; ++env)
+        {
+          V2xReplica& replica = g_replicas[env];
+          replica.cam.Install (replica.nodes, camInterval, camSize, replica.graph,
+                               GetReplicaCamStream (env));
+        }
+      NS_LOG_UNCOND ("Installed 802.11p OCB devices, CAM every " << camInterval << "s ("
+                     << camSize << " bytes)");
+    }
+  UpdateReplicas ();
 
-  Ptr<OpenGymInterface> openGym = CreateObject<OpenGymInterface> (openGymPort);
-  openGym->SetGetActionSpaceCb (MakeCallback (&MyGetActionSpace));
-  openGym->SetGetObservationSpaceCb (MakeCallback (&MyGetObservationSpace));
-  openGym->SetGetGameOverCb (MakeCallback (&MyGetGameOver));
-  openGym->SetGetObservationCb (MakeCallback (&MyGetObservation));
-  openGym->SetGetRewardCb (MakeCallback (&MyGetReward));
-  openGym->SetGetExtraInfoCb (MakeCallback (&MyGetExtraInfo));
-  openGym->SetExecuteActionsCb (MakeCallback (&MyExecuteActions));
-  NS_LOG_UNCOND ("OpenGym callbacks configured");
-
-  Simulator::Schedule (Seconds (envStepTime), &ScheduleNextStateRead, envStepTime, openGym);
+  Ptr<OpenGymInterface> openGym;
+  if (exportPath.empty ())
+    {
+      if (g_shmTransport)
+        {
+          uint32_t rows = g_numEnvs * g_stepsPerExchange;
+          bool sparse = V2xSparseObservation::IsSparse (g_obsEncoding);
+          uint64_t capacity = sparse ? g_sparseObservation.GetMaxSize (rows, g_nodeNum)
+                                     : uint64_t (rows) * GetObservationSize ();
+          if (shmName.empty ())
+            {
+              shmName = "v2x-obs-" + std::to_string (openGymPort);
+            }
+          if (!g_shmRing.Open (shmName, shmSlots, static_cast<uint32_t> (capacity),
+                               g_obsEncoding,
+                               sparse ? std::vector<uint32_t> {static_cast<uint32_t> (capacity)}
+                                      : GetObservationShape ()))
+            {
+              NS_LOG_UNCOND ("[Config] Cannot create the observation ring /dev/shm/" << shmName);
+              return 1;
+            }
+          g_shmDescriptor = CreateObject<V2xShmDescriptorContainer> ();
+          NS_LOG_UNCOND ("Observation ring " << g_shmRing.GetPath () << ": " << shmSlots << " slots of "
+                         << capacity << " floats");
+        }
+      if (g_asyncLag > 0)
+        {
+          g_asyncAction = CreateObject<V2xObservationContainer> (GetActionShape ());
+          if (!g_shmActionRing.Open (shmName + ".actions", shmSlots, g_asyncAction->GetSize (), V2xSparseObservation::DENSE,
+                                     GetActionShape ()))
+            {
+              NS_LOG_UNCOND ("[Config] Cannot create the action ring /dev/shm/" << shmName << ".actions");
+              return 1;
+            }
+          g_shmActions.Attach (&g_shmActionRing);
+          NS_LOG_UNCOND ("Async stepping: up to " << g_asyncLag << " observations ahead, actions from "
+                         << g_shmActionRing.GetPath ());
+        }
+      openGym = CreateObject<OpenGymInterface> (openGymPort);
+      openGym->SetGetActionSpaceCb (MakeCallback (&MyGetActionSpace));
+      openGym->SetGetObservationSpaceCb (MakeCallback (&MyGetObservationSpace));
+      openGym->SetGetGameOverCb (MakeCallback (&MyGetGameOver));
+      openGym->SetGetObservationCb (MakeCallback (&MyGetObservation));
+      openGym->SetGetRewardCb (MakeCallback (&MyGetReward));
+      openGym->SetGetExtraInfoCb (MakeCallback (&MyGetExtraInfo));
+      openGym->SetExecuteActionsCb (MakeCallback (&MyExecuteActions));
+      NS_LOG_UNCOND ("OpenGym callbacks configured");
+    }
+  else
+    {
+      V2xDatasetExporter::Layout layout;
+      layout.observationShape = GetObservationShape ();
+      layout.numEnvs = g_numEnvs;
+      layout.stepsPerExchange = g_stepsPerExchange;
+      layout.envStepTime = g_envStepTime;
+      layout.source = g_useSumoMobility ? sumoTracePath : std::string ("random-walk");
+      layout.recycledSlots = g_recycleSlots;
+      layout.startStep = startStep;
+      if (g_enableCam)
+        {
+          layout.observationLayout += ", then deliveryRatio, latencyMs, busyRatio per vehicle node";
+        }
+      if (g_graphStats != 0)
+        {
+          layout.observationLayout += ", then graph stats (" + graphStats + ")";
+        }
+      if (!g_exporter.Open (exportPath, layout, g_traceReplay.GetView (), exportChunkSteps))
+        {
+          NS_LOG_UNCOND ("[Export] Failed to open " << exportPath);
+          return 1;
+        }
+    }
 
   NS_LOG_UNCOND ("=== Starting Training V2X Simulation ===");
-  openGym->NotifyCurrentState ();
+  PublishCurrentState (openGym);
+  g_windowSteps = 0;
+  // The first exchange is the OpenGym handshake; with --asyncLag the rest go through the rings
+  g_asyncStepping = g_asyncLag > 0;
+  // As in ScheduleNextStateRead, a single one-step episode stops after its first state
+  if (!IsEpisodeOver () || g_episodes != 1)
+    {
+      Simulator::Schedule (Seconds (envStepTime), &ScheduleNextStateRead, envStepTime, openGym);
+    }
 
-  Simulator::Stop (Seconds (simulationTime));
+  if (g_episodes == 1)
+    {
+      Simulator::Stop (Seconds (simulationTime));
+    }
   Simulator::Run ();
 
   NS_LOG_UNCOND ("=== Simulation Complete ===");
-  openGym->NotifySimulationEnd ();
+  g_v2xStepProfiler.DumpReport (g_profileEventsPath);
+  if (g_asyncStepping)
+    {
+      if ((g_shmRing.GetLastFlags () & V2xShmRing::GAME_OVER) == 0)
+        {
+          // Empty end-of-run slot, the single-episode limit is not published as a state
+          WaitForObservationSlot ();
+          g_shmRing.Publish (0, g_currentStep, 0.0f, V2xShmRing::GAME_OVER, g_asyncStallNs);
+        }
+      const V2xShmActionReader::Stats& actions = g_shmActions.GetStats ();
+      NS_LOG_UNCOND ("[Async] " << g_shmRing.GetPublished () << " observations, simulation stalled "
+                     << g_asyncStallNs * 1e-6 << " ms in " << g_asyncStalls << " waits for the agent, agent stalled "
+                     << g_shmRing.GetConsumerStallSeconds () * 1e3 << " ms waiting for observations");
+      NS_LOG_UNCOND ("[Async] " << actions.received << " actions received, " << actions.superseded
+                     << " superseded, " << actions.late << " late by " << actions.lateBy << " observations in total");
+    }
+  if (openGym)
+    {
+      openGym->NotifySimulationEnd ();
+    }
+  else
+    {
+      uint64_t exportedSteps = g_exporter.GetSteps ();
+      if (!g_exporter.Close ())
+        {
+          NS_LOG_UNCOND ("[Export] Failed to finalize " << exportPath);
+          Simulator::Destroy ();
+          return 1;
+        }
+      NS_LOG_UNCOND ("[Export] Wrote " << exportedSteps << " steps to " << exportPath);
+    }
+  if (g_streamTrace)
+    {
+      g_traceStream.Stop ();
+      SumoTraceStreamStats stats = g_traceStream.GetStats ();
+      NS_LOG_UNCOND ("[SUMO] Streamed " << stats.framesRead << " steps of " << stats.vehicles
+                     << " vehicles (peak " << stats.peakFrameSize << " per step, " << stats.slots << " of "
+                     << g_nodeNum << " slots used), " << stats.overflow
+                     << " samples dropped while every slot was taken, " << stats.stalls << " stalls ("
+                     << stats.stallSeconds * 1e3 << " ms)");
+      if (g_traceStream.HasFailed ())
+        {
+          NS_LOG_UNCOND ("[SUMO] Streaming stopped early: " << sumoTracePath << " could not be parsed");
+        }
+    }
   Simulator::Destroy ();
 
   return 0;
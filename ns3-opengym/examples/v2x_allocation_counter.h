@@ -0,0 +1,84 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Process-wide heap allocation counter for the V2X examples
+ *
+ * Replaces the global operator new/delete with malloc/free wrappers that
+ * count allocations and requested bytes, so the examples can report how
+ * many allocations a step performs. The replacement functions are defined here, which means this
+ * header must be included by exactly one translation unit of a program.
+ */
+
+#ifndef V2X_ALLOCATION_COUNTER_H
+#define V2X_ALLOCATION_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace ns3 {
+
+inline std::atomic<uint64_t> g_v2xAllocationCount{0};
+inline std::atomic<uint64_t> g_v2xAllocationBytes{0};
+
+/// Number of operator new calls since program start.
+inline uint64_t
+GetAllocationCount ()
+{
+  return g_v2xAllocationCount.load (std::memory_order_relaxed);
+}
+
+/// Bytes requested from operator new since program start; frees are not subtracted.
+inline uint64_t
+GetAllocatedBytes ()
+{
+  return g_v2xAllocationBytes.load (std::memory_order_relaxed);
+}
+
+} // namespace ns3
+
+void*
+operator new (std::size_t size)
+{
+  ns3::g_v2xAllocationCount.fetch_add (1, std::memory_order_relaxed);
+  ns3::g_v2xAllocationBytes.fetch_add (size, std::memory_order_relaxed);
+  void* p = std::malloc (size > 0 ? size : 1);
+  if (p == nullptr)
+    {
+      throw std::bad_alloc ();
+    }
+  return p;
+}
+
+void*
+operator new[] (std::size_t size)
+{
+  return operator new (size);
+}
+
+// The deletes stay out of line, otherwise GCC flags free () on memory from operator new
+[[gnu::noinline]] void
+operator delete (void* p) noexcept
+{
+  std::free (p);
+}
+
+[[gnu::noinline]] void
+operator delete[] (void* p) noexcept
+{
+  std::free (p);
+}
+
+[[gnu::noinline]] void
+operator delete (void* p, std::size_t) noexcept
+{
+  std::free (p);
+}
+
+[[gnu::noinline]] void
+operator delete[] (void* p, std::size_t) noexcept
+{
+  std::free (p);
+}
+
+#endif /* V2X_ALLOCATION_COUNTER_H */
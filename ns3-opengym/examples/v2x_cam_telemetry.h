@@ -0,0 +1,298 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * 802.11p OCB CAM broadcasts with aggregated link telemetry for the V2X examples
+ *
+ * Every vehicle broadcasts a fixed-size CAM-style beacon on a shared 802.11p
+ * OCB channel. The receive callback and the PHY state trace update plain
+ * per-node counters; once per env step CollectStep turns them into the
+ * delivery ratio, mean latency and channel busy ratio seen by each receiver
+ * and clears them. Nothing is logged or stored per packet, so the cost per
+ * CAM is one counter update on each receiver.
+ *
+ * Delivery is measured against the vehicles within communication range of
+ * the receiver, taken from the connectivity graph of the step the CAMs were
+ * sent in: only their CAMs are expected, and only their CAMs count when
+ * received. Vehicles that are not active in the trace neither send nor
+ * receive, and report zero link stats.
+ */
+
+#ifndef V2X_CAM_TELEMETRY_H
+#define V2X_CAM_TELEMETRY_H
+
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/wave-module.h"
+#include "ns3/wifi-module.h"
+
+#include "v2x_connectivity_graph.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * Link quality of one receiver over the last env step.
+ */
+struct V2xLinkStats
+{
+  float deliveryRatio = 0.0f; // CAMs received / CAMs broadcast by the vehicles in range
+  float latencyMs = 0.0f;     // mean CAM latency
+  float busyRatio = 0.0f;     // share of the step the PHY was in TX, RX or CCA busy
+};
+
+class V2xCamTelemetry
+{
+public:
+  /// Ethertype carried by the CAM frames.
+  static constexpr uint16_t kCamProtocol = 0x8947;
+  /// Observation floats appended per vehicle: delivery ratio, latency, busy ratio.
+  static constexpr uint32_t kStatsPerVehicle = 3;
+
+  /**
+   * Install an 802.11p OCB device on every node and start the CAM schedule.
+   * Each call creates its own channel, so separate node sets do not interfere.
+   * range is the connectivity graph of the same nodes, updated once per env
+   * step after CollectStep. The devices and the CAM jitter draw from the
+   * GetStreamCount streams starting at stream.
+   */
+  void
+  Install (const NodeContainer& nodes, double camInterval, uint32_t camSize,
+           const V2xConnectivityGraph& range, int64_t stream)
+  {
+    YansWifiChannelHelper channel = YansWifiChannelHelper::Default ();
+    YansWifiPhyHelper phy;
+    phy.SetChannel (channel.Create ());
+    NqosWaveMacHelper mac = NqosWaveMacHelper::Default ();
+    Wifi80211pHelper wifi = Wifi80211pHelper::Default ();
+    wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager",
+                                  "DataMode", StringValue ("OfdmRate6MbpsBW10MHz"),
+                                  "NonUnicastMode", StringValue ("OfdmRate6MbpsBW10MHz"));
+    m_devices = wifi.Install (phy, mac, nodes);
+
+    // The counters are bound into device callbacks by address, so they are sized once here
+    m_nodes.clear ();
+    m_nodes.resize (nodes.GetN ());
+    m_stats.assign (nodes.GetN (), V2xLinkStats ());
+    m_range = &range;
+    m_jitter = CreateObject<UniformRandomVariable> ();
+    for (uint32_t i = 0; i < m_devices.GetN (); ++i)
+      {
+        NodeCounters& counters = m_nodes[i];
+        counters.device = m_devices.Get (i);
+        counters.index = i;
+        counters.range = &range;
+        counters.camInterval = camInterval;
+        counters.camSize = std::max<uint32_t> (camSize, kCamHeaderSize);
+        counters.device->SetReceiveCallback (MakeBoundCallback (&V2xCamTelemetry::ReceiveCam, &counters));
+
+        Ptr<WifiNetDevice> wifiDevice = DynamicCast<WifiNetDevice> (counters.device);
+        wifiDevice->GetPhy ()->GetState ()->TraceConnectWithoutContext (
+            "State", MakeBoundCallback (&V2xCamTelemetry::PhyStateChanged, &counters));
+      }
+    Reset (stream);
+  }
+
+  /**
+   * Start a new episode on the installed devices. Call it after
+   * RngSeedManager::SetRun with the stream passed to Install: the WiFi
+   * devices and the CAM jitter are reseeded, the CAM schedule restarts with
+   * fresh jitter, and the counters, link stats and CAMs still in flight of
+   * the previous episode are dropped.
+   */
+  void
+  Reset (int64_t stream)
+  {
+    int64_t deviceStreams = kStreamsPerDevice * int64_t (m_devices.GetN ());
+    int64_t used = WifiHelper::AssignStreams (m_devices, stream);
+    NS_ABORT_MSG_IF (used > deviceStreams, "802.11p devices use " << used << " RNG streams, "
+                                                                   << deviceStreams << " reserved");
+    m_jitter->SetStream (stream + deviceStreams);
+    int64_t nowNs = Simulator::Now ().GetNanoSeconds ();
+    for (auto& counters : m_nodes)
+      {
+        counters.nextCam.Cancel ();
+        counters.sent = 0;
+        counters.received = 0;
+        counters.latencyNs = 0;
+        counters.busyNs = 0;
+        counters.resetNs = nowNs;
+        ScheduleFirstCam (counters);
+      }
+    std::fill (m_stats.begin (), m_stats.end (), V2xLinkStats ());
+  }
+
+  /// RNG streams Reset takes for nodeCount vehicles: a fixed budget per device, then the jitter.
+  static int64_t
+  GetStreamCount (uint32_t nodeCount)
+  {
+    return kStreamsPerDevice * int64_t (nodeCount) + 1;
+  }
+
+  bool
+  IsInstalled () const
+  {
+    return !m_nodes.empty ();
+  }
+
+  /// Only active vehicles broadcast and receive; an inactive one reports zero link stats.
+  void
+  SetActive (uint32_t node, bool active)
+  {
+    if (node < m_nodes.size ())
+      {
+        m_nodes[node].active = active;
+        if (!active)
+          {
+            m_stats[node] = V2xLinkStats ();
+          }
+      }
+  }
+
+  /**
+   * Turn the counters of the step that just ended into link stats and start
+   * a new window. Call it before the range graph moves on to the new step.
+   */
+  void
+  CollectStep (double stepSeconds)
+  {
+    int64_t stepNs = static_cast<int64_t> (stepSeconds * 1e9);
+    for (uint32_t i = 0; i < m_nodes.size (); ++i)
+      {
+        NodeCounters& counters = m_nodes[i];
+        V2xLinkStats& stats = m_stats[i];
+        uint64_t expected = 0;
+        m_range->ForEachNeighbour (i, [this, &expected] (uint32_t sender) {
+          expected += m_nodes[sender].sent;
+        });
+        stats.deliveryRatio = expected > 0 ? std::min (1.0f, float (counters.received) / expected) : 0.0f;
+        stats.latencyMs = counters.received > 0 ? float (counters.latencyNs / 1e6 / counters.received) : 0.0f;
+        stats.busyRatio = stepNs > 0 ? std::min (1.0f, float (double (counters.busyNs) / stepNs)) : 0.0f;
+        if (!counters.active)
+          {
+            stats = V2xLinkStats ();
+          }
+      }
+    for (auto& counters : m_nodes)
+      {
+        counters.sent = 0;
+        counters.received = 0;
+        counters.latencyNs = 0;
+        counters.busyNs = 0;
+      }
+  }
+
+  const V2xLinkStats&
+  GetStats (uint32_t node) const
+  {
+    return m_stats[node];
+  }
+
+  /// Write kStatsPerVehicle values per node for the first nodeCount nodes.
+  template <typename Value>
+  void
+  FillObservation (Value* out, uint32_t nodeCount) const
+  {
+    for (uint32_t i = 0; i < nodeCount; ++i, out += kStatsPerVehicle)
+      {
+        const V2xLinkStats& stats = i < m_stats.size () ? m_stats[i] : V2xLinkStats ();
+        out[0] = stats.deliveryRatio;
+        out[1] = stats.latencyMs;
+        out[2] = stats.busyRatio;
+      }
+  }
+
+private:
+  /// Sender index and transmit time in nanoseconds, ahead of the zero padding.
+  static constexpr uint32_t kCamHeaderSize = sizeof (uint32_t) + sizeof (int64_t);
+  /// Covers the PHY, MAC backoff and rate manager streams of one 802.11p device.
+  static constexpr int64_t kStreamsPerDevice = 8;
+
+  struct NodeCounters
+  {
+    Ptr<NetDevice> device;
+    const V2xConnectivityGraph* range = nullptr;
+    uint32_t index = 0;
+    double camInterval = 0.1;
+    uint32_t camSize = 200;
+    bool active = true;
+    EventId nextCam;
+    int64_t resetNs = 0; // CAMs sent before this belong to the previous episode
+
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    int64_t latencyNs = 0;
+    int64_t busyNs = 0;
+  };
+
+  /// Desynchronize the first CAMs so the vehicles do not all contend at once.
+  void
+  ScheduleFirstCam (NodeCounters& counters)
+  {
+    counters.nextCam = Simulator::Schedule (Seconds (m_jitter->GetValue (0.0, counters.camInterval)),
+                                            &V2xCamTelemetry::SendCam, &counters);
+  }
+
+  static void
+  SendCam (NodeCounters* counters)
+  {
+    if (counters->active)
+      {
+        uint8_t header[kCamHeaderSize];
+        int64_t now = Simulator::Now ().GetNanoSeconds ();
+        std::memcpy (header, &counters->index, sizeof (uint32_t));
+        std::memcpy (header + sizeof (uint32_t), &now, sizeof (int64_t));
+        Ptr<Packet> cam = Create<Packet> (header, kCamHeaderSize);
+        cam->AddPaddingAtEnd (counters->camSize - kCamHeaderSize);
+        counters->device->Send (cam, counters->device->GetBroadcast (), kCamProtocol);
+        counters->sent++;
+      }
+    counters->nextCam =
+        Simulator::Schedule (Seconds (counters->camInterval), &V2xCamTelemetry::SendCam, counters);
+  }
+
+  static bool
+  ReceiveCam (NodeCounters* counters, Ptr<NetDevice>, Ptr<const Packet> packet, uint16_t protocol,
+              const Address&)
+  {
+    if (protocol != kCamProtocol || packet->GetSize () < kCamHeaderSize)
+      {
+        return false;
+      }
+    uint8_t header[kCamHeaderSize];
+    packet->CopyData (header, kCamHeaderSize);
+    uint32_t sender;
+    int64_t sentNs;
+    std::memcpy (&sender, header, sizeof (uint32_t));
+    std::memcpy (&sentNs, header + sizeof (uint32_t), sizeof (int64_t));
+    if (!counters->active || sentNs < counters->resetNs
+        || !counters->range->IsInRange (sender, counters->index))
+      {
+        return true; // not expected, so not counted either
+      }
+    counters->received++;
+    counters->latencyNs += Simulator::Now ().GetNanoSeconds () - sentNs;
+    return true;
+  }
+
+  static void
+  PhyStateChanged (NodeCounters* counters, Time, Time duration, WifiPhyState state)
+  {
+    if (state == WifiPhyState::TX || state == WifiPhyState::RX || state == WifiPhyState::CCA_BUSY)
+      {
+        counters->busyNs += duration.GetNanoSeconds ();
+      }
+  }
+
+  NetDeviceContainer m_devices;
+  Ptr<UniformRandomVariable> m_jitter;
+  std::vector<NodeCounters> m_nodes;
+  std::vector<V2xLinkStats> m_stats;
+  const V2xConnectivityGraph* m_range = nullptr;
+};
+
+} // namespace ns3
+
+#endif /* V2X_CAM_TELEMETRY_H */
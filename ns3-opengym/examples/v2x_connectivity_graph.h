@@ -0,0 +1,436 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Uniform-grid spatial index and range connectivity graph for the V2X examples
+ *
+ * Vehicles are bucketed into square cells whose side is the communication
+ * range, so every neighbour of a vehicle lies in its own or one of the eight
+ * surrounding cells. Cells are found through an open-addressing table keyed by
+ * cell coordinates and the vehicles are counting-sorted by cell, which keeps
+ * a rebuild linear in the vehicle count. Links found through the grid are
+ * merged into a union-find forest, giving per-vehicle degree, the number of
+ * clusters and the largest connected component. Range queries against the
+ * last Update serve the CAM telemetry as well. All buffers are reused
+ * between steps, so a rebuild does not allocate once they have grown to the
+ * peak vehicle count.
+ */
+
+#ifndef V2X_CONNECTIVITY_GRAPH_H
+#define V2X_CONNECTIVITY_GRAPH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+
+class V2xConnectivityGraph
+{
+public:
+  /// Statistics that can be exported to the observation, in output order.
+  enum Stat : uint32_t
+  {
+    CLUSTER_COUNT = 1u << 0,     // connected components among active vehicles
+    LARGEST_COMPONENT = 1u << 1, // vehicles in the largest component
+    MEAN_DEGREE = 1u << 2,       // average neighbours within range
+    ISOLATED = 1u << 3,          // active vehicles without neighbours
+    DEGREE = 1u << 4             // neighbours within range, one value per vehicle node
+  };
+
+  /**
+   * Parse a comma separated list of clusters, largest, meanDegree, isolated
+   * and degree into a Stat mask. Returns false on an unknown name.
+   */
+  static bool
+  ParseStats (const std::string& list, uint32_t& mask)
+  {
+    mask = 0;
+    std::istringstream names (list);
+    std::string name;
+    while (std::getline (names, name, ','))
+      {
+        if (name.empty ())
+          {
+            continue;
+          }
+        if (name == "clusters")
+          {
+            mask |= CLUSTER_COUNT;
+          }
+        else if (name == "largest")
+          {
+            mask |= LARGEST_COMPONENT;
+          }
+        else if (name == "meanDegree")
+          {
+            mask |= MEAN_DEGREE;
+          }
+        else if (name == "isolated")
+          {
+            mask |= ISOLATED;
+          }
+        else if (name == "degree")
+          {
+            mask |= DEGREE;
+          }
+        else
+          {
+            return false;
+          }
+      }
+    return true;
+  }
+
+  void
+  Configure (double range, uint32_t statMask)
+  {
+    m_range = range > 0.0 ? range : 1.0;
+    m_statMask = statMask;
+  }
+
+  bool
+  IsEnabled () const
+  {
+    return m_statMask != 0;
+  }
+
+  /// Values FillObservation writes for a Stat mask and nodeCount vehicle nodes.
+  static uint32_t
+  GetObservationSize (uint32_t statMask, uint32_t nodeCount)
+  {
+    uint32_t size = 0;
+    for (uint32_t stat = CLUSTER_COUNT; stat < DEGREE; stat <<= 1)
+      {
+        size += (statMask & stat) ? 1 : 0;
+      }
+    return size + ((statMask & DEGREE) ? nodeCount : 0);
+  }
+
+  /**
+   * Rebuild the grid and the graph from per-node metrics exposing
+   * position.x, position.y and active. Inactive nodes take no part.
+   */
+  template <typename Metrics>
+  void
+  Update (const std::vector<Metrics>& metrics)
+  {
+    uint32_t nodeCount = static_cast<uint32_t> (metrics.size ());
+    m_degree.assign (nodeCount, 0);
+    m_parent.resize (nodeCount);
+    m_cellKey.resize (nodeCount);
+    m_nodeSlot.assign (nodeCount, kNoSlot);
+    m_x.resize (nodeCount);
+    m_y.resize (nodeCount);
+
+    // Bucket active vehicles into cells
+    uint32_t activeCount = 0;
+    for (const auto& vehicle : metrics)
+      {
+        activeCount += vehicle.active ? 1 : 0;
+      }
+    ResetTable (activeCount);
+    m_slotCount.clear ();
+    for (uint32_t node = 0; node < nodeCount; ++node)
+      {
+        m_parent[node] = node;
+        if (!metrics[node].active)
+          {
+            continue;
+          }
+        m_x[node] = metrics[node].position.x;
+        m_y[node] = metrics[node].position.y;
+        m_cellKey[node] = CellKey (CellCoord (m_x[node]), CellCoord (m_y[node]));
+        uint32_t slot = FindOrInsert (m_cellKey[node]);
+        if (slot == m_slotCount.size ())
+          {
+            m_slotCount.push_back (0);
+          }
+        m_slotCount[slot]++;
+        m_nodeSlot[node] = slot;
+      }
+
+    // Counting sort of the vehicles by cell slot
+    m_slotStart.assign (m_slotCount.size () + 1, 0);
+    for (uint32_t slot = 0; slot < m_slotCount.size (); ++slot)
+      {
+        m_slotStart[slot + 1] = m_slotStart[slot] + m_slotCount[slot];
+        m_slotCount[slot] = m_slotStart[slot];
+      }
+    m_slotNodes.resize (activeCount);
+    for (uint32_t node = 0; node < nodeCount; ++node)
+      {
+        if (m_nodeSlot[node] != kNoSlot)
+          {
+            m_slotNodes[m_slotCount[m_nodeSlot[node]]++] = node;
+          }
+      }
+
+    // Each link is found once, from its lower-index end, and merged into the forest
+    m_linkCount = 0;
+    for (uint32_t node = 0; node < nodeCount; ++node)
+      {
+        ForEachNeighbour (node, [this, node] (uint32_t other) {
+          if (other > node)
+            {
+              m_degree[node]++;
+              m_degree[other]++;
+              m_linkCount++;
+              Union (node, other);
+            }
+        });
+      }
+
+    // Component sizes by root
+    m_componentSize.assign (nodeCount, 0);
+    m_clusterCount = 0;
+    m_largestComponent = 0;
+    m_isolatedCount = 0;
+    m_activeCount = activeCount;
+    for (uint32_t node = 0; node < nodeCount; ++node)
+      {
+        if (m_nodeSlot[node] == kNoSlot)
+          {
+            continue;
+          }
+        uint32_t size = ++m_componentSize[Root (node)];
+        m_clusterCount += (size == 1) ? 1 : 0;
+        m_largestComponent = std::max (m_largestComponent, size);
+        m_isolatedCount += (m_degree[node] == 0) ? 1 : 0;
+      }
+  }
+
+  uint32_t
+  GetClusterCount () const
+  {
+    return m_clusterCount;
+  }
+
+  uint32_t
+  GetLargestComponent () const
+  {
+    return m_largestComponent;
+  }
+
+  uint64_t
+  GetLinkCount () const
+  {
+    return m_linkCount;
+  }
+
+  /// Neighbours within range of a vehicle node after the last Update.
+  uint32_t
+  GetDegree (uint32_t node) const
+  {
+    return node < m_degree.size () ? m_degree[node] : 0;
+  }
+
+  /// Whether both nodes were active and within range of each other at the last Update.
+  bool
+  IsInRange (uint32_t a, uint32_t b) const
+  {
+    if (a >= m_nodeSlot.size () || b >= m_nodeSlot.size () || m_nodeSlot[a] == kNoSlot
+        || m_nodeSlot[b] == kNoSlot)
+      {
+        return false;
+      }
+    double dx = m_x[a] - m_x[b];
+    double dy = m_y[a] - m_y[b];
+    return dx * dx + dy * dy <= m_range * m_range;
+  }
+
+  /// Call fn (other) for every node within range of node at the last Update; none when node was inactive.
+  template <typename Fn>
+  void
+  ForEachNeighbour (uint32_t node, Fn&& fn) const
+  {
+    if (node >= m_nodeSlot.size () || m_nodeSlot[node] == kNoSlot)
+      {
+        return;
+      }
+    double rangeSquared = m_range * m_range;
+    int32_t cx = CellX (m_cellKey[node]);
+    int32_t cy = CellY (m_cellKey[node]);
+    for (int32_t dx = -1; dx <= 1; ++dx)
+      {
+        for (int32_t dy = -1; dy <= 1; ++dy)
+          {
+            uint32_t slot = Find (CellKey (cx + dx, cy + dy));
+            if (slot == kNoSlot)
+              {
+                continue;
+              }
+            for (uint32_t k = m_slotStart[slot]; k < m_slotStart[slot + 1]; ++k)
+              {
+                uint32_t other = m_slotNodes[k];
+                double ox = m_x[other] - m_x[node];
+                double oy = m_y[other] - m_y[node];
+                if (other != node && ox * ox + oy * oy <= rangeSquared)
+                  {
+                    fn (other);
+                  }
+              }
+          }
+      }
+  }
+
+  /// Write the selected statistics, fleet values first, then the per-node degrees.
+  template <typename Value>
+  void
+  FillObservation (Value* out, uint32_t nodeCount) const
+  {
+    if (m_statMask & CLUSTER_COUNT)
+      {
+        *out++ = static_cast<Value> (m_clusterCount);
+      }
+    if (m_statMask & LARGEST_COMPONENT)
+      {
+        *out++ = static_cast<Value> (m_largestComponent);
+      }
+    if (m_statMask & MEAN_DEGREE)
+      {
+        *out++ = m_activeCount > 0 ? static_cast<Value> (2.0 * m_linkCount / m_activeCount) : Value (0);
+      }
+    if (m_statMask & ISOLATED)
+      {
+        *out++ = static_cast<Value> (m_isolatedCount);
+      }
+    if (m_statMask & DEGREE)
+      {
+        for (uint32_t node = 0; node < nodeCount; ++node)
+          {
+            *out++ = node < m_degree.size () ? static_cast<Value> (m_degree[node]) : Value (0);
+          }
+      }
+  }
+
+private:
+  static constexpr uint32_t kNoSlot = UINT32_MAX;
+
+  int32_t
+  CellCoord (double v) const
+  {
+    return static_cast<int32_t> (std::floor (v / m_range));
+  }
+
+  static uint64_t
+  CellKey (int32_t cx, int32_t cy)
+  {
+    return (uint64_t (uint32_t (cx)) << 32) | uint32_t (cy);
+  }
+
+  static int32_t
+  CellX (uint64_t key)
+  {
+    return static_cast<int32_t> (key >> 32);
+  }
+
+  static int32_t
+  CellY (uint64_t key)
+  {
+    return static_cast<int32_t> (key & 0xffffffffu);
+  }
+
+  /// Size the cell table for at most `cells` cells at no more than 50% load and clear it.
+  void
+  ResetTable (uint32_t cells)
+  {
+    uint32_t capacity = 16;
+    while (capacity < 2 * cells)
+      {
+        capacity <<= 1;
+      }
+    m_tableMask = capacity - 1;
+    m_tableKeys.resize (capacity);
+    m_tableSlots.assign (capacity, kNoSlot);
+  }
+
+  uint32_t
+  Hash (uint64_t key) const
+  {
+    return static_cast<uint32_t> ((key * 0x9E3779B97F4A7C15ull) >> 32) & m_tableMask;
+  }
+
+  uint32_t
+  Find (uint64_t key) const
+  {
+    for (uint32_t i = Hash (key);; i = (i + 1) & m_tableMask)
+      {
+        if (m_tableSlots[i] == kNoSlot || m_tableKeys[i] == key)
+          {
+            return m_tableSlots[i];
+          }
+      }
+  }
+
+  /// Slot of the cell, assigning the next free slot index to a new cell.
+  uint32_t
+  FindOrInsert (uint64_t key)
+  {
+    for (uint32_t i = Hash (key);; i = (i + 1) & m_tableMask)
+      {
+        if (m_tableSlots[i] == kNoSlot)
+          {
+            m_tableKeys[i] = key;
+            m_tableSlots[i] = static_cast<uint32_t> (m_slotCount.size ());
+            return m_tableSlots[i];
+          }
+        if (m_tableKeys[i] == key)
+          {
+            return m_tableSlots[i];
+          }
+      }
+  }
+
+  uint32_t
+  Root (uint32_t node)
+  {
+    while (m_parent[node] != node)
+      {
+        m_parent[node] = m_parent[m_parent[node]]; // path halving
+        node = m_parent[node];
+      }
+    return node;
+  }
+
+  void
+  Union (uint32_t a, uint32_t b)
+  {
+    a = Root (a);
+    b = Root (b);
+    if (a != b)
+      {
+        m_parent[std::max (a, b)] = std::min (a, b);
+      }
+  }
+
+  double m_range = 300.0;
+  uint32_t m_statMask = 0;
+
+  // Cell table and counting-sorted cell contents
+  uint32_t m_tableMask = 0;
+  std::vector<uint64_t> m_tableKeys;
+  std::vector<uint32_t> m_tableSlots;
+  std::vector<uint32_t> m_slotCount;
+  std::vector<uint32_t> m_slotStart;
+  std::vector<uint32_t> m_slotNodes;
+  std::vector<uint64_t> m_cellKey;  // per node
+  std::vector<uint32_t> m_nodeSlot; // per node, kNoSlot when inactive
+  std::vector<double> m_x;          // per node, position at the last Update
+  std::vector<double> m_y;
+
+  // Graph
+  std::vector<uint32_t> m_degree;
+  std::vector<uint32_t> m_parent;
+  std::vector<uint32_t> m_componentSize;
+  uint64_t m_linkCount = 0;
+  uint32_t m_activeCount = 0;
+  uint32_t m_clusterCount = 0;
+  uint32_t m_largestComponent = 0;
+  uint32_t m_isolatedCount = 0;
+};
+
+} // namespace ns3
+
+#endif /* V2X_CONNECTIVITY_GRAPH_H */
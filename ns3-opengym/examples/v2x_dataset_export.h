@@ -0,0 +1,364 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Headless dataset export for the V2X examples
+ *
+ * Streams per-step observations and rewards into NumPy .npy files whose
+ * leading dimension grows with the step count, plus the extra info as one
+ * text line per step and a JSON header with the layout and the vehicle ID
+ * mapping. Rows are buffered and written in chunks; after every chunk the
+ * .npy headers are patched with the current row count, so a partially
+ * written export is readable with numpy.load (path, mmap_mode='r').
+ */
+
+#ifndef V2X_DATASET_EXPORT_H
+#define V2X_DATASET_EXPORT_H
+
+#include "sumo_trajectory.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * Writer for a little-endian float32 .npy array of shape (rows, rowShape...)
+ * appended row by row. The header is reserved at a fixed size on open and
+ * rewritten in place with the row count on every flush.
+ */
+class V2xNpyWriter
+{
+public:
+  V2xNpyWriter () = default;
+  V2xNpyWriter (const V2xNpyWriter&) = delete;
+  V2xNpyWriter& operator= (const V2xNpyWriter&) = delete;
+
+  ~V2xNpyWriter ()
+  {
+    Close ();
+  }
+
+  bool
+  Open (const std::string& path, const std::vector<uint32_t>& rowShape)
+  {
+    Close ();
+    m_rowShape = rowShape;
+    m_rowFloats = 1;
+    for (uint32_t dim : rowShape)
+      {
+        m_rowFloats *= dim;
+      }
+    m_rows = 0;
+    m_file = std::fopen (path.c_str (), "wb");
+    if (m_file == nullptr)
+      {
+        return false;
+      }
+    // Size the header for the widest possible row count so patches never move the data
+    m_headerSize = 0;
+    m_headerSize = BuildHeader (UINT64_MAX).size ();
+    return WriteHeader ();
+  }
+
+  bool
+  IsOpen () const
+  {
+    return m_file != nullptr;
+  }
+
+  uint64_t
+  GetRowFloats () const
+  {
+    return m_rowFloats;
+  }
+
+  uint64_t
+  GetRows () const
+  {
+    return m_rows;
+  }
+
+  /// Append rows * GetRowFloats () floats. They reach the file on the next Flush.
+  bool
+  Append (const float* data, uint64_t rows)
+  {
+    if (m_file == nullptr)
+      {
+        return false;
+      }
+    uint64_t count = rows * m_rowFloats;
+    if (std::fwrite (data, sizeof (float), count, m_file) != count)
+      {
+        return false;
+      }
+    m_rows += rows;
+    return true;
+  }
+
+  /// Push buffered rows to the file and publish the row count in the header.
+  bool
+  Flush ()
+  {
+    if (m_file == nullptr)
+      {
+        return false;
+      }
+    bool ok = std::fflush (m_file) == 0 && std::fseek (m_file, 0, SEEK_SET) == 0 && WriteHeader ()
+              && std::fflush (m_file) == 0 && std::fseek (m_file, 0, SEEK_END) == 0;
+    return ok;
+  }
+
+  bool
+  Close ()
+  {
+    if (m_file == nullptr)
+      {
+        return true;
+      }
+    bool ok = Flush ();
+    ok = (std::fclose (m_file) == 0) && ok;
+    m_file = nullptr;
+    return ok;
+  }
+
+private:
+  /// Magic, version, header length and the dict padded with spaces to a multiple of 64 bytes.
+  std::string
+  BuildHeader (uint64_t rows) const
+  {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    std::string dict = "{'descr': '>f4', 'fortran_order': False, 'shape': (";
+#else
+    std::string dict = "{'descr': '<f4', 'fortran_order': False, 'shape': (";
+#endif
+    dict += std::to_string (rows);
+    dict += m_rowShape.empty () ? "," : "";
+    for (uint32_t dim : m_rowShape)
+      {
+        dict += ", " + std::to_string (dim);
+      }
+    dict += "), }";
+
+    std::size_t total = m_headerSize;
+    if (total == 0)
+      {
+        total = (10 + dict.size () + 1 + 63) / 64 * 64;
+      }
+    dict.append (total - 10 - dict.size () - 1, ' ');
+    dict += '\n';
+
+    std::string header ("\x93NUMPY\x01\x00", 8);
+    uint16_t dictSize = static_cast<uint16_t> (dict.size ());
+    header += static_cast<char> (dictSize & 0xff);
+    header += static_cast<char> (dictSize >> 8);
+    return header + dict;
+  }
+
+  bool
+  WriteHeader ()
+  {
+    std::string header = BuildHeader (m_rows);
+    return std::fwrite (header.data (), 1, header.size (), m_file) == header.size ();
+  }
+
+  std::FILE* m_file = nullptr;
+  std::vector<uint32_t> m_rowShape;
+  uint64_t m_rowFloats = 0;
+  uint64_t m_rows = 0;
+  std::size_t m_headerSize = 0;
+};
+
+/**
+ * Export of one run: <path> holds the observations, <path>.rewards.npy the
+ * per-environment rewards, <path>.info.txt the extra info lines and
+ * <path>.json the layout and the vehicle ID mapping.
+ */
+class V2xDatasetExporter
+{
+public:
+  struct Layout
+  {
+    std::vector<uint32_t> observationShape; // shape of one observation row
+    uint32_t numEnvs = 1;
+    uint32_t stepsPerExchange = 1;
+    double envStepTime = 0.1;
+    std::string source;
+    std::string observationLayout = "activeVehicles, avgSpeed, avgX, avgY, then x, y, speed per "
+                                    "vehicle node";
+    bool recycledSlots = false; // node i is a slot shared over time, see the slots: info entries
+    uint32_t startStep = 0;     // trace step of the first row, orders the files of a sharded run
+  };
+
+  bool
+  Open (const std::string& path, const Layout& layout, const SumoTrajectoryView& trajectory,
+        uint32_t chunkSteps)
+  {
+    m_path = path;
+    m_layout = layout;
+    m_trajectory = trajectory;
+    m_chunkSteps = std::max<uint32_t> (chunkSteps, 1);
+    m_pendingSteps = 0;
+
+    std::vector<uint32_t> rewardShape;
+    if (layout.numEnvs > 1)
+      {
+        rewardShape.push_back (layout.numEnvs);
+      }
+    m_info = std::fopen ((path + ".info.txt").c_str (), "wb");
+    return m_observations.Open (path, layout.observationShape)
+           && m_rewards.Open (path + ".rewards.npy", rewardShape) && m_info != nullptr
+           && WriteMetadata ();
+  }
+
+  bool
+  IsOpen () const
+  {
+    return m_observations.IsOpen ();
+  }
+
+  uint64_t
+  GetSteps () const
+  {
+    return m_observations.GetRows ();
+  }
+
+  /// Record one exchange: the observation payload, one reward per environment and the info line.
+  bool
+  AppendStep (const float* observation, const float* rewards, std::string_view info)
+  {
+    bool ok = m_observations.Append (observation, 1) && m_rewards.Append (rewards, 1)
+              && std::fwrite (info.data (), 1, info.size (), m_info) == info.size ()
+              && std::fputc ('\n', m_info) != EOF;
+    if (ok && ++m_pendingSteps >= m_chunkSteps)
+      {
+        ok = Flush ();
+      }
+    return ok;
+  }
+
+  bool
+  Flush ()
+  {
+    m_pendingSteps = 0;
+    return m_observations.Flush () && m_rewards.Flush () && std::fflush (m_info) == 0;
+  }
+
+  bool
+  Close ()
+  {
+    if (!IsOpen ())
+      {
+        return true;
+      }
+    bool ok = m_observations.Close ();
+    ok = m_rewards.Close () && ok;
+    ok = (std::fclose (m_info) == 0) && ok;
+    m_info = nullptr;
+    return WriteMetadata () && ok;
+  }
+
+private:
+  static void
+  AppendJsonString (std::string& out, std::string_view value)
+  {
+    out += '"';
+    for (char c : value)
+      {
+        if (c == '"' || c == '\\')
+          {
+            out += '\\';
+            out += c;
+          }
+        else if (static_cast<unsigned char> (c) < 0x20)
+          {
+            char escaped[8];
+            std::snprintf (escaped, sizeof (escaped), "\\u%04x", static_cast<unsigned> (c));
+            out += escaped;
+          }
+        else
+          {
+            out += c;
+          }
+      }
+    out += '"';
+  }
+
+  static void
+  AppendJsonShape (std::string& out, const std::vector<uint32_t>& shape)
+  {
+    out += '[';
+    for (std::size_t i = 0; i < shape.size (); ++i)
+      {
+        out += (i > 0 ? ", " : "") + std::to_string (shape[i]);
+      }
+    out += ']';
+  }
+
+  bool
+  WriteMetadata () const
+  {
+    std::string json = "{\n  \"format\": \"v2x-dataset\",\n  \"version\": 1,\n  \"source\": ";
+    AppendJsonString (json, m_layout.source);
+    json += ",\n  \"envStepTime\": " + std::to_string (m_layout.envStepTime);
+    json += ",\n  \"numEnvs\": " + std::to_string (m_layout.numEnvs);
+    json += ",\n  \"stepsPerExchange\": " + std::to_string (m_layout.stepsPerExchange);
+    json += ",\n  \"steps\": " + std::to_string (m_observations.GetRows ());
+    json += ",\n  \"startStep\": " + std::to_string (m_layout.startStep);
+    json += ",\n  \"observationShape\": ";
+    AppendJsonShape (json, m_layout.observationShape);
+    json += ",\n  \"observationLayout\": ";
+    AppendJsonString (json, m_layout.observationLayout);
+    json += ",\n  \"files\": {\"observations\": ";
+    AppendJsonString (json, BaseName (m_path));
+    json += ", \"rewards\": ";
+    AppendJsonString (json, BaseName (m_path + ".rewards.npy"));
+    json += ", \"info\": ";
+    AppendJsonString (json, BaseName (m_path + ".info.txt"));
+    json += "},\n  \"nodeIndex\": ";
+    AppendJsonString (json, m_layout.recycledSlots ? "slot" : "vehicle");
+    json += ",\n  \"vehicleIds\": [";
+    for (uint32_t node = 0; node < m_trajectory.vehicleCount; ++node)
+      {
+        json += (node > 0 ? ", " : "");
+        AppendJsonString (json, m_trajectory.GetVehicleId (node));
+      }
+    json += "],\n  \"vehicleTypes\": [";
+    for (uint32_t type = 0; type < m_trajectory.typeCount; ++type)
+      {
+        json += (type > 0 ? ", " : "");
+        AppendJsonString (json, m_trajectory.GetTypeName (type));
+      }
+    json += "]\n}\n";
+
+    std::FILE* file = std::fopen ((m_path + ".json").c_str (), "wb");
+    if (file == nullptr)
+      {
+        return false;
+      }
+    bool ok = std::fwrite (json.data (), 1, json.size (), file) == json.size ();
+    return (std::fclose (file) == 0) && ok;
+  }
+
+  static std::string
+  BaseName (const std::string& path)
+  {
+    std::size_t slash = path.find_last_of ('/');
+    return slash == std::string::npos ? path : path.substr (slash + 1);
+  }
+
+  std::string m_path;
+  Layout m_layout;
+  SumoTrajectoryView m_trajectory; // vehicle IDs by node index; empty for random-walk runs
+  V2xNpyWriter m_observations;
+  V2xNpyWriter m_rewards;
+  std::FILE* m_info = nullptr;
+  uint32_t m_chunkSteps = 1;
+  uint32_t m_pendingSteps = 0;
+};
+
+} // namespace ns3
+
+#endif /* V2X_DATASET_EXPORT_H */
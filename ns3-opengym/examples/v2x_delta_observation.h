@@ -0,0 +1,264 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Delta-encoded observation stream for the V2X OpenGym examples
+ *
+ * Consecutive observations differ in few values: parked and inactive
+ * vehicles stay bit-identical and the rest move a little per step. The
+ * encoder keeps the state the agent has reconstructed so far and sends a
+ * keyframe with every value at a fixed interval, in between only the values
+ * that changed. The payload is a uint32 Box, which protobuf packs as
+ * varints, so small integers cost one or two bytes on the wire.
+ *
+ * With a quantum (epsilon) every value is carried as the integer
+ * q = round (value / epsilon) and the agent reconstructs q * epsilon, so the
+ * error stays within epsilon / 2. A value is sent when its q changed, as the
+ * zigzag-coded difference to the previous q. Integer state on both sides
+ * keeps the reconstruction exact over any number of deltas. With epsilon 0
+ * values are sent as raw float bits whenever their bits change, and the
+ * stream reproduces the dense observation exactly.
+ *
+ * Payload, all uint32:
+ *
+ *   [format = 3, sequence, kind, size, count, epsilon as float bits]
+ *   kind 0 (keyframe): size values
+ *   kind 1 (delta): count index gaps (index - previous index - 1), then count values
+ *
+ * The sequence number grows by one per exchange; a gap tells the agent that
+ * its state is stale until the next keyframe.
+ */
+
+#ifndef V2X_DELTA_OBSERVATION_H
+#define V2X_DELTA_OBSERVATION_H
+
+#include "ns3/opengym-module.h"
+
+#include "v2x_observation.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * Reused uint32 Box container; the counterpart of V2xObservationContainer
+ * for the delta stream.
+ */
+class V2xDeltaObservationContainer : public OpenGymDataContainer
+{
+public:
+  static TypeId
+  GetTypeId ()
+  {
+    static TypeId tid = TypeId ("ns3::V2xDeltaObservationContainer")
+                            .SetParent<OpenGymDataContainer> ()
+                            .SetGroupName ("OpenGym")
+                            .AddConstructor<V2xDeltaObservationContainer> ();
+    return tid;
+  }
+
+  V2xDeltaObservationContainer ()
+  {
+    m_box.set_dtype (ns3opengym::UINT);
+    m_box.add_shape (0);
+  }
+
+  /// Resize the payload to size values and return it. Storage is kept between calls.
+  uint32_t*
+  Resize (uint32_t size)
+  {
+    m_box.set_shape (0, size);
+    m_box.mutable_uintdata ()->Resize (static_cast<int> (size), 0);
+    m_packed.Invalidate ();
+    return m_box.mutable_uintdata ()->mutable_data ();
+  }
+
+  /// Serialize the payload for the next GetDataContainerPbMsg, so the caller can account for it.
+  void
+  Pack ()
+  {
+    m_packed.Pack (m_box);
+  }
+
+  uint32_t
+  GetSize () const
+  {
+    return static_cast<uint32_t> (m_box.uintdata_size ());
+  }
+
+  ns3opengym::DataContainer
+  GetDataContainerPbMsg () override
+  {
+    return m_packed.Take (m_box);
+  }
+
+  void
+  Print (std::ostream& where) const override
+  {
+    where << "[";
+    for (int i = 0; i < m_box.uintdata_size (); ++i)
+      {
+        where << (i > 0 ? ", " : "") << m_box.uintdata (i);
+      }
+    where << "]";
+  }
+
+private:
+  ns3opengym::BoxDataContainer m_box;
+  V2xPackedBox m_packed;
+};
+
+class V2xDeltaEncoder
+{
+public:
+  static constexpr uint32_t kFormat = 3;
+  static constexpr uint32_t kHeaderSize = 6;
+
+  enum Kind : uint32_t
+  {
+    KEYFRAME = 0,
+    DELTA = 1
+  };
+
+  void
+  Configure (uint32_t keyframeInterval, float epsilon)
+  {
+    m_keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+    m_epsilon = epsilon > 0.0f ? epsilon : 0.0f;
+    m_state.clear ();
+  }
+
+  /// Payload values for a frame of size floats; a keyframe is the largest message.
+  static uint64_t
+  GetMaxSize (uint64_t size)
+  {
+    return kHeaderSize + size;
+  }
+
+  /// Send a keyframe with the next frame.
+  void
+  RequestKeyframe ()
+  {
+    m_state.clear ();
+  }
+
+  /// Encode the next frame into container and return the kind that was sent.
+  Kind
+  Encode (const float* frame, uint32_t size, V2xDeltaObservationContainer& container)
+  {
+    bool keyframe = m_state.size () != size || m_sinceKeyframe + 1 >= m_keyframeInterval;
+    if (!keyframe)
+      {
+        m_changed.clear ();
+        m_values.clear ();
+        for (uint32_t i = 0; i < size; ++i)
+          {
+            uint32_t value = ToState (frame[i]);
+            if (value != m_state[i])
+              {
+                m_changed.push_back (i);
+                m_values.push_back (m_epsilon > 0.0f ? ZigZag (int32_t (value) - int32_t (m_state[i]))
+                                                     : value);
+                m_state[i] = value;
+              }
+          }
+        // Gaps and values cost two entries each; past half the frame a keyframe is smaller
+        keyframe = 2 * m_changed.size () >= size;
+      }
+
+    uint32_t* out;
+    if (keyframe)
+      {
+        m_state.resize (size);
+        out = WriteHeader (container.Resize (kHeaderSize + size), KEYFRAME, size, size);
+        for (uint32_t i = 0; i < size; ++i)
+          {
+            m_state[i] = ToState (frame[i]);
+            out[i] = m_epsilon > 0.0f ? ZigZag (int32_t (m_state[i])) : m_state[i];
+          }
+        m_sinceKeyframe = 0;
+      }
+    else
+      {
+        uint32_t count = static_cast<uint32_t> (m_changed.size ());
+        out = WriteHeader (container.Resize (kHeaderSize + 2 * count), DELTA, size, count);
+        uint32_t previous = UINT32_MAX; // gaps count from index -1
+        for (uint32_t k = 0; k < count; ++k)
+          {
+            out[k] = m_changed[k] - previous - 1;
+            previous = m_changed[k];
+          }
+        std::copy (m_values.begin (), m_values.end (), out + count);
+        m_sinceKeyframe++;
+      }
+    m_sequence++;
+    m_lastCount = keyframe ? size : static_cast<uint32_t> (m_changed.size ());
+    return keyframe ? KEYFRAME : DELTA;
+  }
+
+  /// Sequence number the next frame will carry.
+  uint32_t
+  GetSequence () const
+  {
+    return m_sequence;
+  }
+
+  /// Values carried by the last frame.
+  uint32_t
+  GetLastCount () const
+  {
+    return m_lastCount;
+  }
+
+private:
+  /// Largest |q|, so that differences of two q still fit an int32.
+  static constexpr int32_t kMaxQuantized = (1 << 30) - 1;
+
+  static uint32_t
+  ZigZag (int32_t v)
+  {
+    return (uint32_t (v) << 1) ^ uint32_t (v >> 31);
+  }
+
+  /// q = round (v / epsilon) as int32 bits, or the float bits with epsilon 0.
+  uint32_t
+  ToState (float v) const
+  {
+    if (m_epsilon > 0.0f)
+      {
+        float q = std::nearbyint (v / m_epsilon);
+        q = std::isnan (q) ? 0.0f : std::fmax (-kMaxQuantized, std::fmin (kMaxQuantized, q));
+        return uint32_t (int32_t (q));
+      }
+    uint32_t bits;
+    std::memcpy (&bits, &v, sizeof (bits));
+    return bits;
+  }
+
+  uint32_t*
+  WriteHeader (uint32_t* out, Kind kind, uint32_t size, uint32_t count) const
+  {
+    out[0] = kFormat;
+    out[1] = m_sequence;
+    out[2] = kind;
+    out[3] = size;
+    out[4] = count;
+    std::memcpy (&out[5], &m_epsilon, sizeof (float));
+    return out + kHeaderSize;
+  }
+
+  uint32_t m_keyframeInterval = 50;
+  float m_epsilon = 0.0f;
+  uint32_t m_sequence = 0;
+  uint32_t m_sinceKeyframe = 0;
+  uint32_t m_lastCount = 0;
+  std::vector<uint32_t> m_state;   // per value, as reconstructed by the agent
+  std::vector<uint32_t> m_changed; // indices of the current delta
+  std::vector<uint32_t> m_values;  // encoded values of the current delta
+};
+
+} // namespace ns3
+
+#endif /* V2X_DELTA_OBSERVATION_H */
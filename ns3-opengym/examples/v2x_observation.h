@@ -0,0 +1,164 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Reusable float Box observation container for the V2X OpenGym examples
+ *
+ * OpenGymBoxContainer<float> grows a std::vector value by value and copies
+ * it into a fresh protobuf message on every step. This container keeps one
+ * BoxDataContainer message alive for the whole run and exposes its float
+ * payload as a plain array, so the observation is written in bulk straight
+ * into the protobuf storage and serialized from there. After the first step
+ * the fill needs no new memory.
+ *
+ * GetDataContainerPbMsg is the OpenGym hook and returns the message by
+ * value, so every exchange hands a newly allocated message over; a cached
+ * one would have to be copied out instead. Pack serializes the payload
+ * ahead of the hook, where the caller can count those allocations, and the
+ * hook moves the packed message out without copying it.
+ */
+
+#ifndef V2X_OBSERVATION_H
+#define V2X_OBSERVATION_H
+
+#include "ns3/opengym-module.h"
+
+#include <cstdint>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace ns3 {
+
+/**
+ * OpenGym message of a Box payload, packed ahead of the hook that hands it
+ * over. The payload's owner marks it stale when it is written.
+ */
+class V2xPackedBox
+{
+public:
+  void
+  Invalidate ()
+  {
+    m_stale = true;
+  }
+
+  /// Serialize box into a new message, allocating its Any, type URL and payload buffer.
+  void
+  Pack (const ns3opengym::BoxDataContainer& box)
+  {
+    m_message.set_type (ns3opengym::Box);
+    m_message.mutable_data ()->PackFrom (box);
+    m_stale = false;
+  }
+
+  /// Move the message of box out, packed first when box changed since the last Pack.
+  ns3opengym::DataContainer
+  Take (const ns3opengym::BoxDataContainer& box)
+  {
+    if (m_stale)
+      {
+        Pack (box);
+      }
+    m_stale = true; // the message leaves with its buffer
+    return std::move (m_message);
+  }
+
+private:
+  ns3opengym::DataContainer m_message;
+  bool m_stale = true;
+};
+
+class V2xObservationContainer : public OpenGymDataContainer
+{
+public:
+  static TypeId
+  GetTypeId ()
+  {
+    static TypeId tid = TypeId ("ns3::V2xObservationContainer")
+                            .SetParent<OpenGymDataContainer> ()
+                            .SetGroupName ("OpenGym")
+                            .AddConstructor<V2xObservationContainer> ();
+    return tid;
+  }
+
+  V2xObservationContainer ()
+  {
+    m_box.set_dtype (ns3opengym::FLOAT);
+  }
+
+  explicit V2xObservationContainer (const std::vector<uint32_t>& shape)
+    : V2xObservationContainer ()
+  {
+    SetShape (shape);
+  }
+
+  /// Set the Box shape. Storage only grows when the element count exceeds its capacity.
+  void
+  SetShape (const std::vector<uint32_t>& shape)
+  {
+    bool same = static_cast<std::size_t> (m_box.shape_size ()) == shape.size ();
+    for (std::size_t i = 0; same && i < shape.size (); ++i)
+      {
+        same = (m_box.shape (i) == shape[i]);
+      }
+    if (same)
+      {
+        return;
+      }
+
+    uint64_t size = shape.empty () ? 0 : 1;
+    m_box.clear_shape ();
+    for (uint32_t dim : shape)
+      {
+        m_box.add_shape (dim);
+        size *= dim;
+      }
+    m_box.mutable_floatdata ()->Resize (static_cast<int> (size), 0.0f);
+    m_packed.Invalidate ();
+  }
+
+  /// Writable payload of GetSize () floats, valid until the next SetShape.
+  float*
+  GetData ()
+  {
+    m_packed.Invalidate ();
+    return m_box.mutable_floatdata ()->mutable_data ();
+  }
+
+  /// Serialize the payload for the next GetDataContainerPbMsg, so the caller can account for it.
+  void
+  Pack ()
+  {
+    m_packed.Pack (m_box);
+  }
+
+  uint32_t
+  GetSize () const
+  {
+    return static_cast<uint32_t> (m_box.floatdata_size ());
+  }
+
+  ns3opengym::DataContainer
+  GetDataContainerPbMsg () override
+  {
+    return m_packed.Take (m_box);
+  }
+
+  void
+  Print (std::ostream& where) const override
+  {
+    where << "[";
+    for (int i = 0; i < m_box.floatdata_size (); ++i)
+      {
+        where << (i > 0 ? ", " : "") << m_box.floatdata (i);
+      }
+    where << "]";
+  }
+
+private:
+  ns3opengym::BoxDataContainer m_box;
+  V2xPackedBox m_packed;
+};
+
+} // namespace ns3
+
+#endif /* V2X_OBSERVATION_H */
@@ -0,0 +1,242 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Compile-time observation layouts for the V2X OpenGym examples
+ *
+ * A dense observation row holds four fleet aggregates (active vehicles,
+ * mean speed, mean x, mean y) and a block of kVehicleStride values
+ * (x, y, speed) per vehicle node. With CAM telemetry the delivery ratio,
+ * latency and busy ratio per node follow, and the selected connectivity
+ * graph stats come last. A sparse row keeps the fleet fields and lists one
+ * entry per active vehicle: node index, x, y, speed, then the CAM and
+ * degree values.
+ *
+ * V2xObservationLayout fixes the value type and the per-vehicle features as
+ * template parameters. V2xObservationBuilder<Layout> then compiles to loops
+ * with a constant stride and no per-vehicle branches on the enabled
+ * features. The simulations pick the instantiation for their command line
+ * once at startup through V2xObservationOps.
+ */
+
+#ifndef V2X_OBSERVATION_LAYOUT_H
+#define V2X_OBSERVATION_LAYOUT_H
+
+#include "v2x_cam_telemetry.h"
+#include "v2x_connectivity_graph.h"
+#include "v2x_sparse_observation.h"
+#include "v2x_trace_replay.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace ns3 {
+
+/// What a row is built from: the metrics of one node pool and its telemetry.
+struct V2xObservationSource
+{
+  const std::vector<VehicleMetrics>* metrics = nullptr;
+  uint32_t nodeCount = 0;                      // vehicle blocks per dense row
+  const V2xCamTelemetry* cam = nullptr;        // read when the layout has CAM stats
+  const V2xConnectivityGraph* graph = nullptr; // read when graphStats is not 0
+  uint32_t graphStats = 0;                     // V2xConnectivityGraph::Stat mask
+};
+
+template <typename Value, bool kCam, bool kDegree>
+struct V2xObservationLayout
+{
+  using ValueType = Value;
+  static constexpr uint32_t kFleetFields = 4;   // active, mean speed, mean x, mean y
+  static constexpr uint32_t kVehicleStride = 3; // x, y, speed per dense vehicle block
+  static constexpr bool kHasCam = kCam;
+  static constexpr bool kHasDegree = kDegree; // per-vehicle degree in sparse entries
+  static constexpr uint32_t kCamFields = kCam ? V2xCamTelemetry::kStatsPerVehicle : 0;
+  static constexpr uint32_t kEntryFields = 1 + kVehicleStride + kCamFields + (kDegree ? 1 : 0);
+  static constexpr float kBound = 10000.0f; // observation box bound, covers map coordinates in m
+};
+
+template <typename Layout>
+class V2xObservationBuilder
+{
+public:
+  using Value = typename Layout::ValueType;
+
+  /// Values of a dense row.
+  static uint32_t
+  GetSize (uint32_t nodeCount, uint32_t graphStats)
+  {
+    return Layout::kFleetFields + nodeCount * (Layout::kVehicleStride + Layout::kCamFields)
+           + V2xConnectivityGraph::GetObservationSize (graphStats, nodeCount);
+  }
+
+  /// Fleet fields of a sparse row: the aggregates, then the fleet-wide graph stats.
+  static uint32_t
+  GetSparseRowFields (uint32_t graphStats)
+  {
+    return Layout::kFleetFields
+           + V2xConnectivityGraph::GetObservationSize (graphStats & ~V2xConnectivityGraph::DEGREE, 0);
+  }
+
+  /// Write the GetSize () values of a dense row to obs.
+  static void
+  BuildDense (const V2xObservationSource& source, Value* obs)
+  {
+    const std::vector<VehicleMetrics>& metrics = *source.metrics;
+    FleetTotals fleet;
+
+    // Fill the per-vehicle block and the fleet aggregates in one pass
+    Value* vehicleObs = obs + Layout::kFleetFields;
+    uint32_t knownNodes = std::min<uint32_t> (source.nodeCount, metrics.size ());
+    for (uint32_t i = 0; i < knownNodes; ++i, vehicleObs += Layout::kVehicleStride)
+      {
+        const VehicleMetrics& vehicle = metrics[i];
+        if (vehicle.active)
+          {
+            fleet.Add (vehicle);
+            vehicleObs[0] = static_cast<Value> (vehicle.position.x);
+            vehicleObs[1] = static_cast<Value> (vehicle.position.y);
+            vehicleObs[2] = static_cast<Value> (vehicle.speed);
+          }
+        else
+          {
+            std::fill_n (vehicleObs, Layout::kVehicleStride, Value (0));
+          }
+      }
+    Value* extra = obs + Layout::kFleetFields + source.nodeCount * Layout::kVehicleStride;
+    std::fill (vehicleObs, extra, Value (0));
+    if constexpr (Layout::kHasCam)
+      {
+        source.cam->FillObservation (extra, source.nodeCount);
+        extra += source.nodeCount * Layout::kCamFields;
+      }
+    if (source.graphStats != 0)
+      {
+        source.graph->FillObservation (extra, source.nodeCount);
+      }
+    fleet.Write (obs);
+  }
+
+  /**
+   * Stage a sparse row: the same values as BuildDense with an entry for
+   * active vehicles only. The sparse payload is float whatever the layout's
+   * value type. Returns the fleet fields of the row.
+   */
+  static const float*
+  BuildSparseRow (const V2xObservationSource& source, V2xSparseObservation& sparse, uint32_t row)
+  {
+    const std::vector<VehicleMetrics>& metrics = *source.metrics;
+    float* fleetFields = sparse.BeginRow (row);
+    FleetTotals fleet;
+
+    uint32_t knownNodes = std::min<uint32_t> (source.nodeCount, metrics.size ());
+    for (uint32_t i = 0; i < knownNodes; ++i)
+      {
+        const VehicleMetrics& vehicle = metrics[i];
+        if (!vehicle.active)
+          {
+            continue;
+          }
+        fleet.Add (vehicle);
+
+        float* entry = sparse.AddEntry ();
+        entry[0] = static_cast<float> (i);
+        entry[1] = static_cast<float> (vehicle.position.x);
+        entry[2] = static_cast<float> (vehicle.position.y);
+        entry[3] = static_cast<float> (vehicle.speed);
+        if constexpr (Layout::kHasCam)
+          {
+            const V2xLinkStats& stats = source.cam->GetStats (i);
+            entry[4] = stats.deliveryRatio;
+            entry[5] = stats.latencyMs;
+            entry[6] = stats.busyRatio;
+          }
+        if constexpr (Layout::kHasDegree)
+          {
+            entry[Layout::kEntryFields - 1] = static_cast<float> (source.graph->GetDegree (i));
+          }
+      }
+
+    fleet.Write (fleetFields);
+    if (source.graphStats != 0)
+      {
+        // Fleet stats only, no per-node degrees
+        source.graph->FillObservation (fleetFields + Layout::kFleetFields, 0);
+      }
+    return fleetFields;
+  }
+
+private:
+  struct FleetTotals
+  {
+    uint32_t active = 0;
+    double speed = 0.0;
+    double x = 0.0;
+    double y = 0.0;
+
+    void
+    Add (const VehicleMetrics& vehicle)
+    {
+      active++;
+      speed += vehicle.speed;
+      x += vehicle.position.x;
+      y += vehicle.position.y;
+    }
+
+    template <typename Out>
+    void
+    Write (Out* out) const
+    {
+      out[0] = static_cast<Out> (active);
+      out[1] = static_cast<Out> (active > 0 ? speed / active : 0.0);
+      out[2] = static_cast<Out> (active > 0 ? x / active : 0.0);
+      out[3] = static_cast<Out> (active > 0 ? y / active : 0.0);
+    }
+  };
+};
+
+/**
+ * Entry points of the float layout selected at run time. Each call goes to
+ * a builder specialized for the enabled features.
+ */
+struct V2xObservationOps
+{
+  uint32_t (*getSize) (uint32_t nodeCount, uint32_t graphStats) = nullptr;
+  uint32_t (*getSparseRowFields) (uint32_t graphStats) = nullptr;
+  void (*buildDense) (const V2xObservationSource& source, float* obs) = nullptr;
+  const float* (*buildSparseRow) (const V2xObservationSource& source, V2xSparseObservation& sparse,
+                                  uint32_t row) = nullptr;
+  uint32_t entryFields = 0;
+  float bound = 0.0f; // observation space is [-bound, bound]
+
+  template <typename Layout>
+  static V2xObservationOps
+  Make ()
+  {
+    using Builder = V2xObservationBuilder<Layout>;
+    V2xObservationOps ops;
+    ops.getSize = &Builder::GetSize;
+    ops.getSparseRowFields = &Builder::GetSparseRowFields;
+    ops.buildDense = &Builder::BuildDense;
+    ops.buildSparseRow = &Builder::BuildSparseRow;
+    ops.entryFields = Layout::kEntryFields;
+    ops.bound = Layout::kBound;
+    return ops;
+  }
+
+  /// Builder for CAM stats on or off and the per-vehicle degree in the graph stat mask.
+  static V2xObservationOps
+  Select (bool cam, uint32_t graphStats)
+  {
+    bool degree = (graphStats & V2xConnectivityGraph::DEGREE) != 0;
+    if (cam)
+      {
+        return degree ? Make<V2xObservationLayout<float, true, true>> ()
+                      : Make<V2xObservationLayout<float, true, false>> ();
+      }
+    return degree ? Make<V2xObservationLayout<float, false, true>> ()
+                  : Make<V2xObservationLayout<float, false, false>> ();
+  }
+};
+
+} // namespace ns3
+
+#endif /* V2X_OBSERVATION_LAYOUT_H */
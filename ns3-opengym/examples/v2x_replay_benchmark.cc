@@ -0,0 +1,484 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Microbenchmark of the V2X trace-replay and observation hot paths
+ *
+ * Drives trace loading, SUMO mobility replay, the vehicle metrics update and
+ * the observation build of the V2X examples directly, without an OpenGym
+ * connection, over the given FCD traces and synthetic traces with a given
+ * number of vehicles. Every measurement is written to stdout as one JSON
+ * object per line, so runs of two versions can be compared by a script:
+ *
+ *   {"trace": ..., "vehicles": ..., "bench": ..., "steps": ..., "ns_per_step": ...,
+ *    "alloc_bytes_per_step": ..., "allocs_per_step": ..., "mb_per_s": ...,
+ *    "wire_bytes_per_step": ...}
+ *
+ * Only the benchmarked section of each step is timed; the mobility replay
+ * that feeds the observation benchmarks runs outside the clock.
+ */
+
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+#include "ns3/opengym-module.h"
+
+#include "sumo_trace_loader.h"
+#include "sumo_trajectory.h"
+#include "v2x_allocation_counter.h"
+#include "v2x_delta_observation.h"
+#include "v2x_observation.h"
+#include "v2x_observation_layout.h"
+#include "v2x_sparse_observation.h"
+#include "v2x_trace_replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace ns3;
+
+NS_LOG_COMPONENT_DEFINE ("V2xReplayBenchmark");
+
+namespace {
+
+/// The observation the examples build without CAM telemetry and graph stats.
+using BenchLayout = V2xObservationLayout<float, false, false>;
+using BenchBuilder = V2xObservationBuilder<BenchLayout>;
+
+struct BenchResult
+{
+  std::string trace;
+  uint32_t vehicles = 0;
+  std::string bench;
+  uint64_t steps = 0;
+  double nsPerStep = 0.0;
+  double allocBytesPerStep = 0.0;
+  double allocsPerStep = 0.0;
+  double mbPerSecond = 0.0;
+  double wireBytesPerStep = 0.0;
+};
+
+/// Time, allocations and allocated bytes summed over the timed sections of a run.
+struct BenchCounter
+{
+  uint64_t ns = 0;
+  uint64_t allocs = 0;
+  uint64_t bytes = 0;
+
+  template <typename Fn>
+  void
+  Time (Fn&& fn)
+  {
+    uint64_t allocMark = GetAllocationCount ();
+    uint64_t byteMark = GetAllocatedBytes ();
+    auto start = std::chrono::steady_clock::now ();
+    fn ();
+    auto end = std::chrono::steady_clock::now ();
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds> (end - start).count ();
+    allocs += GetAllocationCount () - allocMark;
+    bytes += GetAllocatedBytes () - byteMark;
+  }
+
+  void
+  Fill (BenchResult& result, uint64_t steps) const
+  {
+    result.steps = steps;
+    double n = steps > 0 ? static_cast<double> (steps) : 1.0;
+    result.nsPerStep = ns / n;
+    result.allocsPerStep = allocs / n;
+    result.allocBytesPerStep = bytes / n;
+  }
+};
+
+std::string
+EscapeJson (const std::string& text)
+{
+  std::string escaped;
+  for (char c : text)
+    {
+      if (c == '"' || c == '\\')
+        {
+          escaped += '\\';
+        }
+      escaped += c;
+    }
+  return escaped;
+}
+
+void
+WriteResult (std::ostream& out, const BenchResult& result)
+{
+  char numbers[256];
+  std::snprintf (numbers, sizeof (numbers),
+                 "\"ns_per_step\": %.1f, \"alloc_bytes_per_step\": %.1f, \"allocs_per_step\": %.3f, "
+                 "\"mb_per_s\": %.2f, \"wire_bytes_per_step\": %.1f",
+                 result.nsPerStep, result.allocBytesPerStep, result.allocsPerStep, result.mbPerSecond,
+                 result.wireBytesPerStep);
+  out << "{\"trace\": \"" << EscapeJson (result.trace) << "\", \"vehicles\": " << result.vehicles
+      << ", \"bench\": \"" << result.bench << "\", \"steps\": " << result.steps << ", " << numbers
+      << "}" << std::endl;
+}
+
+std::vector<std::string>
+SplitList (const std::string& list)
+{
+  std::vector<std::string> items;
+  std::stringstream stream (list);
+  std::string item;
+  while (std::getline (stream, item, ','))
+    {
+      if (!item.empty ())
+        {
+          items.push_back (item);
+        }
+    }
+  return items;
+}
+
+/**
+ * Write a synthetic FCD trace: `vehicles` vehicles on parallel lanes of 50,
+ * all present for `steps` timesteps, each at its own constant speed.
+ */
+bool
+GenerateTrace (const std::string& path, uint32_t vehicles, uint32_t steps, double envStepTime)
+{
+  std::FILE* file = std::fopen (path.c_str (), "w");
+  if (file == nullptr)
+    {
+      return false;
+    }
+  std::fprintf (file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<fcd-export>\n");
+  for (uint32_t step = 0; step < steps; ++step)
+    {
+      double time = step * envStepTime;
+      std::fprintf (file, "    <timestep time=\"%.2f\">\n", time);
+      for (uint32_t v = 0; v < vehicles; ++v)
+        {
+          uint32_t lane = v / 50;
+          double speed = 10.0 + (v % 7) * 4.0;
+          double x = (v % 50) * 20.0 + speed * time;
+          double y = lane * 3.2;
+          std::fprintf (file,
+                        "        <vehicle id=\"veh%u\" x=\"%.2f\" y=\"%.2f\" angle=\"90.00\" "
+                        "type=\"DEFAULT_VEHTYPE\" speed=\"%.2f\" pos=\"%.2f\" lane=\"e0_%u\" "
+                        "slope=\"0.00\"/>\n",
+                        v, x, y, speed, x, lane);
+        }
+      std::fprintf (file, "    </timestep>\n");
+    }
+  std::fprintf (file, "</fcd-export>\n");
+  return std::fclose (file) == 0;
+}
+
+class ReplayBenchmark
+{
+public:
+  ReplayBenchmark (double envStepTime, uint32_t parseThreads, uint32_t steps, uint32_t repeat)
+    : m_envStepTime (envStepTime),
+      m_parseThreads (parseThreads),
+      m_steps (std::max<uint32_t> (steps, 1)),
+      m_repeat (std::max<uint32_t> (repeat, 1))
+  {
+    m_replay.Configure (envStepTime, parseThreads, true);
+  }
+
+  /// Run every benchmark over one trace; false when it cannot be loaded.
+  bool
+  Run (const std::string& path, std::ostream& out)
+  {
+    if (!BenchLoad (path, out))
+      {
+        return false;
+      }
+    SetUpNodes ();
+    BenchMobility (out);
+    BenchMetrics (out);
+    BenchObservation (out, V2xSparseObservation::DENSE, "observation_dense");
+    BenchObservation (out, V2xSparseObservation::LIST, "observation_list");
+    BenchObservation (out, V2xSparseObservation::DELTA, "observation_delta");
+    return true;
+  }
+
+private:
+  BenchResult
+  MakeResult (const std::string& bench) const
+  {
+    BenchResult result;
+    result.trace = m_trace;
+    result.vehicles = m_replay.GetVehicleCount ();
+    result.bench = bench;
+    return result;
+  }
+
+  /// Fastest of m_repeat loads; throughput counts the file bytes read by the parser.
+  bool
+  BenchLoad (const std::string& path, std::ostream& out)
+  {
+    m_trace = std::filesystem::path (path).filename ().string ();
+    BenchResult best;
+    SumoTrajectoryData data;
+    for (uint32_t run = 0; run < m_repeat; ++run)
+      {
+        data = SumoTrajectoryData ();
+        SumoTraceLoader loader;
+        BenchCounter counter;
+        bool loaded = false;
+        counter.Time ([&] () { loaded = loader.Load (path, m_envStepTime, m_parseThreads, data); });
+        if (!loaded)
+          {
+            NS_LOG_UNCOND ("[Bench] Failed to load " << path);
+            return false;
+          }
+        m_replay.Adopt (std::move (data));
+        BenchResult result = MakeResult ("load");
+        counter.Fill (result, m_replay.GetView ().timestepCount);
+        result.mbPerSecond = loader.GetStats ().bytes / (1024.0 * 1024.0) / (counter.ns * 1e-9);
+        if (run == 0 || result.nsPerStep < best.nsPerStep)
+          {
+            best = result;
+          }
+      }
+    WriteResult (out, best);
+    return !m_replay.IsEmpty ();
+  }
+
+  void
+  SetUpNodes ()
+  {
+    m_nodes = NodeContainer ();
+    m_nodes.Create (m_replay.GetVehicleCount ());
+    m_replay.BuildNodeTracks (m_replay.GetVehicleCount ());
+    m_timeline = m_replay.InstallMobility (m_nodes, 0, true);
+    ResetVehicleMetrics (m_metrics, m_replay.GetVehicleCount ());
+  }
+
+  /// ApplySumoMobility: trace slice into the metrics; node positions are read on demand.
+  void
+  ApplyStep (uint32_t step)
+  {
+    ResetVehicleMetrics (m_metrics, m_replay.GetVehicleCount ());
+    V2xReplayTarget target (m_nodes, m_metrics, m_replay.GetVehicleCount ());
+    m_replay.ForEachSample (step, true, target);
+  }
+
+  void
+  BenchMobility (std::ostream& out)
+  {
+    ApplyStep (0); // warm-up
+    BenchCounter counter;
+    for (uint32_t step = 0; step < m_steps; ++step)
+      {
+        counter.Time ([&] () { ApplyStep (step); });
+      }
+    BenchResult result = MakeResult ("mobility");
+    counter.Fill (result, m_steps);
+    WriteResult (out, result);
+  }
+
+  /**
+   * UpdateVehicleMetrics: every node's mobility model into metrics, as on the
+   * random-walk path. The trace models are read halfway into each step, so
+   * every position is interpolated, as a PHY reading them between steps
+   * would see.
+   */
+  void
+  BenchMetrics (std::ostream& out)
+  {
+    BenchCounter counter;
+    for (uint32_t step = 0; step < m_steps; ++step)
+      {
+        ApplyStep (step);
+        m_timeline->SetStart (step, Simulator::Now () - Seconds (m_envStepTime / 2));
+        counter.Time ([&] () { UpdateMetricsFromMobility (m_nodes, m_metrics); });
+      }
+    BenchResult result = MakeResult ("metrics");
+    counter.Fill (result, m_steps);
+    WriteResult (out, result);
+  }
+
+  V2xObservationSource
+  GetObservationSource () const
+  {
+    V2xObservationSource source;
+    source.metrics = &m_metrics;
+    source.nodeCount = m_replay.GetVehicleCount ();
+    return source;
+  }
+
+  void
+  BuildList (V2xObservationContainer& container)
+  {
+    m_sparse.Reset (1);
+    BenchBuilder::BuildSparseRow (GetObservationSource (), m_sparse, 0);
+    container.SetShape ({static_cast<uint32_t> (m_sparse.GetEncodedSize ())});
+    m_sparse.Encode (container.GetData ());
+  }
+
+  /// Observation build plus protobuf serialization of the payload, as sent to the agent.
+  void
+  BenchObservation (std::ostream& out, V2xSparseObservation::Encoding encoding,
+                    const std::string& bench)
+  {
+    uint32_t obsSize = BenchBuilder::GetSize (m_replay.GetVehicleCount (), 0);
+    Ptr<V2xObservationContainer> dense = CreateObject<V2xObservationContainer> (
+        encoding == V2xSparseObservation::LIST ? std::vector<uint32_t> {0}
+                                               : std::vector<uint32_t> {obsSize});
+    Ptr<V2xDeltaObservationContainer> delta = CreateObject<V2xDeltaObservationContainer> ();
+    m_sparse.Configure (encoding, BenchBuilder::GetSparseRowFields (0), BenchLayout::kEntryFields);
+    m_delta.Configure (50, 0.0f);
+
+    BenchCounter counter;
+    uint64_t wireBytes = 0;
+    for (uint32_t step = 0; step < m_steps; ++step)
+      {
+        ApplyStep (step);
+        counter.Time ([&] () {
+          Ptr<OpenGymDataContainer> container = dense;
+          if (encoding == V2xSparseObservation::LIST)
+            {
+              BuildList (*dense);
+            }
+          else
+            {
+              BenchBuilder::BuildDense (GetObservationSource (), dense->GetData ());
+              if (encoding == V2xSparseObservation::DELTA)
+                {
+                  m_delta.Encode (dense->GetData (), obsSize, *delta);
+                  container = delta;
+                }
+            }
+          container->GetDataContainerPbMsg ().SerializeToString (&m_wire);
+        });
+        wireBytes += m_wire.size ();
+      }
+    BenchResult result = MakeResult (bench);
+    counter.Fill (result, m_steps);
+    result.wireBytesPerStep = static_cast<double> (wireBytes) / m_steps;
+    WriteResult (out, result);
+  }
+
+  double m_envStepTime;
+  uint32_t m_parseThreads;
+  uint32_t m_steps;
+  uint32_t m_repeat;
+  std::string m_trace;
+  V2xTraceReplay m_replay;
+  NodeContainer m_nodes;
+  Ptr<SumoReplayTimeline> m_timeline;
+  std::vector<VehicleMetrics> m_metrics;
+  V2xSparseObservation m_sparse;
+  V2xDeltaEncoder m_delta;
+  std::string m_wire;
+};
+
+} // namespace
+
+int
+main (int argc, char* argv[])
+{
+  std::string traces = "";
+  std::string traceDir = "";
+  std::string vehicles = "10,100,1000,10000,100000";
+  uint32_t generatedSteps = 200;
+  uint64_t maxGeneratedSamples = 2000000;
+  std::string workDir = "/tmp";
+  bool keepTraces = false;
+  double envStepTime = 0.1;
+  uint32_t steps = 1000;
+  uint32_t repeat = 3;
+  uint32_t parseThreads = 0;
+  std::string outputPath = "";
+
+  CommandLine cmd;
+  cmd.AddValue ("traces", "Comma separated FCD traces to benchmark", traces);
+  cmd.AddValue ("traceDir", "Benchmark every .xml trace in this directory (e.g. sumo-traces)",
+                traceDir);
+  cmd.AddValue ("vehicles", "Comma separated vehicle counts of generated traces (empty = none)",
+                vehicles);
+  cmd.AddValue ("generatedSteps", "Timesteps of a generated trace", generatedSteps);
+  cmd.AddValue ("maxGeneratedSamples",
+                "Cap on vehicles x timesteps of a generated trace; large fleets get fewer steps",
+                maxGeneratedSamples);
+  cmd.AddValue ("workDir", "Directory for the generated traces", workDir);
+  cmd.AddValue ("keepTraces", "Keep the generated traces after the run", keepTraces);
+  cmd.AddValue ("envStep", "Environment step time in seconds", envStepTime);
+  cmd.AddValue ("steps", "Replay steps per benchmark; the trace is looped", steps);
+  cmd.AddValue ("repeat", "Loads per trace, the fastest is reported", repeat);
+  cmd.AddValue ("parseThreads", "Trace parser threads (0 = one per core, 1 = serial)",
+                parseThreads);
+  cmd.AddValue ("output", "Append the JSON lines to this file instead of stdout", outputPath);
+  cmd.Parse (argc, argv);
+
+  std::vector<std::string> paths = SplitList (traces);
+  if (!traceDir.empty ())
+    {
+      std::vector<std::string> found;
+      std::error_code error;
+      for (const auto& entry : std::filesystem::directory_iterator (traceDir, error))
+        {
+          if (entry.path ().extension () == ".xml")
+            {
+              found.push_back (entry.path ().string ());
+            }
+        }
+      if (error)
+        {
+          NS_LOG_UNCOND ("[Bench] Cannot read " << traceDir << ": " << error.message ());
+          return 1;
+        }
+      std::sort (found.begin (), found.end ());
+      paths.insert (paths.end (), found.begin (), found.end ());
+    }
+
+  std::vector<std::string> generated;
+  for (const std::string& count : SplitList (vehicles))
+    {
+      uint32_t n = static_cast<uint32_t> (std::stoul (count));
+      uint32_t traceSteps = static_cast<uint32_t> (
+          std::max<uint64_t> (2, std::min<uint64_t> (generatedSteps, maxGeneratedSamples / std::max (n, 1u))));
+      std::string path = workDir + "/v2x_bench_" + std::to_string (n) + ".xml";
+      NS_LOG_UNCOND ("[Bench] Generating " << path << " (" << n << " vehicles, " << traceSteps
+                                           << " steps)");
+      if (!GenerateTrace (path, n, traceSteps, envStepTime))
+        {
+          NS_LOG_UNCOND ("[Bench] Failed to write " << path);
+          return 1;
+        }
+      generated.push_back (path);
+      paths.push_back (path);
+    }
+
+  std::ofstream file;
+  if (!outputPath.empty ())
+    {
+      file.open (outputPath, std::ios::app);
+      if (!file)
+        {
+          NS_LOG_UNCOND ("[Bench] Cannot open " << outputPath);
+          return 1;
+        }
+    }
+  std::ostream& out = outputPath.empty () ? std::cout : file;
+
+  ReplayBenchmark benchmark (envStepTime, parseThreads, steps, repeat);
+  bool ok = true;
+  for (const std::string& path : paths)
+    {
+      NS_LOG_UNCOND ("[Bench] " << path);
+      ok = benchmark.Run (path, out) && ok;
+    }
+
+  if (!keepTraces)
+    {
+      for (const std::string& path : generated)
+        {
+          std::remove (path.c_str ());
+        }
+    }
+  Simulator::Destroy ();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,488 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Shared-memory observation ring for the V2X OpenGym examples
+ *
+ * The OpenGym exchange serializes the observation into a protobuf message,
+ * copies it through ZMQ and deserializes it again in Python. For a large
+ * fleet this costs more than the step itself. V2xShmRing instead keeps a
+ * ring of fixed-size observation slots in /dev/shm. The simulation builds
+ * each observation directly in the next slot, and the OpenGym exchange
+ * carries only a descriptor of it (sequence, slot, size, step) with the
+ * reward, game over flag, extra info and action. The agent maps the same
+ * file and wraps the slot in a numpy array without copying it.
+ *
+ * File layout, little-endian:
+ *
+ *   header (64 bytes): magic 'V2XS', version, headerBytes, slotCount,
+ *                      slotBytes, capacity, encoding, rank, shape[4],
+ *                      published (offset 48), consumed, consumerStallNs
+ *   slotCount slots of slotBytes each: sequence, size, step (uint64),
+ *                      reward, flags, stallNs (uint64), then `capacity`
+ *                      float32 payload values
+ *
+ * A slot is rewritten slotCount exchanges after it was published, so a
+ * view of it stays valid for slotCount - 1 further exchanges. `published`
+ * counts the published observations and is a futex word woken on every
+ * publish, so a reader outside the OpenGym exchange can sleep on it.
+ *
+ * With --asyncLag the simulation stops waiting for a reply on every step.
+ * The agent then counts the observations it is done with in `consumed`
+ * (offset 52, also a futex word) and adds the time it waited for new ones
+ * to `consumerStallNs` (offset 56). The producer never runs more than the
+ * lag ahead of `consumed`, and records its own accumulated wait in the
+ * stallNs field of each slot. Actions flow back through a second ring of
+ * the same layout, `<name>.actions`, written by the agent: one
+ * [replicas, 4] float action per slot, whose step field is the sequence
+ * number of the observation it targets. V2xShmActionReader drains it on
+ * the simulation side.
+ */
+
+#ifndef V2X_SHM_TRANSPORT_H
+#define V2X_SHM_TRANSPORT_H
+
+#include "ns3/core-module.h"
+#include "ns3/opengym-module.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <new>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace ns3 {
+
+class V2xShmRing
+{
+public:
+  static constexpr uint32_t kMagic = 0x53583256; // "V2XS"
+  static constexpr uint32_t kVersion = 1;
+  static constexpr uint32_t kMaxRank = 4;
+
+  enum Flags : uint32_t
+  {
+    GAME_OVER = 1,   // last observation of the run
+    EPISODE_END = 2, // final state of an episode, see --episodes
+  };
+
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerBytes; // offset of slot 0
+    uint32_t slotCount;
+    uint32_t slotBytes; // stride between slots
+    uint32_t capacity;  // payload floats per slot
+    uint32_t encoding;  // V2xSparseObservation::Encoding of the payload
+    uint32_t rank;      // dimensions of a dense payload
+    uint32_t shape[kMaxRank];
+    std::atomic<uint32_t> published;       // futex word, advanced by the producer
+    std::atomic<uint32_t> consumed;        // futex word, advanced by the consumer (async only)
+    std::atomic<uint64_t> consumerStallNs; // consumer wait for new slots (async only)
+  };
+
+  struct Slot
+  {
+    uint32_t sequence; // value of `published` once this slot was written
+    uint32_t size;     // payload floats
+    uint64_t step;     // env step of the observation
+    float reward;
+    uint32_t flags;
+    uint64_t stallNs; // producer wait for free slots so far (async only)
+  };
+
+  static_assert (sizeof (Header) == 64, "the header layout is read by the agent");
+  static_assert (sizeof (Slot) == 32, "the slot layout is read by the agent");
+  static_assert (std::atomic<uint32_t>::is_always_lock_free && sizeof (std::atomic<uint32_t>) == 4,
+                 "futex words must be plain 32-bit integers");
+  static_assert (std::atomic<uint64_t>::is_always_lock_free && sizeof (std::atomic<uint64_t>) == 8,
+                 "the consumer stall is written by the agent as a plain 64-bit integer");
+
+  V2xShmRing () = default;
+  V2xShmRing (const V2xShmRing&) = delete;
+  V2xShmRing& operator= (const V2xShmRing&) = delete;
+
+  ~V2xShmRing ()
+  {
+    Close ();
+  }
+
+  /**
+   * Create /dev/shm/<name> with slotCount slots of capacity floats. shape
+   * is the dense payload shape, recorded for the agent; sparse payloads
+   * describe themselves.
+   */
+  bool
+  Open (const std::string& name, uint32_t slotCount, uint32_t capacity, uint32_t encoding,
+        const std::vector<uint32_t>& shape)
+  {
+    Close ();
+    if (slotCount == 0 || shape.size () > kMaxRank)
+      {
+        return false;
+      }
+    m_path = "/dev/shm/" + name;
+    uint64_t slotBytes = (sizeof (Slot) + uint64_t (capacity) * sizeof (float) + 63) / 64 * 64;
+    m_size = sizeof (Header) + slotBytes * slotCount;
+
+    int fd = ::open (m_path.c_str (), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+      {
+        return false;
+      }
+    bool sized = ::ftruncate (fd, static_cast<off_t> (m_size)) == 0;
+    void* base = sized ? ::mmap (nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close (fd);
+    if (base == MAP_FAILED)
+      {
+        ::unlink (m_path.c_str ());
+        return false;
+      }
+
+    m_base = static_cast<uint8_t*> (base);
+    m_header = new (m_base) Header ();
+    m_header->magic = kMagic;
+    m_header->version = kVersion;
+    m_header->headerBytes = sizeof (Header);
+    m_header->slotCount = slotCount;
+    m_header->slotBytes = static_cast<uint32_t> (slotBytes);
+    m_header->capacity = capacity;
+    m_header->encoding = encoding;
+    m_header->rank = static_cast<uint32_t> (shape.size ());
+    for (uint32_t i = 0; i < kMaxRank; ++i)
+      {
+        m_header->shape[i] = i < shape.size () ? shape[i] : 1;
+      }
+    m_header->published.store (0, std::memory_order_relaxed);
+    m_header->consumed.store (0, std::memory_order_relaxed);
+    m_header->consumerStallNs.store (0, std::memory_order_release);
+    return true;
+  }
+
+  /// Unmap and remove the file; agents that mapped it keep their mapping.
+  void
+  Close ()
+  {
+    if (m_base != nullptr)
+      {
+        ::munmap (m_base, m_size);
+        ::unlink (m_path.c_str ());
+        m_base = nullptr;
+        m_header = nullptr;
+      }
+  }
+
+  bool
+  IsOpen () const
+  {
+    return m_base != nullptr;
+  }
+
+  const std::string&
+  GetPath () const
+  {
+    return m_path;
+  }
+
+  uint32_t
+  GetCapacity () const
+  {
+    return m_header->capacity;
+  }
+
+  uint32_t
+  GetSlotCount () const
+  {
+    return m_header->slotCount;
+  }
+
+  uint32_t
+  GetPublished () const
+  {
+    return m_header->published.load (std::memory_order_acquire);
+  }
+
+  uint32_t
+  GetConsumed () const
+  {
+    return m_header->consumed.load (std::memory_order_acquire);
+  }
+
+  /// Time the consumer reported waiting for new slots, in seconds.
+  double
+  GetConsumerStallSeconds () const
+  {
+    return m_header->consumerStallNs.load (std::memory_order_relaxed) * 1e-9;
+  }
+
+  /// Slot header of a published sequence number, valid until it is consumed.
+  const Slot*
+  GetPublishedSlot (uint32_t sequence) const
+  {
+    return GetSlot ((sequence - 1) % m_header->slotCount);
+  }
+
+  const float*
+  GetPublishedData (uint32_t sequence) const
+  {
+    return GetPayload ((sequence - 1) % m_header->slotCount);
+  }
+
+  /// Consumer side: release every slot up to sequence and wake a waiting producer.
+  void
+  SetConsumed (uint32_t sequence)
+  {
+    m_header->consumed.store (sequence, std::memory_order_release);
+    Wake (m_header->consumed);
+  }
+
+  /**
+   * Producer side: block until fewer than lag published slots are still
+   * unconsumed, so the write slot may be reused. Returns the nanoseconds
+   * spent waiting. lag must not exceed the slot count. A consumer that
+   * cannot issue FUTEX_WAKE (a plain Python store) is noticed by polling,
+   * backing off to a millisecond.
+   */
+  uint64_t
+  WaitForSpace (uint32_t lag)
+  {
+    uint32_t published = m_header->published.load (std::memory_order_relaxed);
+    uint32_t consumed = GetConsumed ();
+    if (published - consumed < lag)
+      {
+        return 0;
+      }
+    auto start = std::chrono::steady_clock::now ();
+    long pollNs = 20000;
+    while (published - consumed >= lag)
+      {
+        Wait (m_header->consumed, consumed, pollNs);
+        pollNs = std::min (pollNs * 2, 1000000L);
+        consumed = GetConsumed ();
+      }
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now ()
+                                                                 - start)
+        .count ();
+  }
+
+  /// Payload of the slot the next Publish releases; write the observation here.
+  float*
+  GetWriteData ()
+  {
+    return GetPayload (GetWriteSlot ());
+  }
+
+  uint32_t
+  GetWriteSlot () const
+  {
+    return m_header->published.load (std::memory_order_relaxed) % m_header->slotCount;
+  }
+
+  /**
+   * Release the write slot with size payload floats to the agent and wake
+   * readers waiting on `published`. Returns the new sequence number.
+   */
+  uint32_t
+  Publish (uint32_t size, uint64_t step, float reward, uint32_t flags, uint64_t stallNs = 0)
+  {
+    uint32_t sequence = m_header->published.load (std::memory_order_relaxed) + 1;
+    Slot* slot = GetSlot (GetWriteSlot ());
+    slot->sequence = sequence;
+    slot->size = size;
+    slot->step = step;
+    slot->reward = reward;
+    slot->flags = flags;
+    slot->stallNs = stallNs;
+    m_header->published.store (sequence, std::memory_order_release);
+    Wake (m_header->published);
+    return sequence;
+  }
+
+  /// Flags of the last published slot, 0 before the first publish.
+  uint32_t
+  GetLastFlags () const
+  {
+    uint32_t published = m_header->published.load (std::memory_order_relaxed);
+    return published == 0 ? 0 : GetPublishedSlot (published)->flags;
+  }
+
+private:
+  static void
+  Wake (std::atomic<uint32_t>& word)
+  {
+    ::syscall (SYS_futex, reinterpret_cast<uint32_t*> (&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+  }
+
+  /// Sleep while word == expected, at most timeoutNs (below a second).
+  static void
+  Wait (std::atomic<uint32_t>& word, uint32_t expected, long timeoutNs)
+  {
+    struct timespec timeout = {0, timeoutNs};
+    ::syscall (SYS_futex, reinterpret_cast<uint32_t*> (&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+  }
+
+  Slot*
+  GetSlot (uint32_t index) const
+  {
+    return reinterpret_cast<Slot*> (m_base + m_header->headerBytes
+                                    + uint64_t (index) * m_header->slotBytes);
+  }
+
+  float*
+  GetPayload (uint32_t index) const
+  {
+    return reinterpret_cast<float*> (GetSlot (index) + 1);
+  }
+
+  std::string m_path;
+  uint64_t m_size = 0;
+  uint8_t* m_base = nullptr;
+  Header* m_header = nullptr;
+};
+
+/**
+ * Simulation side of the --asyncLag action ring. The agent publishes
+ * actions in the order of the observations they target. Take hands out the
+ * newest action due at an observation and releases it and any older ones it
+ * supersedes; actions for later observations stay in the ring until then.
+ * Targets are observation sequence numbers rather than env steps, so they
+ * keep increasing across episode resets.
+ */
+class V2xShmActionReader
+{
+public:
+  struct Stats
+  {
+    uint64_t received = 0;   // actions taken from the ring
+    uint64_t superseded = 0; // replaced by a newer due action before being applied
+    uint64_t late = 0;       // applied after the observation they targeted
+    uint64_t lateBy = 0;     // sum of the observations they were late by
+  };
+
+  void
+  Attach (V2xShmRing* ring)
+  {
+    m_ring = ring;
+    m_taken = 0;
+    m_stats = Stats ();
+  }
+
+  /**
+   * Copy the newest action due at observation sequence target into action
+   * (size floats). Returns false and leaves action untouched when none
+   * arrived.
+   */
+  bool
+  Take (uint64_t target, float* action, uint32_t size)
+  {
+    uint32_t published = m_ring->GetPublished ();
+    const V2xShmRing::Slot* newest = nullptr;
+    uint32_t sequence = m_taken;
+    while (sequence != published && m_ring->GetPublishedSlot (sequence + 1)->step <= target)
+      {
+        ++sequence;
+        m_stats.superseded += newest != nullptr;
+        newest = m_ring->GetPublishedSlot (sequence);
+        ++m_stats.received;
+      }
+    if (newest == nullptr)
+      {
+        return false;
+      }
+    if (newest->step < target)
+      {
+        ++m_stats.late;
+        m_stats.lateBy += target - newest->step;
+      }
+    const float* data = m_ring->GetPublishedData (sequence);
+    std::copy (data, data + std::min (size, newest->size), action);
+    m_taken = sequence;
+    m_ring->SetConsumed (sequence);
+    return true;
+  }
+
+  const Stats&
+  GetStats () const
+  {
+    return m_stats;
+  }
+
+private:
+  V2xShmRing* m_ring = nullptr;
+  uint32_t m_taken = 0;
+  Stats m_stats;
+};
+
+/**
+ * OpenGym observation of the shared-memory transport: a uint32 Box
+ * [sequence, slot, size, step] pointing at the slot that holds the data.
+ */
+class V2xShmDescriptorContainer : public OpenGymDataContainer
+{
+public:
+  static constexpr uint32_t kSize = 4;
+
+  static TypeId
+  GetTypeId ()
+  {
+    static TypeId tid = TypeId ("ns3::V2xShmDescriptorContainer")
+                            .SetParent<OpenGymDataContainer> ()
+                            .SetGroupName ("OpenGym")
+                            .AddConstructor<V2xShmDescriptorContainer> ();
+    return tid;
+  }
+
+  V2xShmDescriptorContainer ()
+  {
+    m_box.set_dtype (ns3opengym::UINT);
+    m_box.add_shape (kSize);
+    m_box.mutable_uintdata ()->Resize (kSize, 0);
+  }
+
+  void
+  Set (uint32_t sequence, uint32_t slot, uint32_t size, uint32_t step)
+  {
+    uint32_t* data = m_box.mutable_uintdata ()->mutable_data ();
+    data[0] = sequence;
+    data[1] = slot;
+    data[2] = size;
+    data[3] = step;
+  }
+
+  ns3opengym::DataContainer
+  GetDataContainerPbMsg () override
+  {
+    ns3opengym::DataContainer container;
+    container.set_type (ns3opengym::Box);
+    container.mutable_data ()->PackFrom (m_box);
+    return container;
+  }
+
+  void
+  Print (std::ostream& where) const override
+  {
+    where << "[";
+    for (int i = 0; i < m_box.uintdata_size (); ++i)
+      {
+        where << (i > 0 ? ", " : "") << m_box.uintdata (i);
+      }
+    where << "]";
+  }
+
+private:
+  ns3opengym::BoxDataContainer m_box;
+};
+
+} // namespace ns3
+
+#endif /* V2X_SHM_TRANSPORT_H */
@@ -0,0 +1,221 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Active-only observation encodings for the V2X OpenGym examples
+ *
+ * The dense observation reserves a block for every vehicle node and zero
+ * fills the inactive ones. The sparse encodings only carry active vehicles:
+ * every observation row keeps its fixed fleet fields and lists one entry of
+ * entryFields floats per active vehicle, the node index first. Rows and
+ * entries are staged here while the step runs and written into the flat
+ * float Box at exchange time, so the payload grows with the number of active
+ * vehicles instead of the node count.
+ *
+ * Both encodings start with the same header, which tells the agent how to
+ * read the rest of the payload:
+ *
+ *   [encoding, rows, rowFields, entryFields, entries]
+ *
+ * LIST continues with each row as [count, rowFields..., count * entryFields].
+ * CSR continues with rows + 1 entry offsets, then all row fields row by row,
+ * then the entries one field at a time (all node indices, all x, ...), so
+ * each field decodes as one contiguous array.
+ */
+
+#ifndef V2X_SPARSE_OBSERVATION_H
+#define V2X_SPARSE_OBSERVATION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+
+class V2xSparseObservation
+{
+public:
+  enum Encoding : uint32_t
+  {
+    DENSE = 0, // zero-padded block per vehicle node, not handled by this class
+    LIST = 1,
+    CSR = 2,
+    DELTA = 3 // dense rows sent as keyframes and deltas by V2xDeltaEncoder
+  };
+
+  static constexpr uint32_t kHeaderSize = 5;
+
+  /// Parse dense, list, csr or delta. Returns false on an unknown name.
+  static bool
+  ParseEncoding (const std::string& name, Encoding& encoding)
+  {
+    if (name == "dense")
+      {
+        encoding = DENSE;
+      }
+    else if (name == "list")
+      {
+        encoding = LIST;
+      }
+    else if (name == "csr")
+      {
+        encoding = CSR;
+      }
+    else if (name == "delta")
+      {
+        encoding = DELTA;
+      }
+    else
+      {
+        return false;
+      }
+    return true;
+  }
+
+  /// Whether the encoding stages rows in this class rather than the dense block layout.
+  static bool
+  IsSparse (Encoding encoding)
+  {
+    return encoding == LIST || encoding == CSR;
+  }
+
+  void
+  Configure (Encoding encoding, uint32_t rowFields, uint32_t entryFields)
+  {
+    m_encoding = encoding;
+    m_rowFields = rowFields;
+    m_entryFields = entryFields;
+  }
+
+  /// Payload floats when every row lists maxEntriesPerRow vehicles, for the Box space bound.
+  uint64_t
+  GetMaxSize (uint32_t rows, uint32_t maxEntriesPerRow) const
+  {
+    uint64_t entries = uint64_t (rows) * maxEntriesPerRow;
+    return GetSize (rows, entries);
+  }
+
+  /// Start staging an exchange of `rows` rows.
+  void
+  Reset (uint32_t rows)
+  {
+    m_rows.assign (rows, Row ());
+    m_rowData.assign (uint64_t (rows) * m_rowFields, 0.0f);
+    m_entries.clear ();
+    m_current = 0;
+  }
+
+  /// Begin row `row` and return its rowFields floats. Entries added next belong to it.
+  float*
+  BeginRow (uint32_t row)
+  {
+    m_current = row;
+    m_rows[row].begin = m_entries.size () / m_entryFields;
+    m_rows[row].count = 0;
+    return m_rowData.data () + uint64_t (row) * m_rowFields;
+  }
+
+  /// Append an entry to the current row and return its entryFields floats.
+  float*
+  AddEntry ()
+  {
+    m_entries.resize (m_entries.size () + m_entryFields);
+    m_rows[m_current].count++;
+    return m_entries.data () + m_entries.size () - m_entryFields;
+  }
+
+  /// Let row `to` repeat row `from`, entries included.
+  void
+  CopyRow (uint32_t from, uint32_t to)
+  {
+    m_rows[to] = m_rows[from];
+    std::copy_n (m_rowData.data () + uint64_t (from) * m_rowFields, m_rowFields,
+                 m_rowData.data () + uint64_t (to) * m_rowFields);
+  }
+
+  /// Payload floats of the staged exchange.
+  uint64_t
+  GetEncodedSize () const
+  {
+    uint64_t entries = 0;
+    for (const Row& row : m_rows)
+      {
+        entries += row.count;
+      }
+    return GetSize (static_cast<uint32_t> (m_rows.size ()), entries);
+  }
+
+  /// Write GetEncodedSize () floats.
+  void
+  Encode (float* out) const
+  {
+    uint64_t entries = 0;
+    for (const Row& row : m_rows)
+      {
+        entries += row.count;
+      }
+    *out++ = static_cast<float> (m_encoding);
+    *out++ = static_cast<float> (m_rows.size ());
+    *out++ = static_cast<float> (m_rowFields);
+    *out++ = static_cast<float> (m_entryFields);
+    *out++ = static_cast<float> (entries);
+
+    if (m_encoding == LIST)
+      {
+        for (uint32_t r = 0; r < m_rows.size (); ++r)
+          {
+            const Row& row = m_rows[r];
+            *out++ = static_cast<float> (row.count);
+            out = std::copy_n (m_rowData.data () + uint64_t (r) * m_rowFields, m_rowFields, out);
+            out = std::copy_n (m_entries.data () + row.begin * m_entryFields,
+                               uint64_t (row.count) * m_entryFields, out);
+          }
+        return;
+      }
+
+    uint64_t offset = 0;
+    *out++ = 0.0f;
+    for (const Row& row : m_rows)
+      {
+        offset += row.count;
+        *out++ = static_cast<float> (offset);
+      }
+    out = std::copy (m_rowData.begin (), m_rowData.end (), out);
+    for (uint32_t field = 0; field < m_entryFields; ++field)
+      {
+        for (const Row& row : m_rows)
+          {
+            const float* entry = m_entries.data () + row.begin * m_entryFields + field;
+            for (uint32_t e = 0; e < row.count; ++e, entry += m_entryFields)
+              {
+                *out++ = *entry;
+              }
+          }
+      }
+  }
+
+private:
+  struct Row
+  {
+    uint64_t begin = 0; // first entry in m_entries
+    uint32_t count = 0;
+  };
+
+  uint64_t
+  GetSize (uint32_t rows, uint64_t entries) const
+  {
+    uint64_t size = kHeaderSize + uint64_t (rows) * m_rowFields + entries * m_entryFields;
+    return size + (m_encoding == LIST ? rows : rows + 1);
+  }
+
+  Encoding m_encoding = LIST;
+  uint32_t m_rowFields = 0;
+  uint32_t m_entryFields = 0;
+  std::vector<Row> m_rows;
+  std::vector<float> m_rowData; // rows * rowFields
+  std::vector<float> m_entries; // entryFields per entry, in staging order
+  uint32_t m_current = 0;
+};
+
+} // namespace ns3
+
+#endif /* V2X_SPARSE_OBSERVATION_H */
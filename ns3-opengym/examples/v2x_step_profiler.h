@@ -0,0 +1,388 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Per-step phase profiler for the V2X OpenGym examples
+ *
+ * V2X_PROFILE_SCOPE (phase) marks a block as one phase of the env step.
+ * While profiling is enabled at run time each scope reads the steady clock
+ * twice and records its self time, i.e. its duration minus the time of the
+ * scopes nested inside it, into a per-phase latency histogram. The exchange
+ * phase wraps the OpenGym NotifyCurrentState call, so its self time is the
+ * ZMQ round trip without the observation and action callbacks it runs.
+ * Every scope also lands in a fixed ring of recent events. Slots carry a
+ * sequence number, so the ring is appended to and read without locks and a
+ * reader skips slots that are being rewritten.
+ *
+ * Histograms use 8 linear sub-buckets per power of two of nanoseconds, so
+ * reported percentiles are within 12.5 % of the recorded latency. Define
+ * V2X_DISABLE_PROFILING to compile the scopes out entirely.
+ *
+ * LOG_STEP (message) is the --logInterval gated per-step log of the
+ * examples. It reads the includer's g_currentStep and only evaluates the
+ * message on logged steps.
+ */
+
+#ifndef V2X_STEP_PROFILER_H
+#define V2X_STEP_PROFILER_H
+
+#include "ns3/core-module.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace ns3 {
+
+class V2xStepProfiler
+{
+public:
+  enum Phase : uint32_t
+  {
+    MOBILITY = 0, // trace replay into node positions and metrics
+    METRICS,      // vehicle metrics, CAM telemetry and connectivity graph updates
+    OBSERVATION,  // observation build and encoding
+    EXCHANGE,     // ZMQ wait, or the export write when running headless
+    ACTION,       // action handling
+    PHASE_COUNT
+  };
+
+  static constexpr uint32_t kBuckets = 512;
+
+  struct Event
+  {
+    std::atomic<uint64_t> sequence{0}; // index + 1 once the slot holds event `index`
+    uint64_t startNs = 0;              // since Enable ()
+    uint64_t durationNs = 0;
+    uint64_t selfNs = 0;
+    uint32_t step = 0;
+    uint32_t phase = 0;
+  };
+
+  static const char*
+  GetPhaseName (uint32_t phase)
+  {
+    static const char* const names[PHASE_COUNT] = {"mobility", "metrics", "observation",
+                                                   "exchange", "action"};
+    return phase < PHASE_COUNT ? names[phase] : "unknown";
+  }
+
+  /// Start recording; ringSize is rounded up to a power of two.
+  void
+  Enable (uint32_t ringSize)
+  {
+    uint32_t capacity = 1;
+    while (capacity < ringSize)
+      {
+        capacity <<= 1;
+      }
+    m_ring = std::vector<Event> (capacity);
+    m_mask = capacity - 1;
+    m_next.store (0, std::memory_order_relaxed);
+    m_histograms = {};
+    m_origin = std::chrono::steady_clock::now ();
+    m_enabled = true;
+  }
+
+  bool
+  IsEnabled () const
+  {
+    return m_enabled;
+  }
+
+  /// Step number attached to the events recorded from now on.
+  void
+  SetStep (uint32_t step)
+  {
+    m_step = step;
+  }
+
+  std::chrono::steady_clock::time_point
+  GetOrigin () const
+  {
+    return m_origin;
+  }
+
+  /// Total self time recorded so far, used by scopes to exclude nested ones.
+  uint64_t
+  GetRecordedNs () const
+  {
+    return m_recordedNs;
+  }
+
+  /// Record a finished scope. Histograms belong to the simulation thread.
+  void
+  Record (uint32_t phase, uint64_t startNs, uint64_t durationNs, uint64_t nestedNs)
+  {
+    uint64_t selfNs = durationNs > nestedNs ? durationNs - nestedNs : 0;
+    m_recordedNs += selfNs;
+
+    Histogram& histogram = m_histograms[phase];
+    histogram.buckets[GetBucket (selfNs)]++;
+    histogram.count++;
+    histogram.totalNs += selfNs;
+    histogram.maxNs = std::max (histogram.maxNs, selfNs);
+
+    uint64_t index = m_next.fetch_add (1, std::memory_order_relaxed);
+    Event& event = m_ring[index & m_mask];
+    event.sequence.store (0, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+    event.startNs = startNs;
+    event.durationNs = durationNs;
+    event.selfNs = selfNs;
+    event.step = m_step;
+    event.phase = phase;
+    event.sequence.store (index + 1, std::memory_order_release);
+  }
+
+  /// Log one line per phase: count, mean and percentiles of the self time in microseconds.
+  void
+  Dump () const
+  {
+    NS_LOG_UNCOND ("[Profile] phase        count    mean_us     p50_us     p90_us     p99_us     max_us");
+    for (uint32_t phase = 0; phase < PHASE_COUNT; ++phase)
+      {
+        const Histogram& histogram = m_histograms[phase];
+        if (histogram.count == 0)
+          {
+            continue;
+          }
+        char line[160];
+        std::snprintf (line, sizeof (line), "[Profile] %-11s %7llu %10.2f %10.2f %10.2f %10.2f %10.2f",
+                       GetPhaseName (phase), static_cast<unsigned long long> (histogram.count),
+                       histogram.totalNs * 1e-3 / histogram.count,
+                       GetPercentile (histogram, 0.50) * 1e-3, GetPercentile (histogram, 0.90) * 1e-3,
+                       GetPercentile (histogram, 0.99) * 1e-3, histogram.maxNs * 1e-3);
+        NS_LOG_UNCOND (line);
+      }
+  }
+
+  /// Write the events still held by the ring as CSV, oldest first.
+  bool
+  WriteEvents (const std::string& path) const
+  {
+    std::ofstream out (path);
+    if (!out)
+      {
+        return false;
+      }
+    out << "step,phase,start_ns,duration_ns,self_ns\n";
+    uint64_t end = m_next.load (std::memory_order_acquire);
+    uint64_t begin = end > m_ring.size () ? end - m_ring.size () : 0;
+    for (uint64_t index = begin; index < end; ++index)
+      {
+        const Event& event = m_ring[index & m_mask];
+        if (event.sequence.load (std::memory_order_acquire) != index + 1)
+          {
+            continue; // overwritten or still being written
+          }
+        Event copy;
+        copy.startNs = event.startNs;
+        copy.durationNs = event.durationNs;
+        copy.selfNs = event.selfNs;
+        copy.step = event.step;
+        copy.phase = event.phase;
+        std::atomic_thread_fence (std::memory_order_acquire);
+        if (event.sequence.load (std::memory_order_relaxed) != index + 1)
+          {
+            continue;
+          }
+        out << copy.step << ',' << GetPhaseName (copy.phase) << ',' << copy.startNs << ','
+            << copy.durationNs << ',' << copy.selfNs << '\n';
+      }
+    return static_cast<bool> (out);
+  }
+
+  /// Dump, then write the event ring to eventsPath unless it is empty.
+  void
+  DumpReport (const std::string& eventsPath) const
+  {
+    if (!m_enabled)
+      {
+        return;
+      }
+    Dump ();
+    if (!eventsPath.empty () && !WriteEvents (eventsPath))
+      {
+        NS_LOG_UNCOND ("[Profile] Failed to write " << eventsPath);
+      }
+  }
+
+  /// Ask for a dump at the next step boundary on SIGUSR1.
+  static void
+  InstallSignalHandler ()
+  {
+    DumpRequested () = 0;
+    std::signal (SIGUSR1, [] (int) { DumpRequested () = 1; });
+  }
+
+  /// Whether SIGUSR1 arrived since the last call.
+  static bool
+  TakeDumpRequest ()
+  {
+    if (DumpRequested () == 0)
+      {
+        return false;
+      }
+    DumpRequested () = 0;
+    return true;
+  }
+
+private:
+  struct Histogram
+  {
+    std::array<uint64_t, kBuckets> buckets{};
+    uint64_t count = 0;
+    uint64_t totalNs = 0;
+    uint64_t maxNs = 0;
+  };
+
+  static volatile std::sig_atomic_t&
+  DumpRequested ()
+  {
+    static volatile std::sig_atomic_t requested = 0;
+    return requested;
+  }
+
+  static uint32_t
+  GetBucket (uint64_t ns)
+  {
+    if (ns < 8)
+      {
+        return static_cast<uint32_t> (ns);
+      }
+    uint32_t exponent = 63 - __builtin_clzll (ns);
+    uint32_t sub = static_cast<uint32_t> (ns >> (exponent - 3)) & 7;
+    return (exponent - 2) * 8 + sub;
+  }
+
+  /// Upper bound in ns of the values in a bucket.
+  static uint64_t
+  GetBucketLimit (uint32_t bucket)
+  {
+    if (bucket < 8)
+      {
+        return bucket;
+      }
+    uint32_t exponent = bucket / 8 + 2;
+    uint64_t sub = bucket % 8;
+    return ((9 + sub) << (exponent - 3)) - 1;
+  }
+
+  static uint64_t
+  GetPercentile (const Histogram& histogram, double quantile)
+  {
+    uint64_t rank = static_cast<uint64_t> (quantile * (histogram.count - 1)) + 1;
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < kBuckets; ++bucket)
+      {
+        seen += histogram.buckets[bucket];
+        if (seen >= rank)
+          {
+            return std::min (GetBucketLimit (bucket), histogram.maxNs);
+          }
+      }
+    return histogram.maxNs;
+  }
+
+  bool m_enabled = false;
+  uint32_t m_step = 0;
+  uint64_t m_recordedNs = 0;
+  std::chrono::steady_clock::time_point m_origin;
+  std::array<Histogram, PHASE_COUNT> m_histograms{};
+  std::vector<Event> m_ring;
+  uint64_t m_mask = 0;
+  std::atomic<uint64_t> m_next{0};
+};
+
+inline V2xStepProfiler g_v2xStepProfiler;
+
+/// --logInterval gate of LOG_STEP: 0 disables per-step logs, 1 logs every step.
+class V2xStepLog
+{
+public:
+  void
+  SetInterval (uint32_t interval)
+  {
+    m_interval = interval;
+  }
+
+  bool
+  IsLogStep (uint32_t step) const
+  {
+    return m_interval == 1 || (m_interval > 1 && step % m_interval == 0);
+  }
+
+private:
+  uint32_t m_interval = 10;
+};
+
+inline V2xStepLog g_v2xStepLog;
+
+/// Times the enclosing block as one phase while the profiler is enabled.
+class V2xProfileScope
+{
+public:
+  explicit V2xProfileScope (V2xStepProfiler::Phase phase)
+    : m_phase (phase),
+      m_active (g_v2xStepProfiler.IsEnabled ())
+  {
+    if (m_active)
+      {
+        m_nestedMark = g_v2xStepProfiler.GetRecordedNs ();
+        m_start = std::chrono::steady_clock::now ();
+      }
+  }
+
+  V2xProfileScope (const V2xProfileScope&) = delete;
+  V2xProfileScope& operator= (const V2xProfileScope&) = delete;
+
+  ~V2xProfileScope ()
+  {
+    if (!m_active)
+      {
+        return;
+      }
+    auto end = std::chrono::steady_clock::now ();
+    auto ns = [] (std::chrono::steady_clock::duration d) {
+      return static_cast<uint64_t> (std::chrono::duration_cast<std::chrono::nanoseconds> (d).count ());
+    };
+    g_v2xStepProfiler.Record (m_phase, ns (m_start - g_v2xStepProfiler.GetOrigin ()), ns (end - m_start),
+                              g_v2xStepProfiler.GetRecordedNs () - m_nestedMark);
+  }
+
+private:
+  V2xStepProfiler::Phase m_phase;
+  bool m_active;
+  uint64_t m_nestedMark = 0;
+  std::chrono::steady_clock::time_point m_start;
+};
+
+} // namespace ns3
+
+#ifdef V2X_DISABLE_PROFILING
+#define V2X_PROFILE_SCOPE(phase)
+#else
+#define V2X_PROFILE_CONCAT_(a, b) a##b
+#define V2X_PROFILE_CONCAT(a, b) V2X_PROFILE_CONCAT_ (a, b)
+#define V2X_PROFILE_SCOPE(phase)                                                                   \
+  ns3::V2xProfileScope V2X_PROFILE_CONCAT (v2xProfileScope, __LINE__) (ns3::V2xStepProfiler::phase)
+#endif
+
+/// Log a per-step message; the message expression is only evaluated on logged steps.
+#define LOG_STEP(message)                                                                          \
+  do                                                                                               \
+    {                                                                                              \
+      if (ns3::g_v2xStepLog.IsLogStep (g_currentStep))                                             \
+        {                                                                                          \
+          NS_LOG_UNCOND (message);                                                                 \
+        }                                                                                          \
+    }                                                                                              \
+  while (false)
+
+#endif /* V2X_STEP_PROFILER_H */
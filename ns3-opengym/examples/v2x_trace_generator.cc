@@ -0,0 +1,558 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Synthetic SUMO FCD scenario generator for V2X load tests
+ *
+ * Writes a straight multi-lane highway with a fixed number of vehicle slots
+ * as an FCD XML trace or directly as a compiled .v2xtrace file, so the
+ * replay can be stressed at densities the bundled 7-vehicle traces do not
+ * reach. Every slot holds one vehicle at every timestep. With churn a
+ * vehicle leaves at a random step and a new vehicle with a new ID enters
+ * its slot at the start of the road; with a road length vehicles also leave
+ * when they pass its end. The number of vehicles present at once therefore
+ * stays at the slot count while the number of distinct IDs grows.
+ *
+ * Speed profiles follow the bundled variants:
+ *
+ *   normal         14-17 m/s per vehicle with +-0.8 m/s noise per step
+ *   ultra_fast     constant 30-40 m/s per vehicle
+ *   ultra_slow     constant 2-5 m/s per vehicle
+ *   mixed_extreme  alternating 40 m/s and 2 m/s vehicles
+ *
+ * Generation is split over threads by slot range and runs in batches of
+ * timesteps. A writer thread streams the previous batch to the output while
+ * the next one is generated, so memory stays bounded by two batches for any
+ * duration. All random draws are a hash of the seed, slot, vehicle and step,
+ * so the output does not depend on the thread count. Positions and speeds
+ * are rounded to the two decimals of the XML, which makes the compiled
+ * output identical to compiling the XML output.
+ */
+
+#include "ns3/core-module.h"
+
+#include "sumo_trace_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <future>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace ns3;
+
+NS_LOG_COMPONENT_DEFINE ("V2xTraceGenerator");
+
+namespace {
+
+enum SpeedProfile
+{
+  NORMAL,
+  ULTRA_FAST,
+  ULTRA_SLOW,
+  MIXED_EXTREME
+};
+
+bool
+ParseSpeedProfile (const std::string& name, SpeedProfile& profile)
+{
+  if (name == "normal")
+    {
+      profile = NORMAL;
+    }
+  else if (name == "ultra_fast")
+    {
+      profile = ULTRA_FAST;
+    }
+  else if (name == "ultra_slow")
+    {
+      profile = ULTRA_SLOW;
+    }
+  else if (name == "mixed_extreme")
+    {
+      profile = MIXED_EXTREME;
+    }
+  else
+    {
+      return false;
+    }
+  return true;
+}
+
+struct ScenarioConfig
+{
+  uint32_t lanes = 3;
+  uint32_t vehicles = 1000;
+  double duration = 120.0;
+  double stepTime = 0.1;
+  double churn = 0.0;
+  double roadLength = 0.0;
+  double spacing = 20.0;
+  double laneWidth = 3.2;
+  SpeedProfile profile = NORMAL;
+  uint64_t seed = 1;
+};
+
+/// Generated samples of one slot range over one batch of timesteps.
+struct Chunk
+{
+  std::vector<uint64_t> stepEnd; // per batch step, end offset into text or the sample columns
+  std::string text;              // XML vehicle lines
+  std::vector<uint32_t> slot;    // compiled output: one entry per sample
+  std::vector<uint32_t> generation;
+  std::vector<uint8_t> entered; // first sample of the vehicle
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> speed;
+
+  void
+  Clear ()
+  {
+    stepEnd.clear ();
+    text.clear ();
+    slot.clear ();
+    generation.clear ();
+    entered.clear ();
+    x.clear ();
+    y.clear ();
+    speed.clear ();
+  }
+};
+
+/// Write the decimal digits of value at out and return the end.
+char*
+WriteUnsigned (char* out, uint64_t value)
+{
+  char digits[20];
+  int n = 0;
+  do
+    {
+      digits[n++] = static_cast<char> ('0' + value % 10);
+      value /= 10;
+    }
+  while (value > 0);
+  while (n > 0)
+    {
+      *out++ = digits[--n];
+    }
+  return out;
+}
+
+/// Write value / 100 with two decimals, as %.2f would print it.
+char*
+WriteCenti (char* out, int64_t centi)
+{
+  if (centi < 0)
+    {
+      *out++ = '-';
+      centi = -centi;
+    }
+  out = WriteUnsigned (out, static_cast<uint64_t> (centi) / 100);
+  *out++ = '.';
+  *out++ = static_cast<char> ('0' + (centi / 10) % 10);
+  *out++ = static_cast<char> ('0' + centi % 10);
+  return out;
+}
+
+char*
+WriteLiteral (char* out, const char* text)
+{
+  while (*text != '\0')
+    {
+      *out++ = *text++;
+    }
+  return out;
+}
+
+/// Vehicle ID of a slot generation: veh_<slot> for the first one, veh_<slot>.<generation> after.
+char*
+WriteVehicleId (char* out, uint32_t slot, uint32_t generation)
+{
+  out = WriteUnsigned (WriteLiteral (out, "veh_"), slot);
+  if (generation > 0)
+    {
+      *out++ = '.';
+      out = WriteUnsigned (out, generation);
+    }
+  return out;
+}
+
+class ScenarioGenerator
+{
+public:
+  explicit ScenarioGenerator (const ScenarioConfig& config)
+    : m_config (config),
+      m_state (config.vehicles)
+  {
+    for (uint32_t s = 0; s < m_config.vehicles; ++s)
+      {
+        m_state[s].x = (s / m_config.lanes) * m_config.spacing;
+        m_state[s].baseSpeed = DrawBaseSpeed (s, 0);
+      }
+  }
+
+  /// Advance slots [begin, end) over batch steps [firstStep, firstStep + steps) into chunk.
+  void
+  Generate (uint32_t begin, uint32_t end, uint32_t firstStep, uint32_t steps, bool xml, Chunk& chunk)
+  {
+    chunk.Clear ();
+    double exitProbability = m_config.churn * m_config.stepTime;
+    for (uint32_t step = firstStep; step < firstStep + steps; ++step)
+      {
+        for (uint32_t s = begin; s < end; ++s)
+          {
+            Vehicle& vehicle = m_state[s];
+            bool entered = step == 0;
+            if (step > 0
+                && ((exitProbability > 0.0 && Uniform (s, vehicle.generation, step, 1) < exitProbability)
+                    || (m_config.roadLength > 0.0 && vehicle.x > m_config.roadLength)))
+              {
+                vehicle.generation++;
+                vehicle.x = 0.0;
+                vehicle.baseSpeed = DrawBaseSpeed (s, vehicle.generation);
+                entered = true;
+              }
+
+            double speed = vehicle.baseSpeed;
+            if (m_config.profile == NORMAL)
+              {
+                speed += 0.8 * (2.0 * Uniform (s, vehicle.generation, step, 2) - 1.0);
+              }
+            int64_t x = std::llround (vehicle.x * 100.0);
+            int64_t y = std::llround (((s % m_config.lanes) + 0.5) * m_config.laneWidth * 100.0);
+            int64_t v = std::llround (speed * 100.0);
+            vehicle.x += speed * m_config.stepTime;
+
+            if (xml)
+              {
+                char line[160];
+                char* out = WriteLiteral (line, "        <vehicle id=\"");
+                out = WriteVehicleId (out, s, vehicle.generation);
+                out = WriteCenti (WriteLiteral (out, "\" x=\""), x);
+                out = WriteCenti (WriteLiteral (out, "\" y=\""), y);
+                out = WriteCenti (WriteLiteral (out, "\" speed=\""), v);
+                out = WriteLiteral (out, "\" type=\"passenger\" />\n");
+                chunk.text.append (line, out - line);
+              }
+            else
+              {
+                // q / 100.0 is the double nearest to the printed decimal, as the XML parser reads it
+                chunk.slot.push_back (s);
+                chunk.generation.push_back (vehicle.generation);
+                chunk.entered.push_back (entered ? 1 : 0);
+                chunk.x.push_back (static_cast<float> (x / 100.0));
+                chunk.y.push_back (static_cast<float> (y / 100.0));
+                chunk.speed.push_back (static_cast<float> (v / 100.0));
+              }
+          }
+        chunk.stepEnd.push_back (xml ? chunk.text.size () : chunk.slot.size ());
+      }
+  }
+
+private:
+  struct Vehicle
+  {
+    double x = 0.0;
+    double baseSpeed = 0.0;
+    uint32_t generation = 0;
+  };
+
+  static uint64_t
+  Mix (uint64_t z)
+  {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  /// Uniform draw in [0, 1) keyed by slot, generation, step and purpose.
+  double
+  Uniform (uint32_t slot, uint32_t generation, uint32_t step, uint32_t purpose) const
+  {
+    uint64_t h = Mix (m_config.seed + 0x9e3779b97f4a7c15ULL * (uint64_t (slot) + 1));
+    h = Mix (h ^ ((uint64_t (generation) << 32) | step));
+    h = Mix (h + purpose);
+    return (h >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  double
+  DrawBaseSpeed (uint32_t slot, uint32_t generation) const
+  {
+    double u = Uniform (slot, generation, 0, 0);
+    switch (m_config.profile)
+      {
+      case ULTRA_FAST:
+        return 30.0 + 10.0 * u;
+      case ULTRA_SLOW:
+        return 2.0 + 3.0 * u;
+      case MIXED_EXTREME:
+        return (slot + generation) % 2 == 0 ? 40.0 : 2.0;
+      case NORMAL:
+      default:
+        return 14.0 + 3.0 * u;
+      }
+  }
+
+  ScenarioConfig m_config;
+  std::vector<Vehicle> m_state; // per slot
+};
+
+/// Streams batches of chunks, in slot order per timestep, to an XML or compiled trace.
+class TraceWriter
+{
+public:
+  TraceWriter (const ScenarioConfig& config, bool xml)
+    : m_config (config),
+      m_xml (xml),
+      m_slotVehicle (config.vehicles, 0)
+  {
+    // Enough decimals to print every timestep exactly, at least the two SUMO uses
+    m_timeDecimals = 2;
+    while (m_timeDecimals < 6)
+      {
+        double scaled = m_config.stepTime * std::pow (10.0, m_timeDecimals);
+        if (std::fabs (scaled - std::round (scaled)) < 1e-6)
+          {
+            break;
+          }
+        m_timeDecimals++;
+      }
+  }
+
+  ~TraceWriter ()
+  {
+    if (m_file != nullptr)
+      {
+        std::fclose (m_file);
+        std::remove (m_path.c_str ());
+      }
+  }
+
+  bool
+  Open (const std::string& path, uint32_t timesteps)
+  {
+    m_path = path;
+    if (!m_xml)
+      {
+        if (!m_cache.Open (path, timesteps, uint64_t (timesteps) * m_config.vehicles,
+                           m_config.stepTime))
+          {
+            return false;
+          }
+        m_cache.AddTypeName ("passenger");
+        return true;
+      }
+    m_file = std::fopen (path.c_str (), "w");
+    if (m_file == nullptr)
+      {
+        return false;
+      }
+    std::setvbuf (m_file, nullptr, _IOFBF, 1 << 20);
+    std::fputs ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                "<fcd-export xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" "
+                "xsi:noNamespaceSchemaLocation=\"http://sumo.dlr.de/xsd/fcd_file.xsd\">\n",
+                m_file);
+    return true;
+  }
+
+  /// Write batch steps [firstStep, firstStep + steps) held by chunks.
+  bool
+  WriteBatch (uint32_t firstStep, uint32_t steps, const std::vector<Chunk>& chunks)
+  {
+    bool ok = true;
+    for (uint32_t k = 0; k < steps; ++k)
+      {
+        if (m_xml)
+          {
+            std::fprintf (m_file, "    <timestep time=\"%.*f\">\n", m_timeDecimals,
+                          (firstStep + k) * m_config.stepTime);
+            for (const Chunk& chunk : chunks)
+              {
+                uint64_t begin = k > 0 ? chunk.stepEnd[k - 1] : 0;
+                std::fwrite (chunk.text.data () + begin, 1, chunk.stepEnd[k] - begin, m_file);
+              }
+            ok = std::fputs ("    </timestep>\n", m_file) >= 0 && ok;
+            continue;
+          }
+
+        m_cache.BeginStep ();
+        for (const Chunk& chunk : chunks)
+          {
+            uint64_t begin = k > 0 ? chunk.stepEnd[k - 1] : 0;
+            uint64_t count = chunk.stepEnd[k] - begin;
+            m_nodeIndex.resize (count);
+            m_typeId.assign (count, 0);
+            for (uint64_t i = 0; i < count; ++i)
+              {
+                uint32_t s = chunk.slot[begin + i];
+                if (chunk.entered[begin + i])
+                  {
+                    // Vehicles are numbered in first-seen order, like the XML loader does
+                    char id[32];
+                    char* end = WriteVehicleId (id, s, chunk.generation[begin + i]);
+                    m_slotVehicle[s] = m_cache.AddVehicleId (std::string_view (id, end - id));
+                  }
+                m_nodeIndex[i] = m_slotVehicle[s];
+              }
+            m_cache.AppendSamples (m_nodeIndex.data (), chunk.x.data () + begin,
+                                   chunk.y.data () + begin, chunk.speed.data () + begin,
+                                   m_typeId.data (), count);
+          }
+      }
+    return ok;
+  }
+
+  bool
+  Finish ()
+  {
+    if (!m_xml)
+      {
+        return m_cache.Finish ();
+      }
+    bool ok = std::fputs ("</fcd-export>\n", m_file) >= 0;
+    ok = (std::fclose (m_file) == 0) && ok;
+    m_file = nullptr;
+    return ok;
+  }
+
+private:
+  ScenarioConfig m_config;
+  bool m_xml;
+  int m_timeDecimals = 2;
+  std::string m_path;
+  std::FILE* m_file = nullptr;
+  SumoTraceCacheStreamWriter m_cache;
+  std::vector<uint32_t> m_slotVehicle; // per slot, trajectory vehicle index of its current vehicle
+  std::vector<uint32_t> m_nodeIndex;
+  std::vector<uint16_t> m_typeId;
+};
+
+} // namespace
+
+int
+main (int argc, char* argv[])
+{
+  ScenarioConfig config;
+  std::string profileName = "normal";
+  std::string outputPath = "v2x_synthetic_fcd.xml";
+  std::string format = "";
+  uint32_t threads = 0;
+  uint32_t batchSamples = 1 << 22;
+
+  CommandLine cmd;
+  cmd.AddValue ("output", "Output trace path", outputPath);
+  cmd.AddValue ("format", "xml or compiled (default: compiled for a .v2xtrace output, else xml)",
+                format);
+  cmd.AddValue ("lanes", "Number of lanes", config.lanes);
+  cmd.AddValue ("vehicles", "Vehicles present at every timestep (one slot each)", config.vehicles);
+  cmd.AddValue ("duration", "Scenario duration in seconds", config.duration);
+  cmd.AddValue ("stepTime", "Timestep in seconds; use the env step of the simulation", config.stepTime);
+  cmd.AddValue ("profile", "Speed profile: normal, ultra_fast, ultra_slow or mixed_extreme",
+                profileName);
+  cmd.AddValue ("churn", "Rate per second at which a vehicle leaves and a new one enters its slot",
+                config.churn);
+  cmd.AddValue ("roadLength", "Vehicles past this x leave and a new one enters (0 = endless road)",
+                config.roadLength);
+  cmd.AddValue ("spacing", "Initial gap in meters between vehicles of one lane", config.spacing);
+  cmd.AddValue ("laneWidth", "Lane width in meters", config.laneWidth);
+  cmd.AddValue ("seed", "Random seed", config.seed);
+  cmd.AddValue ("threads", "Generator threads (0 = one per core)", threads);
+  cmd.AddValue ("batchSamples", "Samples generated per batch before they are written", batchSamples);
+  cmd.Parse (argc, argv);
+
+  if (!ParseSpeedProfile (profileName, config.profile))
+    {
+      NS_LOG_UNCOND ("[Gen] Unknown speed profile: " << profileName);
+      return 1;
+    }
+  if (format.empty ())
+    {
+      bool compiledPath = outputPath.size () >= 9
+                          && outputPath.compare (outputPath.size () - 9, 9, ".v2xtrace") == 0;
+      format = compiledPath ? "compiled" : "xml";
+    }
+  if (format != "xml" && format != "compiled")
+    {
+      NS_LOG_UNCOND ("[Gen] Unknown format: " << format);
+      return 1;
+    }
+  if (config.lanes == 0 || config.vehicles == 0 || config.stepTime <= 0.0 || config.duration < 0.0)
+    {
+      NS_LOG_UNCOND ("[Gen] lanes, vehicles and stepTime must be positive");
+      return 1;
+    }
+  bool xml = format == "xml";
+
+  if (threads == 0)
+    {
+      threads = std::max (1u, std::thread::hardware_concurrency ());
+    }
+  threads = std::min (threads, config.vehicles);
+  uint32_t timesteps = static_cast<uint32_t> (std::floor (config.duration / config.stepTime + 0.5)) + 1;
+  uint32_t batchSteps = std::max<uint32_t> (1, batchSamples / config.vehicles);
+
+  NS_LOG_UNCOND ("[Gen] " << outputPath << ": " << config.vehicles << " vehicles on " << config.lanes
+                          << " lanes, " << timesteps << " timesteps of " << config.stepTime << "s, "
+                          << profileName << " profile, churn " << config.churn << "/s, " << format
+                          << " format, " << threads << " threads");
+
+  ScenarioGenerator generator (config);
+  TraceWriter writer (config, xml);
+  if (!writer.Open (outputPath, timesteps))
+    {
+      NS_LOG_UNCOND ("[Gen] Cannot write " << outputPath);
+      return 1;
+    }
+
+  auto start = std::chrono::steady_clock::now ();
+  // Two chunk sets: one is written while the next batch is generated into the other
+  std::vector<std::vector<Chunk>> buffers (2, std::vector<Chunk> (threads));
+  std::future<bool> pending;
+  bool ok = true;
+  uint32_t batch = 0;
+  for (uint32_t firstStep = 0; firstStep < timesteps; firstStep += batchSteps, ++batch)
+    {
+      uint32_t steps = std::min (batchSteps, timesteps - firstStep);
+      std::vector<Chunk>& chunks = buffers[batch % 2];
+
+      std::vector<std::thread> workers;
+      for (uint32_t t = 0; t < threads; ++t)
+        {
+          uint32_t begin = static_cast<uint32_t> (uint64_t (config.vehicles) * t / threads);
+          uint32_t end = static_cast<uint32_t> (uint64_t (config.vehicles) * (t + 1) / threads);
+          workers.emplace_back ([&generator, &chunks, begin, end, firstStep, steps, xml, t] () {
+            generator.Generate (begin, end, firstStep, steps, xml, chunks[t]);
+          });
+        }
+      for (std::thread& worker : workers)
+        {
+          worker.join ();
+        }
+
+      if (pending.valid ())
+        {
+          ok = pending.get () && ok;
+        }
+      pending = std::async (std::launch::async, [&writer, &chunks, firstStep, steps] () {
+        return writer.WriteBatch (firstStep, steps, chunks);
+      });
+    }
+  if (pending.valid ())
+    {
+      ok = pending.get () && ok;
+    }
+  ok = writer.Finish () && ok;
+
+  double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+  if (!ok)
+    {
+      NS_LOG_UNCOND ("[Gen] Failed to write " << outputPath);
+      return 1;
+    }
+  uint64_t samples = uint64_t (timesteps) * config.vehicles;
+  NS_LOG_UNCOND ("[Gen] Wrote " << samples << " samples in " << seconds << "s ("
+                                << samples / std::max (seconds, 1e-9) / 1e6 << "M samples/s)");
+  return 0;
+}
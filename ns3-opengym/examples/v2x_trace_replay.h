@@ -0,0 +1,433 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Shared SUMO trace replay for the V2X OpenGym examples
+ *
+ * V2xTraceReplay loads a trace once, from a compiled file, from its cache
+ * sidecar or by parsing the XML, and replays env steps out of it. A
+ * V2xReplayTarget applies the samples of a step to one node pool: it maps
+ * vehicles to recycled node slots when a slot map is given and fills the
+ * per-node metrics the observation is built from. Node positions come from
+ * TraceReplayMobilityModel, which reads the loaded trace on demand; only
+ * the streamed replay, which has no whole trace to read from, pushes them
+ * into constant position models. The simulations and the replay benchmark
+ * share this code, so the load and replay paths exist once.
+ */
+
+#ifndef V2X_TRACE_REPLAY_H
+#define V2X_TRACE_REPLAY_H
+
+#include "ns3/core-module.h"
+#include "ns3/mobility-module.h"
+
+#include "sumo_fcd_parser.h"
+#include "sumo_replay_mobility.h"
+#include "sumo_slot_map.h"
+#include "sumo_trace_cache.h"
+#include "sumo_trace_loader.h"
+#include "sumo_trajectory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ns3 {
+
+struct VehicleMetrics
+{
+  VehicleMetrics () : position (Vector (0.0, 0.0, 0.0)), speed (0.0), active (false) {}
+  Vector position;
+  double speed;
+  bool active;
+};
+
+/// Size metrics to nodeCount entries and mark them all inactive.
+inline void
+ResetVehicleMetrics (std::vector<VehicleMetrics>& metrics, uint32_t nodeCount)
+{
+  metrics.assign (nodeCount, VehicleMetrics ());
+}
+
+/// Read position and speed of every node from its mobility model, as on the random-walk path.
+inline void
+UpdateMetricsFromMobility (const NodeContainer& nodes, std::vector<VehicleMetrics>& metrics)
+{
+  uint32_t nodeCount = std::min<uint32_t> (nodes.GetN (), metrics.size ());
+  for (uint32_t i = 0; i < nodeCount; ++i)
+    {
+      Ptr<MobilityModel> mobility = nodes.Get (i)->GetObject<MobilityModel> ();
+      VehicleMetrics& vehicle = metrics[i];
+      if (mobility)
+        {
+          Vector vel = mobility->GetVelocity ();
+          vehicle.position = mobility->GetPosition ();
+          vehicle.speed = std::sqrt (vel.x * vel.x + vel.y * vel.y);
+          vehicle.active = true;
+        }
+      else
+        {
+          vehicle = VehicleMetrics ();
+        }
+    }
+}
+
+class V2xTraceReplay
+{
+public:
+  /// Env step the trace is binned to (a non-positive step falls back to 0.1 s) and parser threads.
+  void
+  Configure (double envStepTime, uint32_t parseThreads, bool interpolate)
+  {
+    m_envStepTime = envStepTime > 0.0 ? envStepTime : 0.1;
+    m_parseThreads = parseThreads;
+    m_interpolate = interpolate;
+  }
+
+  /// Parse an XML trace into the owned trajectory arrays.
+  bool
+  Parse (const std::string& filePath)
+  {
+    SumoTraceLoader loader;
+    if (!loader.Load (filePath, m_envStepTime, m_parseThreads, m_data))
+      {
+        NS_LOG_UNCOND ("[SUMO] Failed to open mobility trace: " << filePath);
+        return false;
+      }
+
+    const SumoFcdParseStats& stats = loader.GetStats ();
+    NS_LOG_UNCOND ("[SUMO] Parsed " << stats.bytes / (1024.0 * 1024.0) << " MB ("
+                   << stats.vehicles << " vehicle records) in " << stats.seconds << " s, "
+                   << stats.GetThroughputMBps () << " MB/s"
+                   << (loader.GetChunkCount () > 1
+                           ? ", " + std::to_string (loader.GetChunkCount ()) + " chunks in parallel"
+                           : std::string ()));
+    if (stats.skippedVehicles > 0)
+      {
+        NS_LOG_UNCOND ("[SUMO] Resampled to " << m_envStepTime << "s, skipped "
+                       << stats.skippedVehicles << " vehicle records of finer timesteps");
+      }
+    if (loader.GetDroppedSamples () > 0)
+      {
+        NS_LOG_UNCOND ("[SUMO] Dropped " << loader.GetDroppedSamples ()
+                       << " samples with out-of-order timesteps");
+      }
+    return true;
+  }
+
+  /// Write the parsed trajectory as a compiled trace stamped with its source.
+  bool
+  Compile (const std::string& sourcePath, const std::string& cachePath) const
+  {
+    uint64_t sourceSize = 0;
+    int64_t sourceMtime = 0;
+    if (!SumoTraceCacheFile::GetSourceStamp (sourcePath, sourceSize, sourceMtime)
+        || !SumoTraceCacheFile::Write (cachePath, m_data.GetView (), sourceSize, sourceMtime,
+                                       m_envStepTime))
+      {
+        NS_LOG_UNCOND ("[SUMO] Failed to write compiled trace: " << cachePath);
+        return false;
+      }
+    NS_LOG_UNCOND ("[SUMO] Compiled trace written to " << cachePath);
+    return true;
+  }
+
+  /**
+   * Map a compiled trace, or the up-to-date cache sidecar of an XML trace,
+   * or parse the XML and refresh the sidecar. Returns false when no samples
+   * could be loaded.
+   */
+  bool
+  Load (const std::string& filePath, bool useTraceCache)
+  {
+    m_view = SumoTrajectoryView ();
+    m_cache.Close ();
+    m_data.Clear ();
+
+    if (SumoTraceCacheFile::IsCacheFile (filePath))
+      {
+        if (!m_cache.Open (filePath))
+          {
+            NS_LOG_UNCOND ("[SUMO] Invalid or unsupported compiled trace: " << filePath);
+            return false;
+          }
+        if (!m_cache.MatchesEnvStep (m_envStepTime))
+          {
+            // Replaying it would run every step at the wrong trace time
+            NS_LOG_UNCOND ("[SUMO] Compiled trace " << filePath << " was binned with env step "
+                           << m_cache.GetHeader ().envStepTime << "s, running with " << m_envStepTime
+                           << "s; recompile it at this env step");
+            m_cache.Close ();
+            return false;
+          }
+        m_view = m_cache.GetView ();
+        NS_LOG_UNCOND ("[SUMO] Mapped compiled trace (" << m_cache.GetMappedSize () << " bytes)");
+      }
+    else
+      {
+        std::string sidecarPath = SumoTraceCacheFile::GetSidecarPath (filePath);
+        bool cached = useTraceCache && m_cache.Open (sidecarPath);
+        if (cached && !m_cache.MatchesEnvStep (m_envStepTime))
+          {
+            NS_LOG_UNCOND ("[SUMO] Trace cache " << sidecarPath << " was binned with env step "
+                           << m_cache.GetHeader ().envStepTime << "s, recompiling");
+          }
+        if (cached && m_cache.MatchesSource (filePath, m_envStepTime))
+          {
+            m_view = m_cache.GetView ();
+            NS_LOG_UNCOND ("[SUMO] Mapped trace cache " << sidecarPath << " ("
+                           << m_cache.GetMappedSize () << " bytes)");
+          }
+        else
+          {
+            m_cache.Close ();
+            if (!Parse (filePath))
+              {
+                return false;
+              }
+            m_view = m_data.GetView ();
+            if (useTraceCache)
+              {
+                Compile (filePath, sidecarPath);
+              }
+          }
+      }
+
+    NS_LOG_UNCOND ("[SUMO] Loaded mobility trace: " << m_view.vehicleCount << " vehicles, "
+                   << m_view.timestepCount << " timesteps from " << filePath);
+    if (m_view.sampleCount > 0)
+      {
+        uint64_t storageBytes = m_view.GetStorageBytes ();
+        NS_LOG_UNCOND ("[SUMO] Trajectory store: " << m_view.sampleCount << " samples, "
+                       << storageBytes / (1024.0 * 1024.0) << " MB ("
+                       << static_cast<double> (storageBytes) / m_view.sampleCount
+                       << " bytes per vehicle-timestep)");
+      }
+    return !m_view.IsEmpty ();
+  }
+
+  /// Replay a trajectory parsed elsewhere, taking over its arrays.
+  void
+  Adopt (SumoTrajectoryData&& data)
+  {
+    m_cache.Close ();
+    m_data = std::move (data);
+    m_view = m_data.GetView ();
+  }
+
+  bool
+  IsEmpty () const
+  {
+    return m_view.IsEmpty ();
+  }
+
+  /// The loaded trajectory; points into the owned arrays or the mapped file.
+  const SumoTrajectoryView&
+  GetView () const
+  {
+    return m_view;
+  }
+
+  uint32_t
+  GetVehicleCount () const
+  {
+    return m_view.vehicleCount;
+  }
+
+  double
+  GetEnvStepTime () const
+  {
+    return m_envStepTime;
+  }
+
+  /// Time of the last trace step.
+  double
+  GetMaxTime () const
+  {
+    return m_view.timestepCount > 0 ? m_envStepTime * (m_view.timestepCount - 1) : 0.0;
+  }
+
+  /**
+   * Steps [begin, end) of shard `shard` when the trace is cut into `shards`
+   * contiguous time shards. Lengths differ by at most one step, and the
+   * shards in order cover every step exactly once.
+   */
+  void
+  GetShard (uint32_t shard, uint32_t shards, uint32_t& begin, uint32_t& end) const
+  {
+    uint64_t steps = m_view.timestepCount;
+    begin = static_cast<uint32_t> (steps * shard / shards);
+    end = static_cast<uint32_t> (steps * (shard + 1) / shards);
+  }
+
+  /**
+   * Index the loaded samples by node for TraceReplayMobilityModel. Nodes are
+   * the slots of slotMap when one is given, trajectory vehicles otherwise.
+   */
+  void
+  BuildNodeTracks (uint32_t nodeCount, const SumoSlotMap* slotMap = nullptr)
+  {
+    m_tracks.Build (m_view, nodeCount, slotMap);
+    NS_LOG_UNCOND ("[SUMO] Node tracks for on-demand positions: "
+                   << m_tracks.GetStorageBytes () / (1024.0 * 1024.0) << " MB");
+  }
+
+  /**
+   * Aggregate a TraceReplayMobilityModel to every node of a pool, node i
+   * following track i, with trace step startStep replayed at the current
+   * time. The returned timeline moves the whole pool to another start.
+   */
+  Ptr<SumoReplayTimeline>
+  InstallMobility (const NodeContainer& nodes, uint32_t startStep, bool loop) const
+  {
+    Ptr<SumoReplayTimeline> timeline =
+        Create<SumoReplayTimeline> (m_view, m_tracks, m_envStepTime, loop, m_interpolate);
+    timeline->SetStart (startStep, Simulator::Now ());
+    AttachMobility (nodes, 0, timeline);
+    return timeline;
+  }
+
+  /// Aggregate a TraceReplayMobilityModel on timeline to nodes first.. of a pool, node i following track i.
+  static void
+  AttachMobility (const NodeContainer& nodes, uint32_t first, Ptr<SumoReplayTimeline> timeline)
+  {
+    for (uint32_t i = first; i < nodes.GetN (); ++i)
+      {
+        Ptr<TraceReplayMobilityModel> mobility = CreateObject<TraceReplayMobilityModel> ();
+        mobility->SetTrack (timeline, i);
+        nodes.Get (i)->AggregateObject (mobility);
+      }
+  }
+
+  /**
+   * Call fn (vehicle, x, y, speed, type) for every vehicle of a trace step.
+   * Steps past the end hold the last step, or wrap around with loop.
+   */
+  template <typename Fn>
+  void
+  ForEachSample (uint32_t timestep, bool loop, Fn&& fn)
+  {
+    uint32_t steps = m_view.timestepCount;
+    if (steps == 0)
+      {
+        return;
+      }
+    uint32_t step = loop ? timestep % steps : std::min (timestep, steps - 1);
+    m_sampler.ForEachSample (m_view, step, m_interpolate, fn);
+  }
+
+private:
+  double m_envStepTime = 0.1;
+  uint32_t m_parseThreads = 0; // 0 = one per core
+  bool m_interpolate = true;   // interpolate env steps between coarse trace steps
+  SumoTrajectoryView m_view;   // points into m_data or the mapped m_cache
+  SumoTrajectoryData m_data;   // owns the arrays when parsed from XML
+  SumoTraceCacheFile m_cache;  // owns the mapping when loaded from a compiled file
+  SumoTrajectorySampler m_sampler;
+  SumoNodeTracks m_tracks;     // node-major index read by TraceReplayMobilityModel
+};
+
+/**
+ * Applies replayed samples to the metrics of one node pool. Samples of
+ * vehicles mapped past the pool are dropped. Reset the metrics before a
+ * step so vehicles absent from it stay inactive. A pool reserved empty
+ * gets its nodes when the first vehicle enters them: with SetTimeline they
+ * follow their track on it, with SetPushPositions the samples are set on
+ * constant position models of the nodes.
+ */
+class V2xReplayTarget
+{
+public:
+  V2xReplayTarget (NodeContainer& nodes, std::vector<VehicleMetrics>& metrics, uint32_t nodeCount,
+                   const SumoSlotMap* slotMap = nullptr, SumoSlotOccupancy* occupancy = nullptr)
+    : m_nodes (nodes),
+      m_metrics (metrics),
+      m_nodeCount (std::min<uint32_t> (nodeCount, metrics.size ())),
+      m_slotMap (slotMap),
+      m_occupancy (occupancy)
+  {
+  }
+
+  /// Push positions into the nodes, for pools without TraceReplayMobilityModel.
+  void
+  SetPushPositions (bool push)
+  {
+    m_pushPositions = push;
+  }
+
+  /// Timeline the pool's TraceReplayMobilityModels follow, given to the nodes created here.
+  void
+  SetTimeline (Ptr<SumoReplayTimeline> timeline)
+  {
+    m_timeline = timeline;
+  }
+
+  /// Whether every node a sample was applied to exists in the pool.
+  bool
+  HasAllNodes () const
+  {
+    return m_appliedNodes <= m_nodes.GetN ();
+  }
+
+  void
+  operator() (uint32_t vehicle, float x, float y, float speed, uint16_t = 0) const
+  {
+    uint32_t nodeIndex = vehicle;
+    if (m_slotMap != nullptr)
+      {
+        nodeIndex = m_slotMap->GetSlot (vehicle);
+        if (m_occupancy != nullptr)
+          {
+            m_occupancy->Set (nodeIndex, vehicle);
+          }
+      }
+    if (nodeIndex >= m_nodeCount)
+      {
+        return;
+      }
+    VehicleMetrics& metrics = m_metrics[nodeIndex];
+    metrics.position = Vector (x, y, 0.0);
+    metrics.speed = speed;
+    metrics.active = true;
+    m_appliedNodes = std::max (m_appliedNodes, nodeIndex + 1);
+    if (nodeIndex >= m_nodes.GetN () && (m_pushPositions || m_timeline))
+      {
+        // A pool reserved empty gets its node when the first vehicle enters it
+        uint32_t first = m_nodes.GetN ();
+        m_nodes.Create (nodeIndex + 1 - first);
+        if (m_timeline)
+          {
+            V2xTraceReplay::AttachMobility (m_nodes, first, m_timeline);
+          }
+      }
+    if (!m_pushPositions)
+      {
+        return;
+      }
+
+    Ptr<Node> node = m_nodes.Get (nodeIndex);
+    Ptr<ConstantPositionMobilityModel> constant =
+        DynamicCast<ConstantPositionMobilityModel> (node->GetObject<MobilityModel> ());
+    if (!constant)
+      {
+        constant = CreateObject<ConstantPositionMobilityModel> ();
+        node->AggregateObject (constant);
+      }
+    constant->SetPosition (metrics.position);
+  }
+
+private:
+  NodeContainer& m_nodes;
+  std::vector<VehicleMetrics>& m_metrics;
+  uint32_t m_nodeCount;
+  const SumoSlotMap* m_slotMap;
+  SumoSlotOccupancy* m_occupancy;
+  bool m_pushPositions = false;
+  Ptr<SumoReplayTimeline> m_timeline;
+  mutable uint32_t m_appliedNodes = 0; // highest node index a sample was applied to, plus one
+};
+
+} // namespace ns3
+
+#endif /* V2X_TRACE_REPLAY_H */
@@ -0,0 +1,281 @@
+/* -*-  Mode: C++; c-file-style: "gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Fork-after-load worker pool for the V2X OpenGym examples
+ *
+ * A supervisor process loads the trace once and then forks worker
+ * simulations, each serving its own OpenGym port. Everything built before
+ * the fork (trajectory arrays, slot map, node tracks) is shared with the
+ * workers copy-on-write, and nothing writes to it during a run, so the
+ * pages stay shared. A compiled trace is one read-only mapping of the page
+ * cache either way. N workers then cost one load and one copy of the
+ * trajectory instead of N.
+ *
+ * The supervisor never runs a simulation. It restarts workers that crash,
+ * forwards SIGINT and SIGTERM to them, and logs the step rate of every
+ * worker from counters kept in a shared anonymous mapping.
+ */
+
+#ifndef V2X_WORKER_POOL_H
+#define V2X_WORKER_POOL_H
+
+#include "ns3/core-module.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace ns3 {
+
+class V2xWorkerPool
+{
+public:
+  /// Run's return value in the supervisor process.
+  static constexpr int kSupervisor = -1;
+
+  /**
+   * Fork workerCount workers. In a worker Run returns its index right away.
+   * In the supervisor it returns kSupervisor once every worker has exited,
+   * after restarting crashed workers up to maxRestarts times each. Step
+   * rates are logged every reportInterval seconds (0 disables the log).
+   */
+  int
+  Run (uint32_t workerCount, double reportInterval, uint32_t maxRestarts)
+  {
+    m_workers.assign (workerCount, Worker ());
+    m_counters = static_cast<Counter*> (::mmap (nullptr, sizeof (Counter) * workerCount,
+                                                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                                                -1, 0));
+    if (m_counters == MAP_FAILED)
+      {
+        NS_LOG_UNCOND ("[Workers] Cannot map the step counters");
+        m_counters = nullptr;
+        m_failed = true;
+        return kSupervisor;
+      }
+    for (uint32_t i = 0; i < workerCount; ++i)
+      {
+        new (&m_counters[i]) Counter ();
+      }
+
+    StopRequested () = 0;
+    std::signal (SIGINT, [] (int) { StopRequested () = 1; });
+    std::signal (SIGTERM, [] (int) { StopRequested () = 1; });
+    for (uint32_t i = 0; i < workerCount; ++i)
+      {
+        if (Spawn (i))
+          {
+            return static_cast<int> (i);
+          }
+      }
+    NS_LOG_UNCOND ("[Workers] Forked " << workerCount << " workers from supervisor pid "
+                   << ::getpid ());
+    return Supervise (reportInterval, maxRestarts);
+  }
+
+  /// Count one env step of this worker; does nothing outside a worker.
+  void
+  CountStep ()
+  {
+    if (m_stepCounter != nullptr)
+      {
+        m_stepCounter->fetch_add (1, std::memory_order_relaxed);
+      }
+  }
+
+  /// Whether every worker finished with exit status 0.
+  bool
+  AllSucceeded () const
+  {
+    return !m_failed;
+  }
+
+private:
+  struct Counter
+  {
+    std::atomic<uint64_t> steps {0};
+  };
+  static_assert (std::atomic<uint64_t>::is_always_lock_free,
+                 "step counters are shared between processes");
+
+  struct Worker
+  {
+    pid_t pid = 0;
+    uint32_t restarts = 0;
+    uint64_t reportedSteps = 0;
+  };
+
+  static volatile std::sig_atomic_t&
+  StopRequested ()
+  {
+    static volatile std::sig_atomic_t requested = 0;
+    return requested;
+  }
+
+  /// Fork worker index; true in the new worker process.
+  bool
+  Spawn (uint32_t index)
+  {
+    // Buffered output would otherwise be written by both processes
+    std::cout.flush ();
+    std::clog.flush ();
+    std::fflush (nullptr);
+    pid_t pid = ::fork ();
+    if (pid < 0)
+      {
+        NS_LOG_UNCOND ("[Workers] fork failed for worker " << index);
+        m_failed = true;
+        return false;
+      }
+    if (pid == 0)
+      {
+        // Do not outlive the supervisor
+        ::prctl (PR_SET_PDEATHSIG, SIGTERM);
+        std::signal (SIGINT, SIG_DFL);
+        std::signal (SIGTERM, SIG_DFL);
+        m_stepCounter = &m_counters[index].steps;
+        return true;
+      }
+    m_workers[index].pid = pid;
+    return false;
+  }
+
+  int
+  Supervise (double reportInterval, uint32_t maxRestarts)
+  {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point lastReport = Clock::now ();
+    bool stopping = false;
+    while (GetLiveCount () > 0)
+      {
+        if (StopRequested () && !stopping)
+          {
+            stopping = true;
+            NS_LOG_UNCOND ("[Workers] Stopping " << GetLiveCount () << " workers");
+            for (const Worker& worker : m_workers)
+              {
+                if (worker.pid > 0)
+                  {
+                    ::kill (worker.pid, SIGTERM);
+                  }
+              }
+          }
+
+        int status = 0;
+        pid_t pid;
+        while ((pid = ::waitpid (-1, &status, WNOHANG)) > 0)
+          {
+            uint32_t index = FindWorker (pid);
+            if (index == m_workers.size ())
+              {
+                continue;
+              }
+            m_workers[index].pid = 0;
+            if (WIFEXITED (status) && WEXITSTATUS (status) == 0)
+              {
+                NS_LOG_UNCOND ("[Workers] Worker " << index << " finished");
+                continue;
+              }
+            std::string reason = WIFSIGNALED (status)
+                                     ? "signal " + std::to_string (WTERMSIG (status))
+                                     : "exit status " + std::to_string (WEXITSTATUS (status));
+            if (stopping || m_workers[index].restarts >= maxRestarts)
+              {
+                NS_LOG_UNCOND ("[Workers] Worker " << index << " ended with " << reason);
+                m_failed = m_failed || !stopping;
+                continue;
+              }
+            m_workers[index].restarts++;
+            NS_LOG_UNCOND ("[Workers] Worker " << index << " ended with " << reason
+                           << ", restart " << m_workers[index].restarts << " of " << maxRestarts);
+            if (Spawn (index))
+              {
+                return static_cast<int> (index);
+              }
+          }
+
+        std::this_thread::sleep_for (std::chrono::milliseconds (100));
+        double elapsed = std::chrono::duration<double> (Clock::now () - lastReport).count ();
+        if (reportInterval > 0.0 && elapsed >= reportInterval)
+          {
+            Report (elapsed);
+            lastReport = Clock::now ();
+          }
+      }
+    Report (std::chrono::duration<double> (Clock::now () - lastReport).count ());
+    return kSupervisor;
+  }
+
+  uint32_t
+  GetLiveCount () const
+  {
+    uint32_t live = 0;
+    for (const Worker& worker : m_workers)
+      {
+        live += worker.pid > 0 ? 1 : 0;
+      }
+    return live;
+  }
+
+  uint32_t
+  FindWorker (pid_t pid) const
+  {
+    uint32_t index = 0;
+    while (index < m_workers.size () && m_workers[index].pid != pid)
+      {
+        ++index;
+      }
+    return index;
+  }
+
+  /// Log the step rate of each worker since the last report, and the total.
+  void
+  Report (double elapsed)
+  {
+    if (elapsed <= 0.0)
+      {
+        return;
+      }
+    std::ostringstream rates;
+    uint64_t totalSteps = 0;
+    double totalRate = 0.0;
+    for (uint32_t i = 0; i < m_workers.size (); ++i)
+      {
+        Worker& worker = m_workers[i];
+        uint64_t steps = m_counters[i].steps.load (std::memory_order_relaxed);
+        double rate = (steps - worker.reportedSteps) / elapsed;
+        worker.reportedSteps = steps;
+        totalSteps += steps;
+        totalRate += rate;
+        rates << (i > 0 ? ", " : "") << i << ':' << rate;
+        if (worker.restarts > 0)
+          {
+            rates << " (" << worker.restarts << " restarts)";
+          }
+      }
+    NS_LOG_UNCOND ("[Workers] " << totalRate << " steps/s over " << GetLiveCount ()
+                   << " live workers, " << totalSteps << " steps in total; per worker "
+                   << rates.str ());
+  }
+
+  std::vector<Worker> m_workers;                    // supervisor only
+  Counter* m_counters = nullptr;                    // one per worker, shared by all processes
+  std::atomic<uint64_t>* m_stepCounter = nullptr;   // this worker's counter
+  bool m_failed = false;
+};
+
+} // namespace ns3
+
+#endif /* V2X_WORKER_POOL_H */